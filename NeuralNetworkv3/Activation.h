@@ -19,6 +19,11 @@ namespace net
 		public:
 			virtual math::Matrix<double> Activate(math::Matrix<double> nodes) const = 0;
 			virtual math::Matrix<double> Derivative(math::Matrix<double> nodes) const = 0;
+			// outputs are Activate(nodes), activations whose derivative follows from them override this to skip the recomputation
+			virtual math::Matrix<double> Derivative(const math::Matrix<double>& nodes, [[maybe_unused]] const math::Matrix<double>& outputs) const
+			{
+				return Derivative(nodes);
+			}
 			virtual ACTIVATION_TYPE GetType() const = 0;
 		};
 	}
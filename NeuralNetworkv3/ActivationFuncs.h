@@ -30,6 +30,17 @@ namespace net
 				return res;
 			}
 
+			math::Matrix<double> Derivative([[maybe_unused]] const math::Matrix<double>& nodes, const math::Matrix<double>& outputs) const override
+			{
+				// the outputs are exactly the activations computed above, so no exp is needed
+				math::Matrix<double> res{ outputs.GetRows(), outputs.GetColumns() };
+				for (size_t i = 0; i < outputs.GetSize(); i++)
+				{
+					res[i] = outputs[i] * (1.0 - outputs[i]);
+				}
+				return res;
+			}
+
 			ACTIVATION_TYPE GetType() const override
 			{
 				return ACTIVATION_TYPE::SIGMOID;
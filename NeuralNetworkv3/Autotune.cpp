@@ -0,0 +1,245 @@
+#include "Autotune.h"
+#include "Bench.h"
+#include "Parallel.h"
+#include <fstream>
+#include <sstream>
+#include <filesystem>
+#include <algorithm>
+#include <stdexcept>
+
+#ifdef _WIN32
+#include <intrin.h>
+#endif
+
+namespace
+{
+	volatile double _sink = 0.0;
+
+	bool SameShape(const util::tune::Shape& a, const util::tune::Shape& b)
+	{
+		return a.M == b.M && a.N == b.N && a.K == b.K && a.transposedB == b.transposedB;
+	}
+}
+
+std::string util::tune::CpuModel()
+{
+	std::string model = "unknown";
+#ifdef _WIN32
+	int regs[4] = {};
+	char brand[49] = {};
+	__cpuid(regs, 0x80000000);
+	if ((unsigned)regs[0] >= 0x80000004)
+	{
+		for (int i = 0; i < 3; i++)
+		{
+			__cpuid((int*)(brand + 16 * i), 0x80000002 + i);
+		}
+		model = brand;
+	}
+#else
+	std::ifstream cpuinfo{ "/proc/cpuinfo" };
+	std::string line;
+	while (std::getline(cpuinfo, line))
+	{
+		if (line.rfind("model name", 0) == 0)
+		{
+			model = line.substr(line.find(':') + 2);
+			break;
+		}
+	}
+#endif
+	model.erase(0, model.find_first_not_of(' '));
+	std::replace(model.begin(), model.end(), '\t', ' ');
+	return model + " x" + std::to_string(util::HardwareThreads());
+}
+
+std::vector<util::tune::Shape> util::tune::ShapesOf(const std::vector<size_t>& layer_c)
+{
+	std::vector<Shape> shapes;
+	for (size_t i = 1; i < layer_c.size(); i++)
+	{
+		size_t in = layer_c[i - 1], out = layer_c[i];
+		shapes.push_back({ 1, out, in, false }); // input * weights
+		if (i > 1)
+		{
+			shapes.push_back({ 1, in, out, true }); // node values * weights^T
+		}
+		shapes.push_back({ in, out, 1, false }); // outputs^T * node values
+	}
+	return shapes;
+}
+
+math::GemmConfig util::tune::Tune(const Shape& shape, std::ostream* log)
+{
+	math::DMatrix A{ shape.M, shape.K, 0.5 };
+	math::DMatrix B = shape.transposedB ? math::DMatrix{ shape.N, shape.K, 0.25 } : math::DMatrix{ shape.K, shape.N, 0.25 };
+	math::DMatrix C{ shape.M, shape.N };
+	math::ConstDMatrixView b = shape.transposedB ? math::ConstDMatrixView{ B }.Transposed() : math::ConstDMatrixView{ B };
+
+	std::vector<math::GemmConfig> candidates;
+	std::vector<size_t> threads;
+	for (size_t t = 1; t <= util::HardwareThreads(); t *= 2)
+	{
+		threads.push_back(t);
+	}
+	if (threads.back() != util::HardwareThreads())
+	{
+		threads.push_back(util::HardwareThreads());
+	}
+
+	for (size_t t : threads)
+	{
+		if (shape.transposedB)
+		{
+			for (size_t lanes : { 1, 2, 4, 8 })
+			{
+				candidates.push_back({ 256, 1024, lanes, t });
+			}
+			continue;
+		}
+		for (size_t blockK : { (size_t)64, (size_t)256, shape.K })
+		{
+			for (size_t blockN : { (size_t)256, (size_t)1024, shape.N })
+			{
+				candidates.push_back({ std::max<size_t>(1, blockK), std::max<size_t>(1, blockN), 1, t });
+			}
+		}
+	}
+
+	// five runs of roughly 0.2 ms per candidate, the median keeps one preempted run from picking the config
+	size_t iterations = std::max<size_t>(1, (size_t)2e5 / std::max<size_t>(1, shape.M * shape.N * shape.K));
+	const size_t repeats = 5;
+
+	math::GemmConfig best;
+	double bestNs = -1.0;
+	for (const math::GemmConfig& config : candidates)
+	{
+		double ns = util::bench::MedianNs([&] {
+			math::Gemm<double>(C, A, b, 1.0, 0.0, config);
+			_sink = _sink + C[0];
+		}, iterations, repeats);
+		if (bestNs < 0.0 || ns < bestNs)
+		{
+			bestNs = ns;
+			best = config;
+		}
+	}
+
+	if (log)
+	{
+		*log << "tuned " << shape.M << 'x' << shape.K << (shape.transposedB ? " * T" : " * ") << shape.K << 'x' << shape.N
+			<< ": blockK " << best.blockK << " blockN " << best.blockN << " lanes " << best.lanes << " threads " << best.threads
+			<< " (" << bestNs << " ns)\n";
+	}
+	return best;
+}
+
+std::vector<util::tune::Entry> util::tune::LoadCache(const std::string& path)
+{
+	// cpu \t M N K transposed \t blockK blockN lanes threads
+	std::vector<Entry> entries;
+	std::ifstream in{ path };
+	std::string line;
+	while (std::getline(in, line))
+	{
+		std::istringstream fields{ line };
+		std::string cpu, shape, config;
+		if (!std::getline(fields, cpu, '\t') || !std::getline(fields, shape, '\t') || !std::getline(fields, config))
+		{
+			continue;
+		}
+		Entry entry;
+		entry.cpu = cpu;
+		std::istringstream s{ shape }, c{ config };
+		if ((s >> entry.shape.M >> entry.shape.N >> entry.shape.K >> entry.shape.transposedB) &&
+			(c >> entry.config.blockK >> entry.config.blockN >> entry.config.lanes >> entry.config.threads))
+		{
+			entries.push_back(entry);
+		}
+	}
+	return entries;
+}
+
+void util::tune::SaveCache(const std::string& path, const std::vector<Entry>& entries)
+{
+	std::string temp = path + ".tmp";
+	{
+		std::ofstream out{ temp };
+		if (!out)
+		{
+			throw std::runtime_error("cannot open " + temp + " for writing");
+		}
+		for (const Entry& e : entries)
+		{
+			out << e.cpu << '\t' << e.shape.M << ' ' << e.shape.N << ' ' << e.shape.K << ' ' << e.shape.transposedB << '\t'
+				<< e.config.blockK << ' ' << e.config.blockN << ' ' << e.config.lanes << ' ' << e.config.threads << '\n';
+		}
+		out.close();
+		if (!out)
+		{
+			std::error_code ec;
+			std::filesystem::remove(temp, ec);
+			throw std::runtime_error("cannot write " + temp);
+		}
+	}
+
+	// a truncated temp file must never replace a good cache, so the rename only happens once the stream is known to be intact
+	std::error_code ec;
+	std::filesystem::rename(temp, path, ec);
+	if (ec)
+	{
+		std::filesystem::remove(temp, ec);
+		throw std::runtime_error("cannot replace " + path);
+	}
+}
+
+void util::tune::Autotune(const std::vector<size_t>& layer_c, const std::string& cachePath, bool force, std::ostream* log)
+{
+	std::string cpu = CpuModel();
+	std::vector<Entry> entries = LoadCache(cachePath);
+	bool changed = false;
+
+	for (const Shape& shape : ShapesOf(layer_c))
+	{
+		if (shape.M * shape.N * shape.K < math::gemmTuneThreshold)
+		{
+			continue; // always runs with the default config
+		}
+
+		auto cached = std::find_if(entries.begin(), entries.end(), [&](const Entry& e) { return e.cpu == cpu && SameShape(e.shape, shape); });
+		if (cached == entries.end() || force)
+		{
+			math::GemmConfig config = Tune(shape, log);
+			if (cached == entries.end())
+			{
+				entries.push_back({ cpu, shape, config });
+			}
+			else
+			{
+				cached->config = config;
+			}
+			changed = true;
+			math::SetGemmConfig(shape.M, shape.N, shape.K, shape.transposedB, config);
+		}
+		else
+		{
+			math::SetGemmConfig(shape.M, shape.N, shape.K, shape.transposedB, cached->config);
+		}
+	}
+
+	if (changed)
+	{
+		// the tuned configs are registered already, an unwritable cache only means the next run tunes again
+		try
+		{
+			SaveCache(cachePath, entries);
+		}
+		catch (const std::runtime_error& e)
+		{
+			if (log)
+			{
+				*log << "autotune cache not saved: " << e.what() << '\n';
+			}
+		}
+	}
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include "Matrix.h"
+#include <string>
+#include <vector>
+#include <ostream>
+
+namespace util
+{
+	namespace tune
+	{
+		struct Shape
+		{
+			size_t M = 0;
+			size_t N = 0;
+			size_t K = 0;
+			bool transposedB = false;
+		};
+
+		struct Entry
+		{
+			std::string cpu;
+			Shape shape;
+			math::GemmConfig config;
+		};
+
+		std::string CpuModel(); // brand string plus hardware thread count, the cache key of this host
+
+		// the GEMMs a network of these layer sizes runs per sample: forward, backprop through the weights and the weight gradient
+		std::vector<Shape> ShapesOf(const std::vector<size_t>& layer_c);
+
+		// benchmarks the candidate configs for shape and returns the one with the lowest median time
+		math::GemmConfig Tune(const Shape& shape, std::ostream* log = nullptr);
+
+		std::vector<Entry> LoadCache(const std::string& path);
+		void SaveCache(const std::string& path, const std::vector<Entry>& entries); // throws std::runtime_error if the file cannot be written
+
+		// registers cached configs for this host, tunes the shapes that are missing (or all of them with force) and updates the cache
+		// a cache that cannot be written is reported to log and does not stop the tuned configs from being used
+		void Autotune(const std::vector<size_t>& layer_c, const std::string& cachePath = "autotune.cache", bool force = false, std::ostream* log = nullptr);
+	}
+}
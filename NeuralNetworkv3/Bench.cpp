@@ -0,0 +1,892 @@
+#include "Bench.h"
+#include "Network.h"
+#include "ActivationFuncs.h"
+#include "CostFuncs.h"
+#include "Prune.h"
+#include "Ensemble.h"
+#include "Pipeline.h"
+#include "ModelHandle.h"
+#include "MixedNetwork.h"
+#include "Replicas.h"
+#include <cstdio>
+#include <cmath>
+#include <vector>
+#include <iomanip>
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <atomic>
+
+namespace
+{
+	volatile double _sink = 0.0; // keeps the optimizer from dropping the benchmarked work
+
+	// the matrix storage before inline buffers and aligned blocks: every matrix is a std::vector on the heap
+	struct HeapMatrix
+	{
+		std::vector<double> values;
+		size_t rows;
+		size_t columns;
+
+		HeapMatrix(size_t rows, size_t columns, double init = 0.0)
+			: values(rows * columns, init), rows(rows), columns(columns)
+		{}
+
+		double& operator[](size_t index) { return values[index]; }
+		const double& operator[](size_t index) const { return values[index]; }
+		size_t GetRows() const { return rows; }
+		size_t GetColumns() const { return columns; }
+		size_t GetSize() const { return values.size(); }
+	};
+
+	// sigmoid(input * weights + biases) the way Layer::Forward used to compute it, a fresh matrix for every step,
+	// so the only difference between the two storages is where those matrices live
+	template<typename M>
+	M NaiveForward(const M& input, const M& weights, const M& biases)
+	{
+		M product{ input.GetRows(), weights.GetColumns() };
+		for (size_t i = 0; i < input.GetRows(); i++)
+		{
+			for (size_t j = 0; j < weights.GetColumns(); j++)
+			{
+				for (size_t k = 0; k < weights.GetRows(); k++)
+				{
+					product[i * weights.GetColumns() + j] += input[i * input.GetColumns() + k] * weights[k * weights.GetColumns() + j];
+				}
+			}
+		}
+		M weighted{ product.GetRows(), product.GetColumns() };
+		for (size_t i = 0; i < weighted.GetSize(); i++)
+		{
+			weighted[i] = product[i] + biases[i];
+		}
+		M res{ weighted.GetRows(), weighted.GetColumns() };
+		for (size_t i = 0; i < res.GetSize(); i++)
+		{
+			res[i] = 1.0 / (1.0 + std::exp(-weighted[i]));
+		}
+		return res;
+	}
+}
+
+void util::bench::Storage(std::ostream& out)
+{
+	out << "-- matrix storage (inline size " << MATRIX_INLINE_SIZE << ", heap alignment " << math::mem::matrixAlign << ")\n";
+
+	double vec = TimeNs([] {
+		std::vector<double> input{ 4.0, 2.0 };
+		std::vector<double> expected{ 1.0, 0.0 };
+		_sink = _sink + input[0] + expected[0];
+	}, 1000000);
+	double dp = TimeNs([] {
+		util::DataPoint<double> dp{ {{ 4.0, 2.0 }, 1, 2}, {{ 1.0, 0.0 }, 1, 2} };
+		_sink = _sink + dp.input[0] + dp.expected[0];
+	}, 1000000);
+	out << "DataPoint 1x2: " << std::setw(10) << dp << " ns (two heap vectors: " << vec << " ns)\n";
+
+	for (size_t n : { 2, 8, 64, 512, 1024 })
+	{
+		net::actf::Sigmoid sigmoid;
+		net::Layer in{ n };
+		net::Layer layer{ in, math::DMatrix{ 1, n }, n };
+		math::DMatrix input{ 1, n, 0.5 };
+
+		size_t iterations = std::max<size_t>(10, 20000000 / (n * n));
+		double t = TimeNs([&] {
+			_sink = _sink + layer.Forward(input, sigmoid)[0];
+		}, iterations);
+
+		// the same naive step on both storages, before and after the change
+		HeapMatrix heapInput{ 1, n, 0.5 }, heapWeights{ n, n }, heapBiases{ 1, n };
+		std::copy(layer.GetWeights().begin(), layer.GetWeights().end(), heapWeights.values.begin());
+		const math::DMatrix& weights = layer.GetWeights();
+		const math::DMatrix biases{ 1, n };
+		double heap = TimeNs([&] {
+			_sink = _sink + NaiveForward(heapInput, heapWeights, heapBiases)[0];
+		}, iterations);
+		double storage = TimeNs([&] {
+			_sink = _sink + NaiveForward(input, weights, biases)[0];
+		}, iterations);
+
+		bool aligned = layer.GetWeights().IsInline() || (size_t)layer.GetWeights().GetData() % math::mem::matrixAlign == 0;
+		out << "Layer::Forward " << n << "x" << n << ": " << std::setw(12) << t << " ns"
+			<< (layer.GetWeights().IsInline() ? " inline" : aligned ? " aligned" : " unaligned")
+			<< ", naive step: heap vectors " << std::setw(12) << heap << " ns, matrix storage " << std::setw(12) << storage << " ns ("
+			<< heap / storage << "x)\n";
+	}
+}
+
+void util::bench::Init(std::ostream& out)
+{
+	out << "-- weight init (" << util::HardwareThreads() << " threads)\n";
+
+	for (size_t n : { 256, 1024, 4096 })
+	{
+		net::Layer in{ n };
+		uint64_t checksum = 0;
+		double t = TimeNs([&] {
+			net::Layer layer{ in, math::DMatrix{ 1, n }, n, -1.0, 1.0, 42 };
+			checksum = 0;
+			for (double w : layer.GetWeights())
+			{
+				checksum = checksum * 31 + (uint64_t)(w * 1e9);
+			}
+		}, 5);
+		out << "Layer " << n << "x" << n << ": " << std::setw(12) << t / 1e6 << " ms, checksum " << checksum << '\n';
+	}
+}
+
+void util::bench::Cache(std::ostream& out)
+{
+	out << "-- inference cache (integer inputs 0..10, 121 distinct)\n";
+
+	std::vector<util::DataPoint<double>> data;
+	util::Philox gen{ SEED, 7 };
+	for (size_t i = 0; i < 20000; i++)
+	{
+		data.push_back({ { { (double)(gen() % 11), (double)(gen() % 11) }, 1, 2 }, { { 0.0, 0.0 }, 1, 2 } });
+	}
+
+	for (size_t hidden : { 3, 64, 256 })
+	{
+		net::cost::MSE<double> mse;
+		net::Network network{ { 2, hidden, hidden, 2 }, &mse, std::make_unique<net::actf::Sigmoid>(), std::make_unique<net::actf::Sigmoid>() };
+
+		double plain = TimeNs([&] {
+			network.CalculateOutputs(data);
+			_sink = _sink + data[0].output[0];
+		}, 3);
+
+		network.EnableCache(1024);
+		double cached = TimeNs([&] {
+			network.CalculateOutputs(data);
+			_sink = _sink + data[0].output[0];
+		}, 3);
+
+		net::CacheStats stats = network.GetCacheStats();
+		out << "2-" << hidden << "-" << hidden << "-2, 20000 samples: " << std::setw(10) << plain / 1e6 << " ms uncached, "
+			<< std::setw(10) << cached / 1e6 << " ms cached, hit rate " << stats.HitRate() * 100.0 << "%, "
+			<< stats.entries << " entries, " << stats.bytes << " bytes\n";
+	}
+}
+
+void util::bench::Sparse(std::ostream& out)
+{
+	out << "-- sparse vs dense Layer::Forward (* sparse is faster)\n";
+
+	for (size_t n : { 64, 256, 1024 })
+	{
+		double crossover = net::prune::MeasureCrossover(n, n, &out);
+		out << n << "x" << n << " crossover: sparse wins at density <= " << crossover << '\n';
+	}
+}
+
+void util::bench::ModelIO(std::ostream& out)
+{
+	out << "-- text model save/load\n";
+
+	net::cost::MSE<double> mse;
+	net::Network network{ { 784, 1024, 1024, 10 }, &mse, std::make_unique<net::actf::Sigmoid>(), std::make_unique<net::actf::Sigmoid>() };
+	const std::string path = "bench_model.txt";
+
+	double save = TimeNs([&] { network.Save(path); }, 3);
+	double load = TimeNs([&] { net::Network loaded{ path }; }, 3);
+
+	std::FILE* file = std::fopen(path.c_str(), "rb");
+	std::fseek(file, 0, SEEK_END);
+	double mb = std::ftell(file) / 1e6;
+	std::fclose(file);
+
+	// every weight has to come back bit for bit
+	net::Network loaded{ path };
+	net::Snapshot a, b;
+	network.TakeSnapshot(a);
+	loaded.TakeSnapshot(b);
+	bool exact = true;
+	for (size_t i = 1; i < a.weights.size(); i++)
+	{
+		exact = exact && a.weights[i] == b.weights[i] && a.biases[i] == b.biases[i];
+	}
+	std::remove(path.c_str());
+
+	// corrupt files must fail with std::runtime_error, never by reading out of bounds or allocating their claimed sizes
+	const std::vector<std::pair<const char*, const char*>> malformed{
+		{ "offset past the non-zeros", "csr\n3\n2 3 2\n0 0\n2\n0 5 2\n0 1\n1 1\n0 0 0\n1\n0 0 0 1\n0\n1\n0 0\n" },
+		{ "repeated column", "csr\n3\n2 3 2\n0 0\n2\n0 2 2\n1 1\n1 1\n0 0 0\n1\n0 0 0 1\n0\n1\n0 0\n" },
+		{ "huge layer", "3\n2 99999999999999 2\n0 0\n1\n0\n1\n0 0\n" }
+	};
+	size_t rejected = 0;
+	for (const auto& [name, text] : malformed)
+	{
+		{
+			std::ofstream file{ path };
+			file << text;
+		}
+		try
+		{
+			net::Network bad{ path };
+			out << "malformed model loaded: " << name << '\n';
+		}
+		catch (const std::runtime_error&)
+		{
+			rejected++;
+		}
+	}
+	std::remove(path.c_str());
+
+	out << "784-1024-1024-10 (" << mb << " MB): save " << std::setw(10) << save / 1e6 << " ms (" << mb / (save / 1e9) << " MB/s), load "
+		<< std::setw(10) << load / 1e6 << " ms (" << mb / (load / 1e9) << " MB/s), round trip " << (exact ? "exact" : "NOT exact")
+		<< ", " << rejected << "/" << malformed.size() << " malformed files rejected\n";
+}
+
+void util::bench::Slab(std::ostream& out)
+{
+	out << "-- gradient step over the parameter slab\n";
+
+	for (const std::vector<size_t>& sizes : std::vector<std::vector<size_t>>{ { 2, 3, 2 }, { 2, 16, 16, 16, 16, 2 }, { 784, 256, 256, 10 } })
+	{
+		net::cost::MSE<double> mse;
+		net::Network network{ sizes, &mse, std::make_unique<net::actf::Sigmoid>(), std::make_unique<net::actf::Sigmoid>() };
+		std::vector<util::DataPoint<double>> empty;
+
+		// an empty batch only applies and clears the gradients, one pass over each slab
+		size_t n = network.GetParameterSlab().GetSize();
+		size_t iterations = std::max<size_t>(10, 100000000 / n);
+		double slab = TimeNs([&] { network.Learn(empty, 0.01); }, iterations);
+
+		// the same step with a matrix per layer and a temporary per operation, as before the slab
+		std::vector<math::DMatrix> weights, grads;
+		for (size_t i = 1; i < sizes.size(); i++)
+		{
+			weights.emplace_back(sizes[i - 1], sizes[i], 0.5);
+			grads.emplace_back(sizes[i - 1], sizes[i], 0.1);
+			weights.emplace_back(1, sizes[i], 0.5);
+			grads.emplace_back(1, sizes[i], 0.1);
+		}
+		double matrices = TimeNs([&] {
+			for (size_t i = 0; i < weights.size(); i++)
+			{
+				weights[i] = weights[i] - grads[i] * 0.01;
+				grads[i] = math::DMatrix{ grads[i].GetRows(), grads[i].GetColumns() };
+			}
+			_sink = _sink + weights[0][0];
+		}, iterations);
+
+		out << sizes.size() << " layers, " << n << " slab doubles: " << std::setw(12) << slab << " ns slab, " << std::setw(12) << matrices
+			<< " ns per matrix, checksum " << std::hex << network.GetChecksum() << std::dec << '\n';
+	}
+}
+
+void util::bench::Ensemble(std::ostream& out)
+{
+	out << "-- ensemble training, 2-3-2 networks, one pass over 2000 samples in batches of 100 per model\n";
+
+	std::vector<std::vector<util::DataPoint<double>>> batches(20);
+	util::Philox gen{ SEED, 11 };
+	for (auto& batch : batches)
+	{
+		for (size_t i = 0; i < 100; i++)
+		{
+			double x = (double)(gen() % 11), y = (double)(gen() % 11);
+			batch.push_back({ { { x, y }, 1, 2 }, { { x < y ? 1.0 : 0.0, x < y ? 0.0 : 1.0 }, 1, 2 } });
+		}
+	}
+	net::cost::MSE<double> mse;
+
+	// one network at a time is the baseline
+	double single = TimeNs([&] {
+		net::Network network{ { 2, 3, 2 }, &mse, std::make_unique<net::actf::Sigmoid>(), std::make_unique<net::actf::Sigmoid>() };
+		for (auto& batch : batches)
+		{
+			network.Learn(batch, 0.05);
+		}
+	}, 5);
+	out << "separate networks: " << std::setw(12) << 1e9 / single << " models/s\n";
+
+	for (size_t K : { 1, 8, 64, 256 })
+	{
+		std::vector<double> rates(K);
+		std::vector<uint64_t> seeds(K);
+		for (size_t k = 0; k < K; k++)
+		{
+			rates[k] = 0.01 + 0.5 * k / K;
+			seeds[k] = k + 1;
+		}
+		double t = TimeNs([&] {
+			net::Ensemble ensemble{ { 2, 3, 2 }, &mse, net::actf::ACTIVATION_TYPE::SIGMOID, net::actf::ACTIVATION_TYPE::SIGMOID, rates, seeds };
+			for (auto& batch : batches)
+			{
+				ensemble.Learn(batch);
+			}
+		}, 3);
+		out << "ensemble K=" << std::setw(4) << K << ": " << std::setw(12) << K * 1e9 / t << " models/s (" << single * K / t << "x)\n";
+	}
+}
+
+void util::bench::Pipeline(std::ostream& out)
+{
+	out << "-- pipeline-parallel training, 64-256x8-10 sigmoid MLP, batch 256 (" << util::HardwareThreads() << " threads)\n";
+
+	std::vector<size_t> sizes{ 64 };
+	sizes.insert(sizes.end(), 8, 256);
+	sizes.push_back(10);
+
+	std::vector<util::DataPoint<double>> batch;
+	util::Philox gen{ SEED, 13 };
+	for (size_t i = 0; i < 256; i++)
+	{
+		math::DMatrix input{ 1, 64 }, expected{ 1, 10 };
+		for (double& v : input)
+		{
+			v = (gen() % 1000) / 1000.0;
+		}
+		expected[gen() % 10] = 1.0;
+		batch.push_back({ input, expected });
+	}
+	net::cost::MSE<double> mse;
+
+	net::Network reference{ sizes, &mse, std::make_unique<net::actf::Sigmoid>(), std::make_unique<net::actf::Sigmoid>() };
+	net::Snapshot initial;
+	reference.TakeSnapshot(initial);
+	double single = TimeNs([&] { reference.Learn(batch, 0.01); }, 3);
+	out << "Network::Learn: " << std::setw(10) << single / 1e6 << " ms per batch\n";
+
+	for (net::PIPELINE_SCHEDULE schedule : { net::PIPELINE_SCHEDULE::GPIPE, net::PIPELINE_SCHEDULE::ONE_F_ONE_B })
+	{
+		for (size_t stages : { 2, 4 })
+		{
+			for (size_t micro : { 1, 4, 16 })
+			{
+				net::Network network{ sizes, &mse, std::make_unique<net::actf::Sigmoid>(), std::make_unique<net::actf::Sigmoid>() };
+				network.Restore(initial);
+				net::Pipeline pipeline{ network, stages, schedule };
+				pipeline.Learn(batch, 0.01, micro); // warm up
+				pipeline.ClearStats();
+
+				double t = TimeNs([&] { pipeline.Learn(batch, 0.01, micro); }, 3);
+				out << std::setw(10) << t / 1e6 << " ms per batch (" << single / t << "x), ";
+				pipeline.Report(out);
+			}
+		}
+	}
+}
+
+void util::bench::Backward(std::ostream& out)
+{
+	out << "-- backward step through a hidden n x n sigmoid layer: weight gradients and the node values below it\n";
+
+	for (size_t n : { 64, 256, 1024, 2048 })
+	{
+		net::actf::Sigmoid sigmoid;
+		math::DMatrix weights{ n, n }, weighted{ 1, n }, inputs{ 1, n }, nodeValues{ 1, n };
+		util::FillUniform(weights.GetData(), weights.GetSize(), -1.0, 1.0, util::Philox{ SEED, 17 });
+		util::FillUniform(weighted.GetData(), n, -1.0, 1.0, util::Philox{ SEED, 18 });
+		util::FillUniform(nodeValues.GetData(), n, -1.0, 1.0, util::Philox{ SEED, 19 });
+		inputs = sigmoid.Activate(weighted);
+		math::DMatrix derivatives = sigmoid.Derivative(weighted, inputs);
+
+		// as before the fused kernel: an outer-product Gemm, a Gemm against the transposed weights and a recomputed derivative
+		math::DMatrix separateGrad{ n, n }, separateValues;
+		size_t iterations = std::max<size_t>(10, 200000000 / (n * n));
+		double separate = TimeNs([&] {
+			math::Gemm<double>(separateGrad, math::ConstDMatrixView{ inputs }.Transposed(), nodeValues, 1.0, 1.0);
+			math::DMatrix propagated{ 1, n };
+			math::Gemm<double>(propagated, nodeValues, math::ConstDMatrixView{ weights }.Transposed());
+			separateValues = propagated.Hadamard(sigmoid.Derivative(weighted));
+		}, iterations);
+
+		math::DMatrix fusedGrad{ n, n }, fusedValues{ 1, n };
+		double fused = TimeNs([&] {
+			math::FusedBackward<double>(weights, nodeValues, inputs, derivatives, fusedGrad, fusedValues);
+		}, iterations);
+
+		// the weights and the gradients are n x n each, the gradients are read and written
+		double mb = 3.0 * n * n * sizeof(double) / 1e6;
+		out << n << "x" << n << ": " << std::setw(10) << separate / 1e3 << " us in 2 sweeps (" << std::setw(8) << mb / (separate / 1e9) / 1e3 << " GB/s), "
+			<< std::setw(10) << fused / 1e3 << (n * n < math::fusedBackwardThreshold ? " us in 2 sweeps (" : " us in 1 sweep (") << std::setw(8) << mb / (fused / 1e9) / 1e3 << " GB/s), "
+			<< separate / fused << "x, " << (separateGrad == fusedGrad && separateValues == fusedValues ? "exact" : "NOT exact") << '\n';
+	}
+}
+
+void util::bench::Reload(std::ostream& out)
+{
+	out << "-- Feed latency while the model file is replaced every 50 ms, 2 reader threads for 1 s\n";
+
+	net::cost::MSE<double> mse;
+	net::Network first{ { 64, 512, 512, 10 }, &mse, std::make_unique<net::actf::Sigmoid>(), std::make_unique<net::actf::Sigmoid>() };
+	net::Network second{ { 64, 512, 512, 10 }, &mse, std::make_unique<net::actf::Sigmoid>(), std::make_unique<net::actf::Sigmoid>(), 0.0, 1 };
+	const std::string path = "bench_reload.txt", firstPath = "bench_reload_1.txt", secondPath = "bench_reload_2.txt";
+	first.Save(firstPath);
+	second.Save(secondPath);
+	std::filesystem::copy_file(firstPath, path, std::filesystem::copy_options::overwrite_existing);
+	math::DMatrix input{ 1, 64, 0.5 };
+
+	// runs feed on two threads for a second while swap optionally replaces the model every 50 ms
+	auto measure = [&](const std::string& name, auto&& feed, bool replace) {
+		std::atomic<bool> done{ false };
+		std::vector<std::vector<double>> latencies(2);
+		std::vector<std::thread> readers;
+		for (auto& samples : latencies)
+		{
+			readers.emplace_back([&] {
+				while (!done)
+				{
+					auto start = std::chrono::steady_clock::now();
+					feed();
+					samples.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count());
+				}
+			});
+		}
+		for (size_t i = 0; i < 20; i++)
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds{ 50 });
+			if (replace)
+			{
+				// written next to the target and renamed over it, so the handle never sees half a file
+				std::filesystem::copy_file(i % 2 ? firstPath : secondPath, path + ".tmp", std::filesystem::copy_options::overwrite_existing);
+				std::filesystem::rename(path + ".tmp", path);
+			}
+		}
+		done = true;
+		for (std::thread& reader : readers)
+		{
+			reader.join();
+		}
+
+		std::vector<double> all = latencies[0];
+		all.insert(all.end(), latencies[1].begin(), latencies[1].end());
+		std::sort(all.begin(), all.end());
+		out << name << ": " << std::setw(8) << all.size() << " feeds, p50 " << std::setw(8) << all[all.size() / 2] << " us, p99 " << std::setw(8)
+			<< all[all.size() * 99 / 100] << " us, max " << std::setw(10) << all.back() << " us\n";
+	};
+
+	{
+		net::ModelHandle handle{ path, std::chrono::milliseconds{ 10 } };
+		measure("handle, no reloads  ", [&] { _sink = _sink + handle.Feed(input)[0]; }, false);
+		measure("handle, reloading   ", [&] { _sink = _sink + handle.Feed(input)[0]; }, true);
+		out << "  " << handle.GetStats().reloads << " reloads, last load " << handle.GetStats().lastLoadSeconds * 1e3 << " ms\n";
+	}
+
+	// the usual alternative: one network behind a mutex, rebuilt under the lock when the file changes
+	{
+		std::mutex mtx;
+		auto network = std::make_unique<net::Network>(path);
+		std::atomic<bool> stop{ false };
+		std::thread watcher{ [&] {
+			auto seen = std::filesystem::last_write_time(path);
+			while (!stop)
+			{
+				std::this_thread::sleep_for(std::chrono::milliseconds{ 10 });
+				std::error_code ec;
+				auto time = std::filesystem::last_write_time(path, ec);
+				if (!ec && time != seen)
+				{
+					seen = time;
+					std::lock_guard<std::mutex> lock{ mtx };
+					network = std::make_unique<net::Network>(path);
+				}
+			}
+		} };
+		measure("mutex, reloading    ", [&] {
+			std::lock_guard<std::mutex> lock{ mtx };
+			_sink = _sink + network->Feed(input)[0];
+		}, true);
+		stop = true;
+		watcher.join();
+	}
+
+	for (const std::string& file : { path, firstPath, secondPath })
+	{
+		std::remove(file.c_str());
+	}
+}
+
+void util::bench::Trace(std::ostream& out)
+{
+	out << "-- tracing overhead\n";
+
+	double disabled = TimeNs([] { util::trace::Span span{ "bench", "bench" }; }, 10000000);
+	util::trace::Enable(1.0, (size_t)1 << 20);
+	double enabled = TimeNs([] { util::trace::Span span{ "bench", "bench" }; }, 100000);
+	util::trace::Disable();
+	util::trace::Clear();
+	out << "empty span: " << std::setw(8) << disabled << " ns disabled, " << std::setw(8) << enabled << " ns recorded\n";
+
+	for (const std::vector<size_t>& sizes : std::vector<std::vector<size_t>>{ { 2, 3, 2 }, { 64, 256, 256, 10 } })
+	{
+		std::vector<util::DataPoint<double>> batch;
+		util::Philox gen{ SEED, 23 };
+		for (size_t i = 0; i < 100; i++)
+		{
+			math::DMatrix input{ 1, sizes.front() }, expected{ 1, sizes.back() };
+			for (double& v : input)
+			{
+				v = (gen() % 1000) / 1000.0;
+			}
+			expected[gen() % sizes.back()] = 1.0;
+			batch.push_back({ input, expected });
+		}
+		net::cost::MSE<double> mse;
+		net::Network network{ sizes, &mse, std::make_unique<net::actf::Sigmoid>(), std::make_unique<net::actf::Sigmoid>() };
+
+		size_t iterations = sizes.size() == 3 ? 2000 : 20;
+		double off = TimeNs([&] { network.Learn(batch, 0.01); }, iterations);
+		out << sizes.size() << " layers, batch 100: " << std::setw(10) << off / 1e3 << " us per Learn untraced";
+		for (double rate : { 1.0, 0.1 })
+		{
+			util::trace::Enable(rate, (size_t)1 << 22);
+			double on = TimeNs([&] { network.Learn(batch, 0.01); }, iterations);
+			util::trace::Disable();
+			out << ", " << std::setw(10) << on / 1e3 << " us at rate " << rate << " (" << util::trace::GetStats().events << " events)";
+			util::trace::Clear();
+		}
+		out << '\n';
+	}
+}
+
+void util::bench::Mixed(std::ostream& out)
+{
+	out << "-- mixed precision training (" << math::half::Features() << ") vs double, same initial weights and batches\n";
+
+	// noisy samples around one random prototype per class, classes are told apart by the largest output
+	auto makeTask = [](size_t inputs, size_t classes, size_t samples, uint64_t stream) {
+		util::Philox gen{ SEED, stream };
+		std::vector<std::vector<double>> prototypes(classes, std::vector<double>(inputs));
+		for (auto& prototype : prototypes)
+		{
+			for (double& v : prototype)
+			{
+				v = (gen() % 1000) / 1000.0;
+			}
+		}
+		std::vector<util::DataPoint<double>> data;
+		for (size_t i = 0; i < samples; i++)
+		{
+			size_t c = gen() % classes;
+			math::DMatrix input{ 1, inputs }, expected{ 1, classes };
+			for (size_t k = 0; k < inputs; k++)
+			{
+				input[k] = prototypes[c][k] + ((gen() % 1000) / 1000.0 - 0.5) * 0.8;
+			}
+			expected[c] = 1.0;
+			data.push_back({ input, expected });
+		}
+		return data;
+	};
+	auto accuracy = [](const std::vector<util::DataPoint<double>>& data) {
+		size_t correct = 0;
+		for (const auto& dp : data)
+		{
+			auto predicted = std::max_element(dp.output.begin(), dp.output.end()) - dp.output.begin();
+			auto expected = std::max_element(dp.expected.begin(), dp.expected.end()) - dp.expected.begin();
+			correct += predicted == expected;
+		}
+		return (double)correct / data.size();
+	};
+
+	struct Task
+	{
+		std::vector<size_t> sizes;
+		size_t samples;
+		size_t epochs;
+		double learnRate; // Learn sums the gradients of a batch, so the rate is per sample
+		net::actf::ACTIVATION_TYPE hiddenType = net::actf::ACTIVATION_TYPE::SIGMOID;
+		net::actf::ACTIVATION_TYPE outputType = net::actf::ACTIVATION_TYPE::SIGMOID;
+		net::cost::COST_TYPE costType = net::cost::COST_TYPE::MSE;
+	};
+	// two sigmoid layers of 1024 saturate and never leave 10% accuracy, the wide task trains with ReLU and softmax instead
+	for (const Task& task : { Task{ { 16, 32, 4 }, 5000, 20, 0.1 }, Task{ { 64, 256, 10 }, 5000, 5, 0.003 },
+		Task{ { 784, 1024, 1024, 10 }, 2000, 2, 0.001, net::actf::ACTIVATION_TYPE::RELU, net::actf::ACTIVATION_TYPE::SOFTMAX, net::cost::COST_TYPE::CROSS_ENTROPY } })
+	{
+		// the last 1000 samples are held out, drawn around the same prototypes as the training samples
+		std::vector<util::DataPoint<double>> train = makeTask(task.sizes.front(), task.sizes.back(), task.samples + 1000, 29);
+		std::vector<util::DataPoint<double>> test{ train.begin() + task.samples, train.end() };
+		train.resize(task.samples);
+		std::vector<std::vector<util::DataPoint<double>>> batches;
+		for (size_t i = 0; i < train.size(); i += 100)
+		{
+			batches.emplace_back(train.begin() + i, train.begin() + std::min(train.size(), i + 100));
+		}
+
+		std::unique_ptr<net::cost::Cost<double>> cost = net::cost::GetCost<double>(task.costType);
+		net::Network network{ task.sizes, cost.get(), net::actf::GetActivation(task.hiddenType), net::actf::GetActivation(task.outputType) };
+		net::Snapshot initial;
+		network.TakeSnapshot(initial);
+
+		out << "task";
+		for (size_t l = 0; l < task.sizes.size(); l++)
+		{
+			out << (l == 0 ? " " : "-") << task.sizes[l];
+		}
+		out << ", " << task.samples << " samples x " << task.epochs << " epochs\n";
+
+		auto report = [&](const char* name, double seconds) {
+			out << "  " << name << ": " << std::setw(10) << task.samples * task.epochs / seconds << " samples/s, test cost " << std::setw(10)
+				<< cost->Calculate(test) << ", accuracy " << std::setw(6) << accuracy(test) * 100.0 << "%\n";
+		};
+
+		auto start = std::chrono::steady_clock::now();
+		for (size_t e = 0; e < task.epochs; e++)
+		{
+			for (auto& batch : batches)
+			{
+				network.Learn(batch, task.learnRate);
+			}
+		}
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		network.CalculateOutputs(test);
+		report("double", seconds);
+
+		for (math::HALF_FORMAT format : { math::HALF_FORMAT::BF16, math::HALF_FORMAT::FP16 })
+		{
+			net::MixedNetwork mixed{ initial, cost.get(), format };
+			start = std::chrono::steady_clock::now();
+			for (size_t e = 0; e < task.epochs; e++)
+			{
+				for (auto& batch : batches)
+				{
+					mixed.Learn(batch, task.learnRate);
+				}
+			}
+			seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			mixed.CalculateOutputs(test);
+			report(format == math::HALF_FORMAT::BF16 ? "bf16  " : "fp16  ", seconds);
+		}
+	}
+}
+
+void util::bench::Numa(std::ostream& out)
+{
+	using namespace util::numa;
+
+	Topology real = Discover();
+	out << "-- NUMA placement, " << real.nodes.size() << " node(s) found\n";
+	for (const Node& node : real.nodes)
+	{
+		out << "node " << node.physical << ": " << node.cpus.size() << " CPUs, " << node.memoryBytes / (1 << 20) << " MiB\n";
+	}
+
+	// a single node has nothing to be remote from, so two emulated nodes stand in for it, the timings then only show the overhead
+	Topology layout = real.nodes.size() >= 2 ? real : Emulate(real, 2);
+	if (layout.emulated)
+	{
+		out << "emulating " << layout.nodes.size() << " nodes on node " << real.nodes.front().physical << ", local and remote memory are the same here\n";
+	}
+
+	size_t threads = std::max(layout.nodes.size(), layout.GetCpuCount());
+	std::vector<int> cpus = AssignCpus(layout, threads, PIN_POLICY::SCATTER);
+	auto nodeOf = [&](size_t t) { return cpus[t] < 0 ? t % layout.nodes.size() : layout.NodeOfCpu(cpus[t]); };
+
+	// runs f(t) on threads pinned by the scatter policy, samples per second over all of them
+	auto measure = [&](size_t perThread, auto&& f) {
+		auto start = std::chrono::steady_clock::now();
+		std::vector<std::thread> workers;
+		for (size_t t = 0; t < threads; t++)
+		{
+			workers.emplace_back([&, t] {
+				PinThread(cpus[t]);
+				f(t);
+			});
+		}
+		for (std::thread& worker : workers)
+		{
+			worker.join();
+		}
+		return threads * perThread / std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	};
+
+	// inference threads on every node reading one copy of the weights, or each reading a replica
+	{
+		net::Network network{ { 784, 1024, 1024, 10 }, nullptr, std::make_unique<net::actf::Sigmoid>(), std::make_unique<net::actf::Sigmoid>() };
+		network.BindToNode((int)layout.nodes.front().physical);
+		net::Replicas replicas{ network, layout };
+		math::DMatrix input{ 1, 784, 0.5 };
+
+		out << "inference 784-1024-1024-10, " << threads << " threads, replicas on node";
+		for (size_t n = 0; n < replicas.GetNodeCount(); n++)
+		{
+			out << ' ' << replicas.GetPlacement(n);
+		}
+		out << '\n';
+
+		const size_t iterations = 200;
+		double shared = measure(iterations, [&](size_t) {
+			for (size_t i = 0; i < iterations; i++)
+			{
+				_sink = _sink + network.Infer(input)[0];
+			}
+		});
+		double remote = measure(iterations, [&](size_t t) {
+			for (size_t i = 0; i < iterations; i++)
+			{
+				_sink = _sink + replicas.Infer(input, (nodeOf(t) + 1) % layout.nodes.size())[0];
+			}
+		});
+		double local = measure(iterations, [&](size_t t) {
+			for (size_t i = 0; i < iterations; i++)
+			{
+				_sink = _sink + replicas.Infer(input, nodeOf(t))[0];
+			}
+		});
+		out << "  one copy on node 0: " << std::setw(10) << shared << " samples/s\n";
+		out << "  replica, remote:    " << std::setw(10) << remote << " samples/s\n";
+		out << "  replica, local:     " << std::setw(10) << local << " samples/s\n";
+	}
+
+	// one network per worker, e.g. a hyperparameter sweep: built by the main thread, or bound to the worker's node
+	{
+		util::Philox gen{ SEED, 37 };
+		std::vector<util::DataPoint<double>> batch;
+		for (size_t i = 0; i < 100; i++)
+		{
+			math::DMatrix input{ 1, 256 }, expected{ 1, 10 };
+			for (double& v : input)
+			{
+				v = (gen() % 1000) / 1000.0;
+			}
+			expected[gen() % 10] = 1.0;
+			batch.push_back({ input, expected });
+		}
+
+		net::cost::MSE<double> mse;
+		out << "training 256-512-512-10, one network per worker thread\n";
+		for (bool bind : { false, true })
+		{
+			std::vector<std::unique_ptr<net::Network>> networks;
+			for (size_t t = 0; t < threads; t++)
+			{
+				networks.push_back(std::make_unique<net::Network>(std::vector<size_t>{ 256, 512, 512, 10 }, &mse,
+					std::make_unique<net::actf::Sigmoid>(), std::make_unique<net::actf::Sigmoid>()));
+				if (bind)
+				{
+					networks.back()->BindToNode((int)layout.nodes[nodeOf(t)].physical);
+				}
+			}
+			const size_t batches = 4;
+			double rate = measure(batches * batch.size(), [&](size_t t) {
+				std::vector<util::DataPoint<double>> own = batch;
+				for (size_t b = 0; b < batches; b++)
+				{
+					networks[t]->Learn(own, 0.001);
+				}
+			});
+			out << (bind ? "  bound to the worker's node: " : "  first touch by main thread: ") << std::setw(10) << rate << " samples/s\n";
+		}
+	}
+
+	// pipeline stages with their layers on the stage's node
+	{
+		std::vector<util::DataPoint<double>> batch;
+		util::Philox gen{ SEED, 41 };
+		for (size_t i = 0; i < 64; i++)
+		{
+			math::DMatrix input{ 1, 784 }, expected{ 1, 10 };
+			for (double& v : input)
+			{
+				v = (gen() % 1000) / 1000.0;
+			}
+			expected[gen() % 10] = 1.0;
+			batch.push_back({ input, expected });
+		}
+
+		net::cost::MSE<double> mse;
+		out << "pipeline 784-1024-1024-10, " << layout.nodes.size() << " stages\n";
+		for (bool place : { false, true })
+		{
+			net::Network network{ { 784, 1024, 1024, 10 }, &mse, std::make_unique<net::actf::Sigmoid>(), std::make_unique<net::actf::Sigmoid>() };
+			net::Pipeline pipeline{ network, layout.nodes.size() };
+			if (place)
+			{
+				pipeline.Place(layout, PIN_POLICY::SCATTER);
+			}
+			const size_t batches = 2;
+			auto start = std::chrono::steady_clock::now();
+			for (size_t b = 0; b < batches; b++)
+			{
+				pipeline.Learn(batch, 0.001, 8);
+			}
+			double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			out << (place ? "  stages placed and pinned:   " : "  unplaced:                   ") << std::setw(10) << batches * batch.size() / seconds << " samples/s\n";
+		}
+	}
+}
+
+int util::bench::Run(const std::string& name, std::ostream& out)
+{
+	bool all = name == "all";
+	bool found = false;
+	if (all || name == "storage")
+	{
+		Storage(out);
+		found = true;
+	}
+	if (all || name == "init")
+	{
+		Init(out);
+		found = true;
+	}
+	if (all || name == "cache")
+	{
+		Cache(out);
+		found = true;
+	}
+	if (all || name == "sparse")
+	{
+		Sparse(out);
+		found = true;
+	}
+	if (all || name == "io")
+	{
+		ModelIO(out);
+		found = true;
+	}
+	if (all || name == "slab")
+	{
+		Slab(out);
+		found = true;
+	}
+	if (all || name == "ensemble")
+	{
+		Ensemble(out);
+		found = true;
+	}
+	if (all || name == "pipeline")
+	{
+		Pipeline(out);
+		found = true;
+	}
+	if (all || name == "backward")
+	{
+		Backward(out);
+		found = true;
+	}
+	if (all || name == "reload")
+	{
+		Reload(out);
+		found = true;
+	}
+	if (all || name == "trace")
+	{
+		Trace(out);
+		found = true;
+	}
+	if (all || name == "mixed")
+	{
+		Mixed(out);
+		found = true;
+	}
+
+	if (all || name == "numa")
+	{
+		Numa(out);
+		found = true;
+	}
+
+	if (!found)
+	{
+		out << "unknown benchmark: " << name << '\n';
+		return 1;
+	}
+	return 0;
+}
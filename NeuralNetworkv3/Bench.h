@@ -0,0 +1,57 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace util
+{
+	namespace bench
+	{
+		// average wall time of one call to f in nanoseconds
+		template<typename F>
+		inline double TimeNs(F&& f, size_t iterations)
+		{
+			f(); // warm up caches and allocators
+			auto start = std::chrono::steady_clock::now();
+			for (size_t i = 0; i < iterations; i++)
+			{
+				f();
+			}
+			auto end = std::chrono::steady_clock::now();
+			return std::chrono::duration<double, std::nano>(end - start).count() / iterations;
+		}
+
+		// median of repeats runs of TimeNs, so one preempted run does not decide a comparison
+		template<typename F>
+		inline double MedianNs(F&& f, size_t iterations, size_t repeats)
+		{
+			std::vector<double> runs(repeats);
+			for (double& run : runs)
+			{
+				run = TimeNs(f, iterations);
+			}
+			std::nth_element(runs.begin(), runs.begin() + runs.size() / 2, runs.end());
+			return runs[runs.size() / 2];
+		}
+
+		void Storage(std::ostream& out);
+		void Init(std::ostream& out);
+		void Cache(std::ostream& out);
+		void Sparse(std::ostream& out);
+		void ModelIO(std::ostream& out);
+		void Slab(std::ostream& out);
+		void Ensemble(std::ostream& out);
+		void Pipeline(std::ostream& out);
+		void Backward(std::ostream& out);
+		void Reload(std::ostream& out);
+		void Trace(std::ostream& out);
+		void Mixed(std::ostream& out);
+		void Numa(std::ostream& out);
+
+		// runs the benchmark with the given name, "all" runs every benchmark
+		int Run(const std::string& name, std::ostream& out);
+	}
+}
@@ -0,0 +1,146 @@
+#include "Checkpointer.h"
+#include <filesystem>
+#include <algorithm>
+
+net::Checkpointer::Checkpointer(CheckpointConfig config, cost::Cost<double>* cost, std::vector<util::DataPoint<double>> validation)
+	: config(config), cost(cost), validation(std::move(validation))
+{
+	if (config.save)
+	{
+		std::filesystem::create_directories(config.directory);
+	}
+	writer = std::thread{ &Checkpointer::Run, this };
+}
+
+net::Checkpointer::~Checkpointer()
+{
+	{
+		std::lock_guard<std::mutex> lock{ mtx };
+		stop = true;
+	}
+	cv.notify_all();
+	writer.join();
+}
+
+void net::Checkpointer::Submit(const Network& network, size_t step)
+{
+	{
+		std::lock_guard<std::mutex> lock{ mtx };
+		network.TakeSnapshot(back);
+		back.step = step;
+		pending = true;
+	}
+	cv.notify_all();
+}
+
+void net::Checkpointer::Flush()
+{
+	std::unique_lock<std::mutex> lock{ mtx };
+	cv.wait(lock, [this] { return !pending && !busy; });
+}
+
+bool net::Checkpointer::HasResult() const
+{
+	std::lock_guard<std::mutex> lock{ mtx };
+	return !results.empty();
+}
+
+net::CheckpointResult net::Checkpointer::GetLastResult() const
+{
+	std::lock_guard<std::mutex> lock{ mtx };
+	return results.empty() ? CheckpointResult{} : results.back();
+}
+
+std::vector<net::CheckpointResult> net::Checkpointer::GetResults() const
+{
+	std::lock_guard<std::mutex> lock{ mtx };
+	return results;
+}
+
+void net::Checkpointer::Run()
+{
+	util::trace::SetThreadName("checkpointer");
+	std::unique_lock<std::mutex> lock{ mtx };
+	for (;;)
+	{
+		cv.wait(lock, [this] { return pending || stop; });
+		if (!pending)
+		{
+			return; // stopping with nothing left to write
+		}
+
+		std::swap(front, back);
+		pending = false;
+		busy = true;
+
+		lock.unlock();
+		Process(front);
+		lock.lock();
+
+		busy = false;
+		cv.notify_all();
+	}
+}
+
+void net::Checkpointer::Process(const Snapshot& snapshot)
+{
+	util::trace::Span span{ "Checkpointer::Process", "io", (int64_t)snapshot.step };
+	CheckpointResult result;
+	result.step = snapshot.step;
+
+	if (config.save)
+	{
+		std::filesystem::path path = std::filesystem::path{ config.directory } / (config.prefix + '_' + std::to_string(snapshot.step) + ".txt");
+		std::filesystem::path temp = path;
+		temp += ".tmp";
+
+		// readers only ever see a complete file, the rename replaces it atomically
+		try
+		{
+			snapshot.Save(temp.string());
+			std::filesystem::rename(temp, path);
+			result.path = path.string();
+
+			files.push_back(result.path);
+			while (config.retention != 0 && files.size() > config.retention)
+			{
+				std::error_code ec;
+				std::filesystem::remove(files.front(), ec);
+				files.pop_front();
+			}
+		}
+		catch (const std::exception& e)
+		{
+			// training goes on without this checkpoint, the next one may well succeed
+			result.error = e.what();
+			std::error_code ec;
+			std::filesystem::remove(temp, ec);
+		}
+	}
+
+	try
+	{
+		if (!validation.empty())
+		{
+			size_t correct = 0;
+			for (util::DataPoint<double>& dp : validation)
+			{
+				dp.output = snapshot.Feed(dp.input);
+				if (std::max_element(dp.output.begin(), dp.output.end()) - dp.output.begin() ==
+					std::max_element(dp.expected.begin(), dp.expected.end()) - dp.expected.begin())
+				{
+					correct++;
+				}
+			}
+			result.cost = cost ? cost->Calculate(validation) : 0.0;
+			result.accuracy = (double)correct / validation.size();
+		}
+	}
+	catch (const std::exception& e)
+	{
+		result.error += (result.error.empty() ? "" : "; ") + std::string{ e.what() };
+	}
+
+	std::lock_guard<std::mutex> lock{ mtx };
+	results.push_back(result);
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include "Network.h"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+
+namespace net
+{
+	struct CheckpointConfig
+	{
+		std::string directory = ".";
+		std::string prefix = "checkpoint";
+		size_t retention = 3; // checkpoint files kept on disk, older ones are deleted, 0 keeps everything
+		bool save = true;
+	};
+
+	struct CheckpointResult
+	{
+		size_t step = 0;
+		std::string path; // empty if saving is disabled or failed
+		std::string error; // what went wrong writing or evaluating this checkpoint, empty if nothing did
+		double cost = 0.0; // on the validation set, 0 without one
+		double accuracy = 0.0; // fraction of validation points whose largest output matches the largest expected value
+	};
+
+	// writes checkpoints and evaluates them on a background thread while training carries on
+	// Submit only copies the weights into a spare snapshot buffer, the writer thread works on the other one
+	class Checkpointer
+	{
+	public:
+		Checkpointer(CheckpointConfig config, cost::Cost<double>* cost = nullptr, std::vector<util::DataPoint<double>> validation = {});
+		~Checkpointer();
+
+		Checkpointer(const Checkpointer&) = delete;
+		Checkpointer& operator=(const Checkpointer&) = delete;
+	public:
+		// if the writer has not picked up the previous submission yet it is replaced by this one
+		void Submit(const Network& network, size_t step);
+		void Flush(); // blocks until every submitted snapshot has been written and evaluated
+
+		bool HasResult() const;
+		CheckpointResult GetLastResult() const;
+		std::vector<CheckpointResult> GetResults() const;
+	private:
+		void Run();
+		void Process(const Snapshot& snapshot);
+	private:
+		CheckpointConfig config;
+		cost::Cost<double>* cost;
+		std::vector<util::DataPoint<double>> validation; // owned copy, the writer writes the outputs into it
+
+		Snapshot front; // read by the writer thread
+		Snapshot back; // filled by Submit
+		bool pending = false;
+		bool busy = false;
+		bool stop = false;
+
+		std::deque<std::string> files;
+		std::vector<CheckpointResult> results;
+
+		mutable std::mutex mtx;
+		std::condition_variable cv;
+		std::thread writer;
+	};
+}
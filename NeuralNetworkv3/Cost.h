@@ -6,6 +6,12 @@ namespace net
 {
 	namespace cost
 	{
+		enum class COST_TYPE
+		{
+			MSE,
+			CROSS_ENTROPY
+		};
+
 		template<typename T>
 		class Cost
 		{
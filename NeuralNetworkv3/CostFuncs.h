@@ -1,6 +1,7 @@
 #pragma once
 
 #include "Cost.h"
+#include <memory>
 
 namespace net
 {
@@ -124,5 +125,19 @@ namespace net
 				return res;
 			}
 		};
+
+		template<typename T>
+		inline std::unique_ptr<Cost<T>> GetCost(COST_TYPE type)
+		{
+			switch (type)
+			{
+			case COST_TYPE::MSE:
+				return std::make_unique<MSE<T>>();
+			case COST_TYPE::CROSS_ENTROPY:
+				return std::make_unique<CrossEntropy<T>>();
+			default:
+				return nullptr;
+			}
+		}
 	}
 }
\ No newline at end of file
@@ -0,0 +1,624 @@
+#include "Distributed.h"
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <filesystem>
+#include <stdexcept>
+#include <iomanip>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#endif
+
+namespace
+{
+	constexpr size_t channelCapacity = (size_t)1 << 20;
+
+	double Seconds(std::chrono::steady_clock::time_point start)
+	{
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+}
+
+struct net::dist::ShmTransport::Channel
+{
+	alignas(64) std::atomic<uint64_t> head; // total bytes written
+	alignas(64) std::atomic<uint64_t> tail; // total bytes read
+	alignas(64) char data[channelCapacity];
+};
+
+namespace
+{
+	// in front of the channels, lets the ranks tell the segment of this run from one a crashed run left behind
+	struct SegmentHeader
+	{
+		alignas(64) std::atomic<uint64_t> ready; // set by rank 0 once the fresh segment is mapped
+		std::atomic<uint64_t> attached; // ranks other than 0 that have checked in
+		std::atomic<uint64_t> acknowledged; // set to attached by rank 0 once all of them have, never on a stale segment
+	};
+}
+
+#ifndef _WIN32
+
+net::dist::ShmTransport::ShmTransport(const std::string& name, size_t rank, size_t size)
+	: name(name), rank(rank), size(size)
+{
+	static_assert(std::atomic<uint64_t>::is_always_lock_free, "shared memory channels need address-free atomics");
+
+	segmentBytes = sizeof(SegmentHeader) + sizeof(Channel) * size;
+
+	// rank 0 removes whatever an earlier run left under the name and creates a fresh zero-filled segment,
+	// the others retry until they are attached to that one and not to the stale one it replaced
+	SegmentHeader* header = nullptr;
+	if (rank == 0)
+	{
+		shm_unlink(name.c_str());
+		int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+		if (fd < 0 || ftruncate(fd, (off_t)segmentBytes) != 0)
+		{
+			if (fd >= 0)
+			{
+				close(fd);
+			}
+			throw std::runtime_error("cannot create shared memory segment " + name);
+		}
+		segment = mmap(nullptr, segmentBytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		close(fd);
+		if (segment == MAP_FAILED)
+		{
+			throw std::runtime_error("cannot map shared memory segment " + name);
+		}
+		header = (SegmentHeader*)segment;
+		header->ready.store(1, std::memory_order_release);
+
+		for (size_t attempt = 0; header->attached.load(std::memory_order_acquire) != size - 1; attempt++)
+		{
+			if (attempt > 10000)
+			{
+				munmap(segment, segmentBytes);
+				shm_unlink(name.c_str());
+				throw std::runtime_error("not every rank attached to shared memory segment " + name);
+			}
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+		header->acknowledged.store(size - 1, std::memory_order_release);
+	}
+	else
+	{
+		for (size_t attempt = 0;; attempt++)
+		{
+			if (attempt > 10000)
+			{
+				throw std::runtime_error("shared memory segment " + name + " was never created");
+			}
+			if (attempt > 0)
+			{
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			}
+
+			int fd = shm_open(name.c_str(), O_RDWR, 0600);
+			struct stat st{};
+			if (fd < 0)
+			{
+				continue;
+			}
+			if (fstat(fd, &st) != 0 || (size_t)st.st_size != segmentBytes)
+			{
+				close(fd);
+				continue;
+			}
+			segment = mmap(nullptr, segmentBytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+			if (segment == MAP_FAILED)
+			{
+				close(fd);
+				throw std::runtime_error("cannot map shared memory segment " + name);
+			}
+			header = (SegmentHeader*)segment;
+
+			// only a live rank 0 acknowledges the check-in, a stale segment never does and loses its name once rank 0 replaces it
+			auto replaced = [&] { return fstat(fd, &st) != 0 || st.st_nlink == 0; };
+			bool stale = false;
+			while (header->ready.load(std::memory_order_acquire) == 0 && !(stale = replaced()) && attempt++ <= 10000)
+			{
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			}
+			stale = stale || header->ready.load(std::memory_order_acquire) == 0;
+			if (!stale)
+			{
+				uint64_t ticket = header->attached.fetch_add(1, std::memory_order_acq_rel) + 1;
+				while (header->acknowledged.load(std::memory_order_acquire) < ticket && !(stale = replaced()) && attempt++ <= 10000)
+				{
+					std::this_thread::sleep_for(std::chrono::milliseconds(1));
+				}
+				stale = stale || header->acknowledged.load(std::memory_order_acquire) < ticket;
+			}
+			close(fd);
+			if (!stale)
+			{
+				break;
+			}
+			munmap(segment, segmentBytes);
+			segment = nullptr;
+		}
+	}
+
+	Channel* channels = (Channel*)((char*)segment + sizeof(SegmentHeader));
+	out = &channels[rank];
+	in = &channels[(rank + size - 1) % size];
+}
+
+net::dist::ShmTransport::~ShmTransport()
+{
+	munmap(segment, segmentBytes);
+	if (rank == 0)
+	{
+		// every rank has attached by the time training ran a step, unlinking only removes the name
+		shm_unlink(name.c_str());
+	}
+}
+
+void net::dist::ShmTransport::SendRecv(const void* send, size_t sendBytes, void* recv, size_t recvBytes)
+{
+	const char* src = (const char*)send;
+	char* dst = (char*)recv;
+	size_t sent = 0;
+	size_t received = 0;
+
+	while (sent < sendBytes || received < recvBytes)
+	{
+		bool progress = false;
+
+		if (sent < sendBytes)
+		{
+			uint64_t head = out->head.load(std::memory_order_relaxed);
+			uint64_t tail = out->tail.load(std::memory_order_acquire);
+			size_t n = std::min(sendBytes - sent, channelCapacity - (size_t)(head - tail));
+			for (size_t done = 0; done < n;)
+			{
+				size_t pos = (size_t)((head + done) % channelCapacity);
+				size_t len = std::min(n - done, channelCapacity - pos);
+				std::memcpy(out->data + pos, src + sent + done, len);
+				done += len;
+			}
+			if (n > 0)
+			{
+				out->head.store(head + n, std::memory_order_release);
+				sent += n;
+				progress = true;
+			}
+		}
+
+		if (received < recvBytes)
+		{
+			uint64_t tail = in->tail.load(std::memory_order_relaxed);
+			uint64_t head = in->head.load(std::memory_order_acquire);
+			size_t n = std::min(recvBytes - received, (size_t)(head - tail));
+			for (size_t done = 0; done < n;)
+			{
+				size_t pos = (size_t)((tail + done) % channelCapacity);
+				size_t len = std::min(n - done, channelCapacity - pos);
+				std::memcpy(dst + received + done, in->data + pos, len);
+				done += len;
+			}
+			if (n > 0)
+			{
+				in->tail.store(tail + n, std::memory_order_release);
+				received += n;
+				progress = true;
+			}
+		}
+
+		if (!progress)
+		{
+			std::this_thread::yield();
+		}
+	}
+}
+
+net::dist::TcpTransport::TcpTransport(unsigned short basePort, size_t rank, size_t size)
+	: rank(rank), size(size)
+{
+	int listener = socket(AF_INET, SOCK_STREAM, 0);
+	int yes = 1;
+	setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+
+	sockaddr_in addr{};
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = htons((unsigned short)(basePort + rank));
+	if (bind(listener, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(listener, 1) != 0)
+	{
+		close(listener);
+		throw std::runtime_error("cannot listen on port " + std::to_string(basePort + rank));
+	}
+
+	// the next rank may not be listening yet, keep retrying
+	sockaddr_in peer = addr;
+	peer.sin_port = htons((unsigned short)(basePort + (rank + 1) % size));
+	for (size_t attempt = 0;; attempt++)
+	{
+		next = socket(AF_INET, SOCK_STREAM, 0);
+		if (connect(next, (sockaddr*)&peer, sizeof(peer)) == 0)
+		{
+			break;
+		}
+		close(next);
+		if (attempt > 10000)
+		{
+			close(listener);
+			throw std::runtime_error("cannot connect to rank " + std::to_string((rank + 1) % size));
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+
+	prev = accept(listener, nullptr, nullptr);
+	close(listener);
+	if (prev < 0)
+	{
+		throw std::runtime_error("cannot accept connection from rank " + std::to_string((rank + size - 1) % size));
+	}
+
+	for (int fd : { next, prev })
+	{
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+	}
+}
+
+net::dist::TcpTransport::~TcpTransport()
+{
+	close(next);
+	close(prev);
+}
+
+void net::dist::TcpTransport::SendRecv(const void* send, size_t sendBytes, void* recv, size_t recvBytes)
+{
+	const char* src = (const char*)send;
+	char* dst = (char*)recv;
+	size_t sent = 0;
+	size_t received = 0;
+
+	while (sent < sendBytes || received < recvBytes)
+	{
+		pollfd fds[2] = { { next, POLLOUT, 0 }, { prev, POLLIN, 0 } };
+		poll(fds + (sent < sendBytes ? 0 : 1), (sent < sendBytes) + (received < recvBytes), 100);
+
+		if (sent < sendBytes)
+		{
+			ssize_t n = ::send(next, src + sent, sendBytes - sent, MSG_NOSIGNAL);
+			if (n > 0)
+			{
+				sent += (size_t)n;
+			}
+			else if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+			{
+				throw std::runtime_error("send to the next rank failed");
+			}
+		}
+		if (received < recvBytes)
+		{
+			ssize_t n = ::recv(prev, dst + received, recvBytes - received, 0);
+			if (n > 0)
+			{
+				received += (size_t)n;
+			}
+			else if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+			{
+				throw std::runtime_error("receive from the previous rank failed");
+			}
+		}
+	}
+}
+
+#else
+
+net::dist::ShmTransport::ShmTransport(const std::string& name, size_t rank, size_t size)
+	: name(name), rank(rank), size(size)
+{
+	throw std::runtime_error("the shared memory transport needs POSIX shared memory");
+}
+
+net::dist::ShmTransport::~ShmTransport()
+{}
+
+void net::dist::ShmTransport::SendRecv(const void* send, size_t sendBytes, void* recv, size_t recvBytes)
+{}
+
+net::dist::TcpTransport::TcpTransport(unsigned short basePort, size_t rank, size_t size)
+	: rank(rank), size(size)
+{
+	throw std::runtime_error("the TCP transport needs POSIX sockets");
+}
+
+net::dist::TcpTransport::~TcpTransport()
+{}
+
+void net::dist::TcpTransport::SendRecv(const void* send, size_t sendBytes, void* recv, size_t recvBytes)
+{}
+
+#endif
+
+size_t net::dist::ShmTransport::GetRank() const
+{
+	return rank;
+}
+
+size_t net::dist::ShmTransport::GetSize() const
+{
+	return size;
+}
+
+size_t net::dist::TcpTransport::GetRank() const
+{
+	return rank;
+}
+
+size_t net::dist::TcpTransport::GetSize() const
+{
+	return size;
+}
+
+void net::dist::AllReduce(Transport& transport, double* data, size_t count)
+{
+	const size_t n = transport.GetSize();
+	const size_t r = transport.GetRank();
+	if (n == 1)
+	{
+		return;
+	}
+
+	auto begin = [&](size_t chunk) { return count * chunk / n; };
+	auto length = [&](size_t chunk) { return begin(chunk + 1) - begin(chunk); };
+
+	std::vector<double> recv(count / n + 1);
+
+	// reduce-scatter, afterwards rank r holds the full sum of chunk r + 1
+	for (size_t step = 0; step < n - 1; step++)
+	{
+		size_t sendChunk = (r + n - step) % n;
+		size_t recvChunk = (r + n - step - 1) % n;
+		transport.SendRecv(data + begin(sendChunk), length(sendChunk) * sizeof(double), recv.data(), length(recvChunk) * sizeof(double));
+
+		double* target = data + begin(recvChunk);
+		for (size_t i = 0; i < length(recvChunk); i++)
+		{
+			target[i] += recv[i];
+		}
+	}
+
+	// all-gather the reduced chunks around the ring
+	for (size_t step = 0; step < n - 1; step++)
+	{
+		size_t sendChunk = (r + 1 + n - step) % n;
+		size_t recvChunk = (r + n - step) % n;
+		transport.SendRecv(data + begin(sendChunk), length(sendChunk) * sizeof(double), data + begin(recvChunk), length(recvChunk) * sizeof(double));
+	}
+}
+
+net::dist::DataParallel::DataParallel(Transport& transport)
+	: transport(transport)
+{
+	comm = std::thread{ &DataParallel::Run, this };
+}
+
+net::dist::DataParallel::~DataParallel()
+{
+	{
+		std::lock_guard<std::mutex> lock{ mtx };
+		stop = true;
+	}
+	cv.notify_all();
+	comm.join();
+}
+
+void net::dist::DataParallel::SyncParameters(Network& network)
+{
+	// a sum where every rank but 0 contributes zeros is a broadcast from rank 0, the whole slab goes in one call
+	ParameterSlab& parameters = network.GetParameterSlab();
+	if (transport.GetRank() != 0)
+	{
+		parameters.Zero();
+	}
+	AllReduce(transport, parameters.GetData(), parameters.GetSize());
+	network.ParametersChanged();
+}
+
+void net::dist::DataParallel::Learn(Network& network, std::vector<util::DataPoint<double>>& shard, double learnRate)
+{
+	network.Learn(shard, learnRate, this);
+	stats.steps++;
+}
+
+void net::dist::DataParallel::LayerReady(size_t, math::DMatrix& weightGrad, math::DMatrix& biasGrad)
+{
+	{
+		std::lock_guard<std::mutex> lock{ mtx };
+		queue.push_back({ &weightGrad, &biasGrad });
+		queued++;
+	}
+	cv.notify_all();
+}
+
+void net::dist::DataParallel::Wait()
+{
+	auto start = std::chrono::steady_clock::now();
+	std::unique_lock<std::mutex> lock{ mtx };
+	cv.wait(lock, [this] { return done == queued; });
+	stats.waitSeconds += Seconds(start);
+}
+
+net::dist::SyncStats net::dist::DataParallel::GetStats() const
+{
+	std::lock_guard<std::mutex> lock{ mtx };
+	return stats;
+}
+
+void net::dist::DataParallel::Run()
+{
+	std::unique_lock<std::mutex> lock{ mtx };
+	for (;;)
+	{
+		cv.wait(lock, [this] { return !queue.empty() || stop; });
+		if (queue.empty())
+		{
+			return;
+		}
+		Bucket bucket = queue.front();
+		queue.pop_front();
+		lock.unlock();
+
+		// weights and biases of a layer go out as one flat buffer, the ranks queue layers in the same order
+		auto start = std::chrono::steady_clock::now();
+		size_t nw = bucket.weightGrad->GetSize();
+		size_t nb = bucket.biasGrad->GetSize();
+
+		// the weight gradients are sums over the samples, but Network::Learn steps the biases by the last sample's
+		// gradient alone, so only the last rank, whose shard ends the batch, contributes it and the sum stays that one
+		if (transport.GetRank() != transport.GetSize() - 1)
+		{
+			std::fill(bucket.biasGrad->begin(), bucket.biasGrad->end(), 0.0);
+		}
+		if (bucket.biasGrad->GetData() == bucket.weightGrad->GetData() + ParameterSlab::Padded(nw))
+		{
+			// adjacent in the gradient slab, reduced in place together with the zero padding between them
+			AllReduce(transport, bucket.weightGrad->GetData(), ParameterSlab::Padded(nw) + nb);
+		}
+		else
+		{
+			staging.resize(nw + nb);
+			std::copy(bucket.weightGrad->begin(), bucket.weightGrad->end(), staging.begin());
+			std::copy(bucket.biasGrad->begin(), bucket.biasGrad->end(), staging.begin() + nw);
+
+			AllReduce(transport, staging.data(), staging.size());
+
+			std::copy(staging.begin(), staging.begin() + nw, bucket.weightGrad->begin());
+			std::copy(staging.begin() + nw, staging.end(), bucket.biasGrad->begin());
+		}
+		double seconds = Seconds(start);
+
+		lock.lock();
+		stats.commSeconds += seconds;
+		done++;
+		cv.notify_all();
+	}
+}
+
+std::vector<util::DataPoint<double>> net::dist::Shard(const std::vector<util::DataPoint<double>>& batch, size_t rank, size_t size)
+{
+	size_t begin = batch.size() * rank / size;
+	size_t end = batch.size() * (rank + 1) / size;
+	return { batch.begin() + begin, batch.begin() + end };
+}
+
+bool net::dist::ParseWorkerArgs(int argc, char* argv[], WorkerArgs& args)
+{
+	if (argc < 8 || std::string(argv[1]) != "--worker")
+	{
+		return false;
+	}
+	args.rank = std::stoul(argv[2]);
+	args.size = std::stoul(argv[3]);
+	args.transport = argv[4];
+	args.job = argv[5];
+	args.epochs = std::stoul(argv[6]);
+	args.result = argv[7];
+	return true;
+}
+
+std::unique_ptr<net::dist::Transport> net::dist::MakeTransport(const WorkerArgs& args)
+{
+	if (args.transport == "tcp")
+	{
+		// the job id picks a port range so concurrent jobs on one host do not collide
+		unsigned short basePort = (unsigned short)(20000 + std::stoul(args.job) % 20000);
+		return std::make_unique<TcpTransport>(basePort, args.rank, args.size);
+	}
+	return std::make_unique<ShmTransport>("/nn_dist_" + args.job, args.rank, args.size);
+}
+
+void net::dist::ReportResult(const WorkerArgs& args, double samplesPerSecond)
+{
+	if (args.rank == 0)
+	{
+		std::ofstream out{ args.result };
+		out << samplesPerSecond << '\n';
+	}
+}
+
+int net::dist::Launch(const std::string& executable, size_t maxWorkers, const std::string& transport, size_t epochs, std::ostream& out)
+{
+#ifndef _WIN32
+	std::vector<size_t> counts;
+	for (size_t n = 1; n < maxWorkers; n *= 2)
+	{
+		counts.push_back(n);
+	}
+	counts.push_back(maxWorkers);
+
+	double single = 0.0;
+	out << "workers  samples/s  efficiency\n";
+	for (size_t n : counts)
+	{
+		std::string job = std::to_string(getpid() * 8 + n);
+		std::string result = (std::filesystem::temp_directory_path() / ("nn_dist_" + job + ".txt")).string();
+
+		std::vector<pid_t> children;
+		for (size_t rank = 0; rank < n; rank++)
+		{
+			pid_t pid = fork();
+			if (pid == 0)
+			{
+				std::vector<std::string> args{ executable, "--worker", std::to_string(rank), std::to_string(n), transport, job, std::to_string(epochs), result };
+				std::vector<char*> argv;
+				for (std::string& a : args)
+				{
+					argv.push_back(a.data());
+				}
+				argv.push_back(nullptr);
+				execv(executable.c_str(), argv.data());
+				_exit(127);
+			}
+			children.push_back(pid);
+		}
+
+		bool failed = false;
+		for (pid_t pid : children)
+		{
+			int status = 0;
+			waitpid(pid, &status, 0);
+			failed |= !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+		}
+
+		double throughput = 0.0;
+		std::ifstream in{ result };
+		if (failed || !(in >> throughput))
+		{
+			out << "job with " << n << " workers failed\n";
+			return 1;
+		}
+		in.close();
+		std::filesystem::remove(result);
+
+		if (n == 1)
+		{
+			single = throughput;
+		}
+		out << std::setw(7) << n << std::setw(11) << (size_t)throughput << std::setw(12) << throughput / (single * n) << '\n';
+	}
+	return 0;
+#else
+	out << "launching local workers needs POSIX fork/exec\n";
+	return 1;
+#endif
+}
@@ -0,0 +1,145 @@
+#pragma once
+
+#include "Network.h"
+#include <string>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <ostream>
+
+namespace net
+{
+	namespace dist
+	{
+		// ring connection between worker processes, every rank sends to rank + 1 and receives from rank - 1
+		class Transport
+		{
+		public:
+			virtual ~Transport() = default;
+
+			// sends to the next rank and receives from the previous one at the same time so a full ring never deadlocks
+			virtual void SendRecv(const void* send, size_t sendBytes, void* recv, size_t recvBytes) = 0;
+
+			virtual size_t GetRank() const = 0;
+			virtual size_t GetSize() const = 0;
+		};
+
+		// one single-producer/single-consumer byte ring per rank in a POSIX shared memory segment
+		class ShmTransport : public Transport
+		{
+		public:
+			// rank 0 replaces any segment a crashed run left under name, every rank waits until all of them are attached
+			// to the fresh one and throws std::runtime_error if that takes more than about 10 s
+			ShmTransport(const std::string& name, size_t rank, size_t size);
+			~ShmTransport();
+
+			void SendRecv(const void* send, size_t sendBytes, void* recv, size_t recvBytes) override;
+
+			size_t GetRank() const override;
+			size_t GetSize() const override;
+		private:
+			struct Channel;
+
+			std::string name;
+			size_t rank;
+			size_t size;
+			void* segment = nullptr;
+			size_t segmentBytes = 0;
+			Channel* out = nullptr;
+			Channel* in = nullptr;
+		};
+
+		// TCP over loopback, rank r listens on basePort + r
+		class TcpTransport : public Transport
+		{
+		public:
+			TcpTransport(unsigned short basePort, size_t rank, size_t size);
+			~TcpTransport();
+
+			void SendRecv(const void* send, size_t sendBytes, void* recv, size_t recvBytes) override;
+
+			size_t GetRank() const override;
+			size_t GetSize() const override;
+		private:
+			size_t rank;
+			size_t size;
+			int next = -1;
+			int prev = -1;
+		};
+
+		// in-place sum over all ranks, reduce-scatter followed by all-gather so each rank moves 2 * (n - 1) / n of the buffer
+		void AllReduce(Transport& transport, double* data, size_t count);
+
+		struct SyncStats
+		{
+			size_t steps = 0;
+			double commSeconds = 0.0; // spent in AllReduce on the communication thread
+			double waitSeconds = 0.0; // training thread blocked at the end of backprop, communication that was not hidden
+		};
+
+		// data-parallel training over a transport, gradients are all-reduced per layer on a communication
+		// thread while backprop of the layers below continues
+		// the ranks must learn from the shards Shard makes, in rank order, for the step to match Network::Learn on the whole batch
+		class DataParallel : public GradientSync
+		{
+		public:
+			DataParallel(Transport& transport);
+			~DataParallel();
+
+			DataParallel(const DataParallel&) = delete;
+			DataParallel& operator=(const DataParallel&) = delete;
+		public:
+			void SyncParameters(Network& network); // every rank starts from rank 0's parameters
+			void Learn(Network& network, std::vector<util::DataPoint<double>>& shard, double learnRate);
+
+			void LayerReady(size_t layer_i, math::DMatrix& weightGrad, math::DMatrix& biasGrad) override;
+			void Wait() override;
+
+			SyncStats GetStats() const;
+		private:
+			void Run();
+		private:
+			struct Bucket
+			{
+				math::DMatrix* weightGrad;
+				math::DMatrix* biasGrad;
+			};
+
+			Transport& transport;
+			std::vector<double> staging;
+
+			std::deque<Bucket> queue;
+			size_t queued = 0;
+			size_t done = 0;
+			bool stop = false;
+			SyncStats stats;
+
+			mutable std::mutex mtx;
+			std::condition_variable cv;
+			std::thread comm;
+		};
+
+		// this rank's contiguous part of a batch, the shards of all ranks together make up the batch
+		std::vector<util::DataPoint<double>> Shard(const std::vector<util::DataPoint<double>>& batch, size_t rank, size_t size);
+
+		struct WorkerArgs
+		{
+			size_t rank = 0;
+			size_t size = 1;
+			std::string transport = "shm";
+			std::string job;
+			size_t epochs = 0;
+			std::string result; // rank 0 writes its throughput here
+		};
+
+		// argv: --worker <rank> <size> <shm|tcp> <job> <epochs> <result>
+		bool ParseWorkerArgs(int argc, char* argv[], WorkerArgs& args);
+		std::unique_ptr<Transport> MakeTransport(const WorkerArgs& args);
+		void ReportResult(const WorkerArgs& args, double samplesPerSecond);
+
+		// spawns executable --worker ... for 1, 2, 4, ... maxWorkers local workers and reports throughput and scaling efficiency
+		int Launch(const std::string& executable, size_t maxWorkers, const std::string& transport, size_t epochs, std::ostream& out);
+	}
+}
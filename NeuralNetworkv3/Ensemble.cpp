@@ -0,0 +1,304 @@
+#include "Ensemble.h"
+#include "ActivationFuncs.h"
+#include <cmath>
+#include <cstring>
+
+net::Ensemble::Ensemble(std::vector<size_t> layer_c, cost::Cost<double>* cost,
+	actf::ACTIVATION_TYPE hiddenType, actf::ACTIVATION_TYPE outputType,
+	std::vector<double> learnRates, std::vector<uint64_t> seeds,
+	double bias)
+	: layer_c(layer_c), n_layers(layer_c.size()), K(learnRates.size()), cost(cost), hiddenType(hiddenType), outputType(outputType), learnRates(learnRates)
+{
+	assert(seeds.size() == K && K > 0);
+	assert(hiddenType != actf::ACTIVATION_TYPE::SOFTMAX && outputType != actf::ACTIVATION_TYPE::SOFTMAX);
+
+	weights.resize(n_layers);
+	biases.resize(n_layers);
+	weight_grad.resize(n_layers);
+	bias_grad.resize(n_layers);
+	weightedInputs.resize(n_layers);
+	outputs.resize(n_layers);
+
+	size_t widest = 0;
+	outputs[0].assign(layer_c[0] * K, 0.0);
+	for (size_t i = 1; i < n_layers; i++)
+	{
+		size_t in = layer_c[i - 1], out = layer_c[i];
+		weights[i].resize(in * out * K);
+		biases[i].assign(out * K, bias);
+		weight_grad[i].assign(in * out * K, 0.0);
+		bias_grad[i].assign(out * K, 0.0);
+		weightedInputs[i].assign(out * K, 0.0);
+		outputs[i].assign(out * K, 0.0);
+		widest = std::max(widest, std::max(in, out));
+
+		// the same initialization as Layer, each member on its own seed
+		std::vector<double> member(in * out);
+		for (size_t k = 0; k < K; k++)
+		{
+			util::FillUniform(member.data(), member.size(), -1.0, 1.0, util::Philox{ seeds[k], util::LayerStream(0, i) }, 1.0 / std::sqrt((double)in));
+			for (size_t p = 0; p < member.size(); p++)
+			{
+				weights[i][p * K + k] = member[p];
+			}
+		}
+	}
+	nodeValues.resize(widest * K);
+	propagated.resize(widest * K);
+}
+
+void net::Ensemble::Activate(double* out, const double* in, size_t n, actf::ACTIVATION_TYPE type) const
+{
+	// the same expressions as actf::Sigmoid and actf::ReLU so every member matches a Network bit for bit
+	if (type == actf::ACTIVATION_TYPE::SIGMOID)
+	{
+		for (size_t i = 0; i < n; i++)
+		{
+			out[i] = 1.0 / (1.0 + std::exp(-in[i]));
+		}
+	}
+	else
+	{
+		for (size_t i = 0; i < n; i++)
+		{
+			out[i] = std::max(0.0, in[i]);
+		}
+	}
+}
+
+void net::Ensemble::Derivative(double* out, const double* weightedInputs, const double* outputs, size_t n, actf::ACTIVATION_TYPE type) const
+{
+	if (type == actf::ACTIVATION_TYPE::SIGMOID)
+	{
+		// the stored activation is exactly what Sigmoid::Derivative would recompute
+		for (size_t i = 0; i < n; i++)
+		{
+			out[i] = outputs[i] * (1.0 - outputs[i]);
+		}
+	}
+	else
+	{
+		for (size_t i = 0; i < n; i++)
+		{
+			out[i] = weightedInputs[i] <= 0.0 ? 0.0 : 1.0;
+		}
+	}
+}
+
+void net::Ensemble::Forward(math::ConstDMatrixView input)
+{
+	assert(input.GetSize() == layer_c[0]);
+	double* __restrict first = outputs[0].data();
+	for (size_t r = 0; r < layer_c[0]; r++)
+	{
+		double x = input(0, r);
+		for (size_t k = 0; k < K; k++)
+		{
+			first[r * K + k] = x;
+		}
+	}
+
+	for (size_t i = 1; i < n_layers; i++)
+	{
+		const size_t in = layer_c[i - 1], out = layer_c[i];
+		double* __restrict z = weightedInputs[i].data();
+		const double* __restrict a = outputs[i - 1].data();
+		const double* __restrict w = weights[i].data();
+
+		// biases first, then the rows of the weights in order, as Gemm accumulates them
+		std::memcpy(z, biases[i].data(), out * K * sizeof(double));
+		for (size_t r = 0; r < in; r++)
+		{
+			for (size_t c = 0; c < out; c++)
+			{
+				const double* __restrict wrc = w + (r * out + c) * K;
+				double* __restrict zc = z + c * K;
+				for (size_t k = 0; k < K; k++)
+				{
+					zc[k] += a[r * K + k] * wrc[k];
+				}
+			}
+		}
+		Activate(outputs[i].data(), z, out * K, i == n_layers - 1 ? outputType : hiddenType);
+	}
+}
+
+void net::Ensemble::Learn(const std::vector<util::DataPoint<double>>& batch)
+{
+	for (const util::DataPoint<double>& dp : batch)
+	{
+		Forward(dp.input);
+
+		// output layer: activation derivative times cost derivative
+		size_t last = n_layers - 1;
+		size_t out = layer_c[last];
+		double* __restrict nv = nodeValues.data();
+		Derivative(nv, weightedInputs[last].data(), outputs[last].data(), out * K, outputType);
+		for (size_t c = 0; c < out; c++)
+		{
+			for (size_t k = 0; k < K; k++)
+			{
+				nv[c * K + k] *= cost->Derivative(outputs[last][c * K + k], dp.expected[c]);
+			}
+		}
+
+		for (size_t i = last; i > 0; --i)
+		{
+			const size_t in = layer_c[i - 1];
+			out = layer_c[i];
+
+			// weight gradient += previous outputs^T * node values, the bias gradient is the node values of the last point as in Network
+			const double* __restrict a = outputs[i - 1].data();
+			double* __restrict wg = weight_grad[i].data();
+			for (size_t r = 0; r < in; r++)
+			{
+				for (size_t c = 0; c < out; c++)
+				{
+					double* __restrict g = wg + (r * out + c) * K;
+					const double* __restrict v = nv + c * K;
+					for (size_t k = 0; k < K; k++)
+					{
+						g[k] += a[r * K + k] * v[k];
+					}
+				}
+			}
+			std::memcpy(bias_grad[i].data(), nv, out * K * sizeof(double));
+
+			if (i == 1)
+			{
+				break;
+			}
+
+			// node values of layer i - 1: (node values * weights^T) hadamard activation derivative
+			const double* __restrict w = weights[i].data();
+			double* __restrict p = propagated.data();
+			for (size_t r = 0; r < in; r++)
+			{
+				double* __restrict pr = p + r * K;
+				std::fill(pr, pr + K, 0.0);
+				for (size_t c = 0; c < out; c++)
+				{
+					const double* __restrict wrc = w + (r * out + c) * K;
+					const double* __restrict v = nv + c * K;
+					for (size_t k = 0; k < K; k++)
+					{
+						pr[k] += v[k] * wrc[k];
+					}
+				}
+			}
+			Derivative(nv, weightedInputs[i - 1].data(), outputs[i - 1].data(), in * K, hiddenType);
+			for (size_t n = 0; n < in * K; n++)
+			{
+				nv[n] = p[n] * nv[n];
+			}
+		}
+	}
+
+	// apply and clear, each member with its own learning rate
+	for (size_t i = 1; i < n_layers; i++)
+	{
+		for (auto [param, grad] : { std::make_pair(&weights[i], &weight_grad[i]), std::make_pair(&biases[i], &bias_grad[i]) })
+		{
+			double* __restrict y = param->data();
+			double* __restrict g = grad->data();
+			const double* __restrict lr = learnRates.data();
+			size_t n = param->size() / K;
+			for (size_t q = 0; q < n; q++)
+			{
+				for (size_t k = 0; k < K; k++)
+				{
+					y[q * K + k] += -lr[k] * g[q * K + k];
+				}
+			}
+			std::fill(grad->begin(), grad->end(), 0.0);
+		}
+	}
+}
+
+math::DMatrix net::Ensemble::Feed(math::ConstDMatrixView input)
+{
+	Forward(input);
+	size_t out = layer_c[n_layers - 1];
+	math::DMatrix res{ K, out };
+	for (size_t k = 0; k < K; k++)
+	{
+		for (size_t c = 0; c < out; c++)
+		{
+			res(k, c) = outputs[n_layers - 1][c * K + k];
+		}
+	}
+	return res;
+}
+
+std::vector<double> net::Ensemble::GetCosts(const std::vector<util::DataPoint<double>>& data)
+{
+	std::vector<double> costs(K, 0.0);
+	size_t out = layer_c[n_layers - 1];
+	for (const util::DataPoint<double>& dp : data)
+	{
+		Forward(dp.input);
+		for (size_t k = 0; k < K; k++)
+		{
+			double sum = 0.0;
+			for (size_t c = 0; c < out; c++)
+			{
+				sum += cost->Calculate(outputs[n_layers - 1][c * K + k], dp.expected[c]);
+			}
+			costs[k] += sum;
+		}
+	}
+	for (double& c : costs)
+	{
+		c /= data.size();
+	}
+	return costs;
+}
+
+void net::Ensemble::TakeSnapshot(size_t member, Snapshot& snapshot) const
+{
+	assert(member < K);
+	math::mem::ScopedResource scope{ &math::mem::GlobalPool() };
+
+	snapshot.layer_c = layer_c;
+	snapshot.hiddenType = hiddenType;
+	snapshot.outputType = outputType;
+	snapshot.weights.assign(n_layers, math::DMatrix{});
+	snapshot.biases.assign(n_layers, math::DMatrix{});
+	for (size_t i = 1; i < n_layers; i++)
+	{
+		snapshot.weights[i] = math::DMatrix{ layer_c[i - 1], layer_c[i] };
+		snapshot.biases[i] = math::DMatrix{ 1, layer_c[i] };
+		for (size_t p = 0; p < snapshot.weights[i].GetSize(); p++)
+		{
+			snapshot.weights[i][p] = weights[i][p * K + member];
+		}
+		for (size_t p = 0; p < snapshot.biases[i].GetSize(); p++)
+		{
+			snapshot.biases[i][p] = biases[i][p * K + member];
+		}
+	}
+}
+
+std::unique_ptr<net::Network> net::Ensemble::Extract(size_t member) const
+{
+	Snapshot snapshot;
+	TakeSnapshot(member, snapshot);
+	auto network = std::make_unique<Network>(layer_c, cost, actf::GetActivation(hiddenType), actf::GetActivation(outputType));
+	network->Restore(snapshot);
+	return network;
+}
+
+size_t net::Ensemble::GetSize() const
+{
+	return K;
+}
+
+const std::vector<size_t>& net::Ensemble::GetLayerSizes() const
+{
+	return layer_c;
+}
+
+double net::Ensemble::GetLearnRate(size_t member) const
+{
+	return learnRates[member];
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include "Network.h"
+#include <vector>
+#include <memory>
+
+namespace net
+{
+	// K networks of one topology trained in lockstep on the same batches
+	// parameter p of member k is stored at p * K + k, so the innermost loops run over the members and vectorize:
+	// one vector instruction advances as many members as the register holds
+	// activations and costs must be elementwise (Sigmoid or ReLU, MSE or CrossEntropy)
+	class Ensemble
+	{
+	public:
+		// member k starts from its own weights drawn from seeds[k] and trains with learnRates[k]
+		Ensemble(std::vector<size_t> layer_c, cost::Cost<double>* cost,
+			actf::ACTIVATION_TYPE hiddenType, actf::ACTIVATION_TYPE outputType,
+			std::vector<double> learnRates, std::vector<uint64_t> seeds,
+			double bias = 0.0);
+	public:
+		// the same steps Network::Learn takes, for every member at once
+		void Learn(const std::vector<util::DataPoint<double>>& batch);
+
+		// K x outputs, row k is member k's output
+		math::DMatrix Feed(math::ConstDMatrixView input);
+		std::vector<double> GetCosts(const std::vector<util::DataPoint<double>>& data); // average cost of each member over data
+
+		// member k as a standalone network, e.g. to Save it
+		void TakeSnapshot(size_t member, Snapshot& snapshot) const;
+		std::unique_ptr<Network> Extract(size_t member) const;
+
+		size_t GetSize() const;
+		const std::vector<size_t>& GetLayerSizes() const;
+		double GetLearnRate(size_t member) const;
+	private:
+		void Forward(math::ConstDMatrixView input);
+		void Activate(double* out, const double* in, size_t n, actf::ACTIVATION_TYPE type) const;
+		void Derivative(double* out, const double* weightedInputs, const double* outputs, size_t n, actf::ACTIVATION_TYPE type) const;
+	private:
+		std::vector<size_t> layer_c;
+		size_t n_layers;
+		size_t K;
+		cost::Cost<double>* cost;
+		actf::ACTIVATION_TYPE hiddenType;
+		actf::ACTIVATION_TYPE outputType;
+		std::vector<double> learnRates;
+
+		// per layer, interleaved over the members, index 0 is the input layer
+		std::vector<std::vector<double>> weights; // (row * columns + column) * K + k
+		std::vector<std::vector<double>> biases;
+		std::vector<std::vector<double>> weight_grad;
+		std::vector<std::vector<double>> bias_grad;
+		std::vector<std::vector<double>> weightedInputs;
+		std::vector<std::vector<double>> outputs;
+		std::vector<double> nodeValues;
+		std::vector<double> propagated;
+	};
+}
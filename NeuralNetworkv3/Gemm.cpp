@@ -0,0 +1,40 @@
+#include "Gemm.h"
+#include <map>
+#include <tuple>
+#include <mutex>
+#include <shared_mutex>
+#include <atomic>
+
+namespace
+{
+	typedef std::tuple<size_t, size_t, size_t, bool> Shape;
+
+	std::map<Shape, math::GemmConfig> _configs;
+	std::shared_mutex _configsMutex;
+	std::atomic<bool> _hasConfigs{ false }; // skips the lock entirely until something has been tuned
+}
+
+math::GemmConfig math::GetGemmConfig(size_t M, size_t N, size_t K, bool transposedB)
+{
+	if (!_hasConfigs.load(std::memory_order_acquire))
+	{
+		return {};
+	}
+	std::shared_lock<std::shared_mutex> lock{ _configsMutex };
+	auto it = _configs.find(Shape{ M, N, K, transposedB });
+	return it == _configs.end() ? GemmConfig{} : it->second;
+}
+
+void math::SetGemmConfig(size_t M, size_t N, size_t K, bool transposedB, const GemmConfig& config)
+{
+	std::unique_lock<std::shared_mutex> lock{ _configsMutex };
+	_configs[Shape{ M, N, K, transposedB }] = config;
+	_hasConfigs.store(true, std::memory_order_release);
+}
+
+void math::ClearGemmConfigs()
+{
+	std::unique_lock<std::shared_mutex> lock{ _configsMutex };
+	_configs.clear();
+	_hasConfigs.store(false, std::memory_order_release);
+}
@@ -0,0 +1,247 @@
+#pragma once
+
+#include "MatrixView.h"
+#include "Parallel.h"
+
+namespace math
+{
+	// blocking and threading of one GEMM shape, picked per host by util::tune
+	struct GemmConfig
+	{
+		size_t blockK = 256; // rows of B kept hot in cache while a block of C is updated
+		size_t blockN = 1024; // columns of C and B per block
+		size_t lanes = 1; // independent partial sums in A * B^T dot products, > 1 changes the rounding slightly
+		size_t threads = 1; // the columns of C are split between this many threads
+	};
+
+	constexpr size_t gemmTuneThreshold = (size_t)1 << 14; // shapes with fewer multiply-adds always use the default config
+	constexpr size_t fusedBackwardThreshold = (size_t)1 << 20; // smaller weight matrices stay in cache, two Gemm sweeps are faster there
+
+	// tuned configs are looked up by shape, unknown shapes get the default config
+	GemmConfig GetGemmConfig(size_t M, size_t N, size_t K, bool transposedB);
+	void SetGemmConfig(size_t M, size_t N, size_t K, bool transposedB, const GemmConfig& config);
+	void ClearGemmConfigs();
+
+	template<typename T, size_t W>
+	inline T Dot(const T* a, const T* b, size_t n)
+	{
+		T acc[W] = {};
+		size_t k = 0;
+		for (; k + W <= n; k += W)
+		{
+			for (size_t w = 0; w < W; w++)
+			{
+				acc[w] += a[k + w] * b[k + w];
+			}
+		}
+		T sum = 0;
+		for (size_t w = 0; w < W; w++)
+		{
+			sum += acc[w];
+		}
+		for (; k < n; k++)
+		{
+			sum += a[k] * b[k];
+		}
+		return sum;
+	}
+
+	template<typename T>
+	inline T Dot(const T* a, const T* b, size_t n, size_t lanes)
+	{
+		switch (lanes)
+		{
+		case 8:
+			return Dot<T, 8>(a, b, n);
+		case 4:
+			return Dot<T, 4>(a, b, n);
+		case 2:
+			return Dot<T, 2>(a, b, n);
+		default:
+			return Dot<T, 1>(a, b, n);
+		}
+	}
+
+	// columns [j0, j1) of C += alpha * A * B
+	template<typename T>
+	inline void GemmColumns(MatrixView<T> C, MatrixView<const T> A, MatrixView<const T> B, T alpha, size_t j0, size_t j1, const GemmConfig& config)
+	{
+		const size_t M = C.GetRows(), K = A.GetColumns();
+
+		if (B.IsRowMajor() && C.IsRowMajor())
+		{
+			// C row i += A(i, k) * B row k, B and C are streamed contiguously, k stays in order so blocking does not change the result
+			for (size_t kb = 0; kb < K; kb += config.blockK)
+			{
+				size_t kEnd = std::min(K, kb + config.blockK);
+				for (size_t jb = j0; jb < j1; jb += config.blockN)
+				{
+					size_t jEnd = std::min(j1, jb + config.blockN);
+					for (size_t i = 0; i < M; i++)
+					{
+						T* __restrict c = C.GetData() + i * C.GetRowStride();
+						for (size_t k = kb; k < kEnd; k++)
+						{
+							T a = alpha * A(i, k);
+							if (a == 0)
+							{
+								continue;
+							}
+							const T* __restrict b = B.GetData() + k * B.GetRowStride();
+							for (size_t j = jb; j < jEnd; j++)
+							{
+								c[j] += a * b[j];
+							}
+						}
+					}
+				}
+			}
+		}
+		else if (B.IsTransposed() && A.IsRowMajor())
+		{
+			// A * B^T: every element is a dot product of two contiguous rows
+			for (size_t i = 0; i < M; i++)
+			{
+				const T* a = A.GetData() + i * A.GetRowStride();
+				for (size_t j = j0; j < j1; j++)
+				{
+					C(i, j) += alpha * Dot(a, B.GetData() + j * B.GetColumnStride(), K, config.lanes);
+				}
+			}
+		}
+		else
+		{
+			for (size_t i = 0; i < M; i++)
+			{
+				for (size_t j = j0; j < j1; j++)
+				{
+					T sum = 0;
+					for (size_t k = 0; k < K; k++)
+					{
+						sum += A(i, k) * B(k, j);
+					}
+					C(i, j) += alpha * sum;
+				}
+			}
+		}
+	}
+
+	// C = alpha * A * B + beta * C with an explicit config
+	template<typename T>
+	inline void Gemm(MatrixView<T> C, MatrixView<const T> A, MatrixView<const T> B, T alpha, T beta, const GemmConfig& config)
+	{
+		assert(A.GetColumns() == B.GetRows() && C.GetRows() == A.GetRows() && C.GetColumns() == B.GetColumns());
+		const size_t M = C.GetRows(), N = C.GetColumns();
+
+		if (beta != 1)
+		{
+			for (size_t i = 0; i < M; i++)
+			{
+				for (size_t j = 0; j < N; j++)
+				{
+					C(i, j) = beta == 0 ? 0 : C(i, j) * beta;
+				}
+			}
+		}
+
+		if (config.threads <= 1)
+		{
+			GemmColumns(C, A, B, alpha, 0, N, config);
+			return;
+		}
+		// threads own disjoint column ranges of C, so they never write the same element
+		util::ParallelFor(N, (N + config.threads - 1) / config.threads, [&](size_t j0, size_t j1) {
+			GemmColumns(C, A, B, alpha, j0, j1, config);
+		}, config.threads);
+	}
+
+	// C = alpha * A * B + beta * C
+	// A and B may be transposed or sliced views, the loop order is picked from their strides so A^T * B and A * B^T never copy
+	template<typename T>
+	inline void Gemm(MatrixView<T> C, MatrixView<const T> A, MatrixView<const T> B, T alpha = 1, T beta = 0)
+	{
+		const size_t M = C.GetRows(), N = C.GetColumns(), K = A.GetColumns();
+		Gemm(C, A, B, alpha, beta, M * N * K < gemmTuneThreshold ? GemmConfig{} : GetGemmConfig(M, N, K, B.IsTransposed()));
+	}
+
+	// one backward step through a layer, every row of W (inputs x outputs) is read once and all results come out of that pass:
+	// weightGrad += inputs^T * nodeValues and propagated = (nodeValues * W^T) hadamard derivative
+	// inputs, nodeValues, derivative and propagated are single rows, an empty weightGrad or propagated skips that half
+	// the results are bit-identical to the separate Gemm calls, which are made instead below fusedBackwardThreshold weights
+	template<typename T>
+	inline void FusedBackward(MatrixView<const T> W, MatrixView<const T> nodeValues, MatrixView<const T> inputs, MatrixView<const T> derivative,
+		MatrixView<T> weightGrad, MatrixView<T> propagated)
+	{
+		const size_t M = W.GetRows(), N = W.GetColumns();
+		const bool accumulate = weightGrad.GetSize() != 0, propagate = propagated.GetSize() != 0;
+		assert(W.IsRowMajor() && nodeValues.IsRowMajor() && nodeValues.GetSize() == N);
+		assert(!accumulate || (weightGrad.IsRowMajor() && weightGrad.GetRows() == M && weightGrad.GetColumns() == N && inputs.GetSize() == M));
+		assert(!propagate || (propagated.GetSize() == M && derivative.GetSize() == M));
+
+		if (M * N < fusedBackwardThreshold)
+		{
+			if (accumulate)
+			{
+				Gemm<T>(weightGrad, inputs.Transposed(), nodeValues, 1, 1);
+			}
+			if (propagate)
+			{
+				Gemm<T>(propagated, nodeValues, W.Transposed());
+				for (size_t r = 0; r < M; r++)
+				{
+					propagated(0, r) *= derivative(0, r);
+				}
+			}
+			return;
+		}
+
+		// same config the propagation Gemm would look up, lanes changes its rounding and threads split the rows
+		const GemmConfig config = M * N < gemmTuneThreshold ? GemmConfig{} : GetGemmConfig(1, M, N, true);
+		const T* __restrict nv = nodeValues.GetData();
+
+		auto rows = [&](size_t r0, size_t r1) {
+			for (size_t r = r0; r < r1; r++)
+			{
+				const T* w = W.GetData() + r * W.GetRowStride();
+				if (accumulate)
+				{
+					T a = inputs(0, r);
+					if (a != 0)
+					{
+						T* __restrict g = weightGrad.GetData() + r * weightGrad.GetRowStride();
+						for (size_t j = 0; j < N; j++)
+						{
+							g[j] += a * nv[j];
+						}
+					}
+				}
+				if (propagate)
+				{
+					T sum = 0;
+					sum += Dot(w, nv, N, config.lanes);
+					propagated(0, r) = sum * derivative(0, r);
+				}
+			}
+		};
+
+		if (config.threads <= 1)
+		{
+			rows(0, M);
+			return;
+		}
+		util::ParallelFor(M, (M + config.threads - 1) / config.threads, rows, config.threads);
+	}
+
+	template<typename T>
+	inline void Copy(MatrixView<T> dst, MatrixView<const T> src)
+	{
+		assert(dst.GetRows() == src.GetRows() && dst.GetColumns() == src.GetColumns());
+		for (size_t i = 0; i < dst.GetRows(); i++)
+		{
+			for (size_t j = 0; j < dst.GetColumns(); j++)
+			{
+				dst(i, j) = src(i, j);
+			}
+		}
+	}
+}
@@ -0,0 +1,351 @@
+#include "Half.h"
+#include <atomic>
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#include <immintrin.h>
+#define HALF_X86
+#define HALF_TARGET(features)
+#elif defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <immintrin.h>
+#define HALF_X86
+#define HALF_TARGET(features) __attribute__((target(features)))
+#endif
+
+namespace
+{
+	struct CpuFeatures
+	{
+		bool f16c = false;
+		bool avx2 = false;
+		bool avx512bf16 = false;
+	};
+
+	constexpr size_t lanes = 8; // partial sums of Dot, one AVX register of floats
+
+	template<typename Widen>
+	float DotScalar(const uint16_t* x, const float* y, size_t n, Widen widen)
+	{
+		float acc[lanes] = {};
+		size_t i = 0;
+		for (; i + lanes <= n; i += lanes)
+		{
+			for (size_t l = 0; l < lanes; l++)
+			{
+				acc[l] += widen(x[i + l]) * y[i + l];
+			}
+		}
+		float sum = 0.0f;
+		for (size_t l = 0; l < lanes; l++)
+		{
+			sum += acc[l];
+		}
+		for (; i < n; i++)
+		{
+			sum += widen(x[i]) * y[i];
+		}
+		return sum;
+	}
+
+#ifdef HALF_X86
+	void CpuId(unsigned leaf, unsigned subleaf, unsigned regs[4])
+	{
+#ifdef _MSC_VER
+		__cpuidex((int*)regs, (int)leaf, (int)subleaf);
+#else
+		__cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+	}
+
+	uint64_t EnabledStates()
+	{
+#ifdef _MSC_VER
+		return _xgetbv(0);
+#else
+		uint32_t lo, hi;
+		__asm__ volatile("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+		return ((uint64_t)hi << 32) | lo;
+#endif
+	}
+
+	HALF_TARGET("avx,f16c") void EncodeF16c(const float* in, uint16_t* out, size_t n)
+	{
+		size_t i = 0;
+		for (; i + 8 <= n; i += 8)
+		{
+			_mm_storeu_si128((__m128i*)(out + i), _mm256_cvtps_ph(_mm256_loadu_ps(in + i), _MM_FROUND_TO_NEAREST_INT));
+		}
+		for (; i < n; i++)
+		{
+			out[i] = math::half::ToFp16(in[i]);
+		}
+	}
+
+	HALF_TARGET("avx,f16c") void DecodeF16c(const uint16_t* in, float* out, size_t n)
+	{
+		size_t i = 0;
+		for (; i + 8 <= n; i += 8)
+		{
+			_mm256_storeu_ps(out + i, _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*)(in + i))));
+		}
+		for (; i < n; i++)
+		{
+			out[i] = math::half::FromFp16(in[i]);
+		}
+	}
+
+	// the vector kernels finish like DotScalar: the lanes are added in order, then the tail
+	HALF_TARGET("avx") float FinishDot(__m256 acc, const uint16_t* x, const float* y, size_t i, size_t n, math::HALF_FORMAT format)
+	{
+		float parts[lanes];
+		_mm256_storeu_ps(parts, acc);
+		float sum = 0.0f;
+		for (size_t l = 0; l < lanes; l++)
+		{
+			sum += parts[l];
+		}
+		for (; i < n; i++)
+		{
+			sum += math::half::Decode(x[i], format) * y[i];
+		}
+		return sum;
+	}
+
+	HALF_TARGET("avx,f16c") void AxpyF16c(float a, const uint16_t* x, float* y, size_t n)
+	{
+		__m256 va = _mm256_set1_ps(a);
+		size_t i = 0;
+		for (; i + 8 <= n; i += 8)
+		{
+			__m256 vx = _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*)(x + i)));
+			_mm256_storeu_ps(y + i, _mm256_add_ps(_mm256_loadu_ps(y + i), _mm256_mul_ps(va, vx)));
+		}
+		for (; i < n; i++)
+		{
+			y[i] += a * math::half::FromFp16(x[i]);
+		}
+	}
+
+	HALF_TARGET("avx,f16c") float DotF16c(const uint16_t* x, const float* y, size_t n)
+	{
+		__m256 acc = _mm256_setzero_ps();
+		size_t i = 0;
+		for (; i + 8 <= n; i += 8)
+		{
+			__m256 vx = _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*)(x + i)));
+			acc = _mm256_add_ps(acc, _mm256_mul_ps(vx, _mm256_loadu_ps(y + i)));
+		}
+		return FinishDot(acc, x, y, i, n, math::HALF_FORMAT::FP16);
+	}
+
+	HALF_TARGET("avx2") __m256 WidenBf16(const uint16_t* x)
+	{
+		return _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)x)), 16));
+	}
+
+	HALF_TARGET("avx2") void AxpyBf16Avx2(float a, const uint16_t* x, float* y, size_t n)
+	{
+		__m256 va = _mm256_set1_ps(a);
+		size_t i = 0;
+		for (; i + 8 <= n; i += 8)
+		{
+			_mm256_storeu_ps(y + i, _mm256_add_ps(_mm256_loadu_ps(y + i), _mm256_mul_ps(va, WidenBf16(x + i))));
+		}
+		for (; i < n; i++)
+		{
+			y[i] += a * math::half::FromBf16(x[i]);
+		}
+	}
+
+	HALF_TARGET("avx2") float DotBf16Avx2(const uint16_t* x, const float* y, size_t n)
+	{
+		__m256 acc = _mm256_setzero_ps();
+		size_t i = 0;
+		for (; i + 8 <= n; i += 8)
+		{
+			acc = _mm256_add_ps(acc, _mm256_mul_ps(WidenBf16(x + i), _mm256_loadu_ps(y + i)));
+		}
+		return FinishDot(acc, x, y, i, n, math::HALF_FORMAT::BF16);
+	}
+
+	HALF_TARGET("avx512f,avx512bf16") void EncodeAvx512Bf16(const float* in, uint16_t* out, size_t n)
+	{
+		size_t i = 0;
+		for (; i + 16 <= n; i += 16)
+		{
+			__m256bh packed = _mm512_cvtneps_pbh(_mm512_loadu_ps(in + i));
+			std::memcpy(out + i, &packed, sizeof(packed));
+		}
+		for (; i < n; i++)
+		{
+			out[i] = math::half::ToBf16(in[i]);
+		}
+	}
+#endif
+
+	CpuFeatures Detect()
+	{
+		CpuFeatures cpu;
+#ifdef HALF_X86
+		unsigned regs[4] = {};
+		CpuId(0, 0, regs);
+		unsigned maxLeaf = regs[0];
+
+		// the instructions need the CPU flag and the OS saving the vector registers they use
+		CpuId(1, 0, regs);
+		bool osxsave = regs[2] & (1u << 27), avx = regs[2] & (1u << 28), f16c = regs[2] & (1u << 29);
+		if (!osxsave)
+		{
+			return cpu;
+		}
+		uint64_t states = EnabledStates();
+		cpu.f16c = avx && f16c && (states & 0x6) == 0x6;
+
+		if (maxLeaf >= 7)
+		{
+			CpuId(7, 0, regs);
+			cpu.avx2 = (regs[1] & (1u << 5)) && (states & 0x6) == 0x6;
+			bool avx512f = regs[1] & (1u << 16);
+			CpuId(7, 1, regs);
+			bool bf16 = regs[0] & (1u << 5);
+			cpu.avx512bf16 = avx512f && bf16 && (states & 0xE6) == 0xE6;
+		}
+#endif
+		return cpu;
+	}
+
+	const CpuFeatures _cpu = Detect();
+	std::atomic<bool> _useHardware{ true };
+}
+
+void math::half::Encode(const float* in, uint16_t* out, size_t n, HALF_FORMAT format)
+{
+#ifdef HALF_X86
+	if (_useHardware.load(std::memory_order_relaxed))
+	{
+		if (format == HALF_FORMAT::FP16 && _cpu.f16c)
+		{
+			EncodeF16c(in, out, n);
+			return;
+		}
+		if (format == HALF_FORMAT::BF16 && _cpu.avx512bf16)
+		{
+			EncodeAvx512Bf16(in, out, n);
+			return;
+		}
+	}
+#endif
+	if (format == HALF_FORMAT::BF16)
+	{
+		for (size_t i = 0; i < n; i++)
+		{
+			out[i] = ToBf16(in[i]);
+		}
+	}
+	else
+	{
+		for (size_t i = 0; i < n; i++)
+		{
+			out[i] = ToFp16(in[i]);
+		}
+	}
+}
+
+void math::half::Decode(const uint16_t* in, float* out, size_t n, HALF_FORMAT format)
+{
+	if (format == HALF_FORMAT::BF16)
+	{
+		// a shift, which the compiler vectorizes on every target
+		for (size_t i = 0; i < n; i++)
+		{
+			out[i] = FromBf16(in[i]);
+		}
+		return;
+	}
+#ifdef HALF_X86
+	if (_useHardware.load(std::memory_order_relaxed) && _cpu.f16c)
+	{
+		DecodeF16c(in, out, n);
+		return;
+	}
+#endif
+	for (size_t i = 0; i < n; i++)
+	{
+		out[i] = FromFp16(in[i]);
+	}
+}
+
+void math::half::Axpy(float a, const uint16_t* x, float* y, size_t n, HALF_FORMAT format)
+{
+#ifdef HALF_X86
+	if (_useHardware.load(std::memory_order_relaxed))
+	{
+		if (format == HALF_FORMAT::FP16 && _cpu.f16c)
+		{
+			AxpyF16c(a, x, y, n);
+			return;
+		}
+		if (format == HALF_FORMAT::BF16 && _cpu.avx2)
+		{
+			AxpyBf16Avx2(a, x, y, n);
+			return;
+		}
+	}
+#endif
+	if (format == HALF_FORMAT::BF16)
+	{
+		for (size_t i = 0; i < n; i++)
+		{
+			y[i] += a * FromBf16(x[i]);
+		}
+	}
+	else
+	{
+		for (size_t i = 0; i < n; i++)
+		{
+			y[i] += a * FromFp16(x[i]);
+		}
+	}
+}
+
+float math::half::Dot(const uint16_t* x, const float* y, size_t n, HALF_FORMAT format)
+{
+#ifdef HALF_X86
+	if (_useHardware.load(std::memory_order_relaxed))
+	{
+		if (format == HALF_FORMAT::FP16 && _cpu.f16c)
+		{
+			return DotF16c(x, y, n);
+		}
+		if (format == HALF_FORMAT::BF16 && _cpu.avx2)
+		{
+			return DotBf16Avx2(x, y, n);
+		}
+	}
+#endif
+	return format == HALF_FORMAT::BF16 ? DotScalar(x, y, n, FromBf16) : DotScalar(x, y, n, FromFp16);
+}
+
+std::string math::half::Features()
+{
+	std::string features;
+	if (_useHardware.load() && _cpu.f16c)
+	{
+		features += "F16C ";
+	}
+	if (_useHardware.load() && _cpu.avx2)
+	{
+		features += "AVX2 ";
+	}
+	if (_useHardware.load() && _cpu.avx512bf16)
+	{
+		features += "AVX512-BF16 ";
+	}
+	return features.empty() ? "software" : features.substr(0, features.size() - 1);
+}
+
+void math::half::UseHardware(bool value)
+{
+	_useHardware.store(value);
+}
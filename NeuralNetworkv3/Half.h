@@ -0,0 +1,137 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <string>
+
+namespace math
+{
+	enum class HALF_FORMAT
+	{
+		BF16, // fp32's 8-bit exponent with 7 mantissa bits, same range as fp32
+		FP16 // IEEE binary16, 5-bit exponent with 10 mantissa bits, largest finite value 65504
+	};
+
+	// 16-bit storage formats, values are only stored in them, arithmetic always happens in fp32
+	namespace half
+	{
+		inline uint32_t Bits(float v)
+		{
+			uint32_t bits;
+			std::memcpy(&bits, &v, sizeof(bits));
+			return bits;
+		}
+
+		inline float FromBits(uint32_t bits)
+		{
+			float v;
+			std::memcpy(&v, &bits, sizeof(v));
+			return v;
+		}
+
+		// every conversion to 16 bits rounds to nearest even, NaN stays NaN and overflow becomes infinity
+		inline uint16_t ToBf16(float v)
+		{
+			uint32_t bits = Bits(v);
+			if ((bits & 0x7FFFFFFF) > 0x7F800000)
+			{
+				return (uint16_t)((bits >> 16) | 0x40); // quiet NaN, the rounding below could turn it into infinity
+			}
+			return (uint16_t)((bits + 0x7FFF + ((bits >> 16) & 1)) >> 16);
+		}
+
+		inline float FromBf16(uint16_t v)
+		{
+			return FromBits((uint32_t)v << 16);
+		}
+
+		inline uint16_t ToFp16(float v)
+		{
+			uint32_t bits = Bits(v);
+			uint16_t sign = (uint16_t)((bits >> 16) & 0x8000);
+			uint32_t x = bits & 0x7FFFFFFF;
+
+			if (x >= 0x7F800000)
+			{
+				return sign | (x > 0x7F800000 ? 0x7E00 : 0x7C00);
+			}
+			if (x >= 0x477FF000) // 65520 and up round to infinity
+			{
+				return sign | 0x7C00;
+			}
+			if (x < 0x38800000) // below 2^-14 the result is subnormal
+			{
+				if (x < 0x33000000) // at most 2^-25, which ties to zero
+				{
+					return sign;
+				}
+				uint32_t exponent = x >> 23;
+				uint32_t mantissa = (x & 0x7FFFFF) | 0x800000;
+				uint32_t shift = 126 - exponent;
+				uint32_t h = mantissa >> shift;
+				uint32_t rest = mantissa & ((1u << shift) - 1), halfway = 1u << (shift - 1);
+				h += rest > halfway || (rest == halfway && (h & 1));
+				return sign | (uint16_t)h;
+			}
+
+			// rebias the exponent from 127 to 15, a mantissa carry correctly bumps the exponent
+			uint32_t h = (x - 0x38000000) >> 13;
+			uint32_t rest = x & 0x1FFF;
+			h += rest > 0x1000 || (rest == 0x1000 && (h & 1));
+			return sign | (uint16_t)h;
+		}
+
+		inline float FromFp16(uint16_t v)
+		{
+			uint32_t sign = (uint32_t)(v & 0x8000) << 16;
+			uint32_t exponent = (v >> 10) & 0x1F;
+			uint32_t mantissa = v & 0x3FF;
+
+			if (exponent == 0x1F)
+			{
+				return FromBits(sign | 0x7F800000 | (mantissa << 13));
+			}
+			if (exponent != 0)
+			{
+				return FromBits(sign | ((exponent + 112) << 23) | (mantissa << 13));
+			}
+			if (mantissa == 0)
+			{
+				return FromBits(sign);
+			}
+			// subnormal, normalized for fp32
+			exponent = 113;
+			while (!(mantissa & 0x400))
+			{
+				mantissa <<= 1;
+				exponent--;
+			}
+			return FromBits(sign | (exponent << 23) | ((mantissa & 0x3FF) << 13));
+		}
+
+		inline uint16_t Encode(float v, HALF_FORMAT format)
+		{
+			return format == HALF_FORMAT::BF16 ? ToBf16(v) : ToFp16(v);
+		}
+
+		inline float Decode(uint16_t v, HALF_FORMAT format)
+		{
+			return format == HALF_FORMAT::BF16 ? FromBf16(v) : FromFp16(v);
+		}
+
+		// bulk conversions, F16C for fp16, AVX2 for widening bf16 and AVX-512 BF16 for narrowing it when the CPU has them,
+		// the scalar code otherwise
+		// the results are the same on every path, except that AVX-512 BF16 flushes subnormal inputs to zero
+		void Encode(const float* in, uint16_t* out, size_t n, HALF_FORMAT format);
+		void Decode(const uint16_t* in, float* out, size_t n, HALF_FORMAT format);
+
+		// y += a * x and the dot product of x and y with x in 16 bits, widened as it is loaded and summed in fp32
+		// Axpy rounds exactly like the scalar expression, Dot sums 8 interleaved partial sums in a fixed order on every path
+		void Axpy(float a, const uint16_t* x, float* y, size_t n, HALF_FORMAT format);
+		float Dot(const uint16_t* x, const float* y, size_t n, HALF_FORMAT format);
+
+		std::string Features(); // the hardware paths in use, e.g. "F16C AVX2 AVX512-BF16"
+		void UseHardware(bool value); // false forces the software paths, for benchmarking them
+	}
+}
@@ -0,0 +1,190 @@
+#include "InferenceCache.h"
+#include "Memory.h"
+
+double net::CacheStats::HitRate() const
+{
+	return hits + misses == 0 ? 0.0 : (double)hits / (double)(hits + misses);
+}
+
+net::InferenceCache::InferenceCache(size_t capacity, size_t shards)
+	: capacity(capacity), n_shards(std::max<size_t>(1, std::min(shards, capacity)))
+{
+	shardCapacity = std::max<size_t>(1, capacity / n_shards);
+	this->shards = std::make_unique<Shard[]>(n_shards);
+}
+
+uint64_t net::InferenceCache::Hash(math::ConstDMatrixView input)
+{
+	// FNV-1a over the value bytes, finished with a 64-bit mix so the low bits are usable for picking shards
+	uint64_t h = 14695981039346656037ull;
+	for (size_t i = 0; i < input.GetRows(); i++)
+	{
+		for (size_t j = 0; j < input.GetColumns(); j++)
+		{
+			double v = input(i, j);
+			const unsigned char* bytes = (const unsigned char*)&v;
+			for (size_t b = 0; b < sizeof(double); b++)
+			{
+				h = (h ^ bytes[b]) * 1099511628211ull;
+			}
+		}
+	}
+	h ^= input.GetRows() * 0x9E3779B97F4A7C15ull + input.GetColumns();
+	h ^= h >> 33;
+	h *= 0xFF51AFD7ED558CCDull;
+	h ^= h >> 33;
+	return h;
+}
+
+net::InferenceCache::Shard& net::InferenceCache::ShardOf(uint64_t hash)
+{
+	return shards[(hash >> 48) % n_shards];
+}
+
+bool net::InferenceCache::SameInput(const math::DMatrix& key, math::ConstDMatrixView input)
+{
+	if (key.GetRows() != input.GetRows() || key.GetColumns() != input.GetColumns())
+	{
+		return false;
+	}
+	for (size_t i = 0; i < input.GetRows(); i++)
+	{
+		for (size_t j = 0; j < input.GetColumns(); j++)
+		{
+			if (key[i * key.GetColumns() + j] != input(i, j))
+			{
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+void net::InferenceCache::Validate(Shard& shard, uint64_t version)
+{
+	if (shard.version == version)
+	{
+		return;
+	}
+	if (!shard.slots.empty())
+	{
+		shard.stats.invalidations++;
+	}
+	shard.slots.clear();
+	shard.index.clear();
+	shard.hand = 0;
+	shard.version = version;
+}
+
+bool net::InferenceCache::Lookup(math::ConstDMatrixView input, uint64_t version, math::DMatrix& output)
+{
+	uint64_t hash = Hash(input);
+	Shard& shard = ShardOf(hash);
+	std::lock_guard<std::mutex> lock{ shard.mtx };
+	Validate(shard, version);
+
+	auto it = shard.index.find(hash);
+	if (it == shard.index.end() || !SameInput(shard.slots[it->second].input, input))
+	{
+		shard.stats.misses++;
+		return false;
+	}
+	Slot& slot = shard.slots[it->second];
+	slot.referenced = true;
+	output = slot.output;
+	shard.stats.hits++;
+	return true;
+}
+
+void net::InferenceCache::Insert(math::ConstDMatrixView input, uint64_t version, const math::DMatrix& output)
+{
+	uint64_t hash = Hash(input);
+	Shard& shard = ShardOf(hash);
+	std::lock_guard<std::mutex> lock{ shard.mtx };
+	Validate(shard, version);
+
+	// cached matrices live as long as the cache, keep them out of any per-batch arena
+	math::mem::ScopedResource scope{ &math::mem::GlobalPool() };
+
+	size_t slot_i = 0;
+	auto it = shard.index.find(hash);
+	if (it != shard.index.end())
+	{
+		slot_i = it->second; // same hash, either the same input or a collision that replaces the older entry
+	}
+	else if (shard.slots.size() < shardCapacity)
+	{
+		slot_i = shard.slots.size();
+		shard.slots.emplace_back();
+		shard.index[hash] = slot_i;
+	}
+	else
+	{
+		while (shard.slots[shard.hand].referenced)
+		{
+			shard.slots[shard.hand].referenced = false;
+			shard.hand = (shard.hand + 1) % shard.slots.size();
+		}
+		slot_i = shard.hand;
+		shard.hand = (shard.hand + 1) % shard.slots.size();
+
+		shard.index.erase(shard.slots[slot_i].hash);
+		shard.index[hash] = slot_i;
+		shard.stats.evictions++;
+	}
+
+	Slot& slot = shard.slots[slot_i];
+	slot.hash = hash;
+	slot.input.Resize(input.GetRows(), input.GetColumns());
+	math::Copy<double>(slot.input, input);
+	slot.output = output;
+	slot.referenced = false;
+}
+
+void net::InferenceCache::Clear()
+{
+	for (size_t i = 0; i < n_shards; i++)
+	{
+		std::lock_guard<std::mutex> lock{ shards[i].mtx };
+		shards[i].slots.clear();
+		shards[i].index.clear();
+		shards[i].hand = 0;
+	}
+}
+
+net::CacheStats net::InferenceCache::GetStats() const
+{
+	CacheStats total;
+	for (size_t i = 0; i < n_shards; i++)
+	{
+		const Shard& shard = shards[i];
+		std::lock_guard<std::mutex> lock{ shard.mtx };
+		total.hits += shard.stats.hits;
+		total.misses += shard.stats.misses;
+		total.evictions += shard.stats.evictions;
+		total.invalidations += shard.stats.invalidations;
+		total.entries += shard.slots.size();
+
+		total.bytes += shard.slots.capacity() * sizeof(Slot) + shard.index.size() * (sizeof(uint64_t) + sizeof(size_t) + sizeof(void*));
+		for (const Slot& slot : shard.slots)
+		{
+			total.bytes += (slot.input.IsInline() ? 0 : slot.input.GetSize() * sizeof(double)) +
+				(slot.output.IsInline() ? 0 : slot.output.GetSize() * sizeof(double));
+		}
+	}
+	return total;
+}
+
+void net::InferenceCache::ClearStats()
+{
+	for (size_t i = 0; i < n_shards; i++)
+	{
+		std::lock_guard<std::mutex> lock{ shards[i].mtx };
+		shards[i].stats = {};
+	}
+}
+
+size_t net::InferenceCache::GetCapacity() const
+{
+	return capacity;
+}
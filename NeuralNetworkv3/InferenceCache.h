@@ -0,0 +1,69 @@
+#pragma once
+
+#include "Matrix.h"
+#include <vector>
+#include <unordered_map>
+#include <mutex>
+#include <memory>
+
+namespace net
+{
+	struct CacheStats
+	{
+		size_t hits = 0;
+		size_t misses = 0;
+		size_t evictions = 0;
+		size_t invalidations = 0; // shards flushed because the weights changed
+		size_t entries = 0;
+		size_t bytes = 0; // slots plus the heap storage of their matrices
+
+		double HitRate() const;
+	};
+
+	// bounded map from inputs to network outputs, split into shards with their own lock so concurrent lookups rarely contend
+	// entries are tagged with the weight version they were computed with, a lookup with a newer version flushes the shard
+	class InferenceCache
+	{
+	public:
+		InferenceCache(size_t capacity, size_t shards = 16);
+	public:
+		bool Lookup(math::ConstDMatrixView input, uint64_t version, math::DMatrix& output);
+		void Insert(math::ConstDMatrixView input, uint64_t version, const math::DMatrix& output);
+		void Clear();
+
+		CacheStats GetStats() const;
+		void ClearStats();
+
+		size_t GetCapacity() const;
+
+		static uint64_t Hash(math::ConstDMatrixView input);
+	private:
+		struct Slot
+		{
+			uint64_t hash = 0;
+			math::DMatrix input; // the full input is kept so a hash collision is never returned as a hit
+			math::DMatrix output;
+			bool referenced = false;
+		};
+
+		// CLOCK replacement, the hand skips and clears referenced slots so recently used entries survive one more sweep
+		struct Shard
+		{
+			std::vector<Slot> slots;
+			std::unordered_map<uint64_t, size_t> index;
+			size_t hand = 0;
+			uint64_t version = 0;
+			CacheStats stats;
+			mutable std::mutex mtx;
+		};
+
+		Shard& ShardOf(uint64_t hash);
+		static bool SameInput(const math::DMatrix& key, math::ConstDMatrixView input);
+		static void Validate(Shard& shard, uint64_t version);
+	private:
+		size_t capacity;
+		size_t shardCapacity;
+		std::unique_ptr<Shard[]> shards;
+		size_t n_shards;
+	};
+}
@@ -1,31 +1,73 @@
 #include "Layer.h"
+#include <atomic>
+#include <cstring>
 
-net::Layer::Layer(Layer& in, math::DMatrix biases, size_t n_nodes, double wmin, double wmax)
-	: biases(biases), n_nodes(n_nodes), weights(in.n_nodes, n_nodes)
+namespace
 {
-	for (double& w : weights)
+	std::atomic<uint64_t> _nextVersion{ 1 };
+
+	uint64_t NextVersion()
 	{
-		w = util::Random<double>(std::uniform_real_distribution<double>(wmin, wmax)) / std::sqrt((double)in.n_nodes);
+		return _nextVersion.fetch_add(1, std::memory_order_relaxed);
 	}
 }
 
+net::Layer::Layer(Layer& in, math::DMatrix biases, size_t n_nodes, double wmin, double wmax, uint64_t stream)
+	: biases(biases), n_nodes(n_nodes), weights(in.n_nodes, n_nodes), version(NextVersion())
+{
+	util::FillUniform(weights.GetData(), weights.GetSize(), wmin, wmax, util::Philox{ SEED, stream }, 1.0 / std::sqrt((double)in.n_nodes));
+}
+
 net::Layer::Layer(size_t n_nodes)
-	: n_nodes(n_nodes)
+	: n_nodes(n_nodes), version(NextVersion())
 {}
 
-math::DMatrix net::Layer::Forward(const math::DMatrix& input, const actf::Activation& activation, bool start)
+const math::DMatrix& net::Layer::Forward(math::ConstDMatrixView input, const actf::Activation& activation, bool start, bool keepDerivative)
 {
 	if (start)
 	{
-		outputs = input;
-		return input;
+		outputs.Resize(input.GetRows(), input.GetColumns());
+		math::Copy<double>(outputs, input);
+		return outputs;
 	}
 
-	weightedInputs = input * weights + biases;
+	// biases are copied in first and the product is accumulated on top, so no temporary is created
+	weightedInputs = biases;
+	if (sparseForward)
+	{
+		if (sparseVersion != version)
+		{
+			sparse.Assign(weights);
+			sparseVersion = version;
+		}
+		math::SpMM<double>(weightedInputs, input, sparse);
+	}
+	else
+	{
+		math::Gemm<double>(weightedInputs, input, weights, 1.0, 1.0);
+	}
 	outputs = activation.Activate(weightedInputs);
+	if (keepDerivative)
+	{
+		derivatives = activation.Derivative(weightedInputs, outputs);
+	}
 	return outputs;
 }
 
+math::DMatrix net::Layer::Apply(math::ConstDMatrixView input, const actf::Activation& activation) const
+{
+	math::DMatrix weighted = biases;
+	if (sparseForward && sparseVersion == version)
+	{
+		math::SpMM<double>(weighted, input, sparse);
+	}
+	else
+	{
+		math::Gemm<double>(weighted, input, weights, 1.0, 1.0);
+	}
+	return activation.Activate(std::move(weighted));
+}
+
 const math::DMatrix& net::Layer::GetWeights() const
 {
 	return weights;
@@ -34,6 +76,14 @@ const math::DMatrix& net::Layer::GetWeights() const
 void net::Layer::SetWeights(const math::DMatrix& value)
 {
 	weights = value;
+	if (mask.GetSize() != 0)
+	{
+		for (size_t i = 0; i < weights.GetSize(); i++)
+		{
+			weights[i] *= mask[i];
+		}
+	}
+	version = NextVersion();
 }
 
 const math::DMatrix& net::Layer::GetBiases() const
@@ -44,6 +94,7 @@ const math::DMatrix& net::Layer::GetBiases() const
 void net::Layer::SetBiases(const math::DMatrix& value)
 {
 	biases = value;
+	version = NextVersion();
 }
 
 const math::DMatrix& net::Layer::GetWeightedInputs() const
@@ -54,4 +105,70 @@ const math::DMatrix& net::Layer::GetWeightedInputs() const
 const math::DMatrix& net::Layer::GetOutputs() const
 {
 	return outputs;
-}
\ No newline at end of file
+}
+
+const math::DMatrix& net::Layer::GetDerivatives() const
+{
+	return derivatives;
+}
+
+uint64_t net::Layer::GetVersion() const
+{
+	return version;
+}
+
+void net::Layer::Bind(double* weightData, double* biasData)
+{
+	std::memcpy(weightData, weights.GetData(), weights.GetSize() * sizeof(double));
+	std::memcpy(biasData, biases.GetData(), biases.GetSize() * sizeof(double));
+	weights.Bind(weightData, weights.GetRows(), weights.GetColumns());
+	biases.Bind(biasData, biases.GetRows(), biases.GetColumns());
+	version = NextVersion();
+}
+
+void net::Layer::MarkChanged()
+{
+	SetWeights(weights);
+}
+
+const math::DMatrix& net::Layer::GetMask() const
+{
+	return mask;
+}
+
+void net::Layer::SetMask(const math::DMatrix& value)
+{
+	assert(value.SizeEqu(weights));
+	mask = value;
+	SetWeights(weights);
+}
+
+void net::Layer::ClearMask()
+{
+	mask = math::DMatrix{};
+}
+
+bool net::Layer::IsSparse() const
+{
+	return sparseForward;
+}
+
+void net::Layer::SetSparse(bool value)
+{
+	sparseForward = value;
+	sparseVersion = 0;
+}
+
+double net::Layer::GetDensity() const
+{
+	if (weights.GetSize() == 0)
+	{
+		return 0.0;
+	}
+	size_t nonZeros = 0;
+	for (double w : weights)
+	{
+		nonZeros += w != 0.0;
+	}
+	return (double)nonZeros / weights.GetSize();
+}
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "Matrix.h"
+#include "SparseMatrix.h"
 #include "Activation.h"
 #include <memory>
 #include "Utility.h"
@@ -10,10 +11,15 @@ namespace net
 	class Layer
 	{
 	public:
-		Layer(Layer& in, math::DMatrix biases, size_t n_nodes, double wmin = -1.0, double wmax = 1.0);
+		// weights come from the given stream of SEED, so they do not depend on other random draws, construction order or the thread count
+		Layer(Layer& in, math::DMatrix biases, size_t n_nodes, double wmin = -1.0, double wmax = 1.0, uint64_t stream = util::LayerStream(0, 1));
 		Layer(size_t n_nodes);
 
-		math::DMatrix Forward(const math::DMatrix& input, const actf::Activation& activation, bool start = false);
+		// keepDerivative also stores the activation's derivative at the weighted inputs for backprop
+		const math::DMatrix& Forward(math::ConstDMatrixView input, const actf::Activation& activation, bool start = false, bool keepDerivative = false);
+		// same result as Forward but leaves the layer untouched, so any number of threads can call it at once
+		// the CSR weights are only used once a Forward has built them for the current version
+		math::DMatrix Apply(math::ConstDMatrixView input, const actf::Activation& activation) const;
 	public:
 		const math::DMatrix& GetWeights() const;
 		void SetWeights(const math::DMatrix& value);
@@ -23,11 +29,36 @@ namespace net
 
 		const math::DMatrix& GetWeightedInputs() const;
 		const math::DMatrix& GetOutputs() const;
+		const math::DMatrix& GetDerivatives() const; // from the last Forward with keepDerivative
+
+		// moves the weights and biases into external storage, e.g. the network's parameter slab, current values are copied over
+		void Bind(double* weightData, double* biasData);
+		void MarkChanged(); // after the bound storage was written directly: reapplies the mask and bumps the version
+
+		// weights where the mask is 0 are forced to 0 on every SetWeights, so pruned weights stay pruned while training
+		const math::DMatrix& GetMask() const;
+		void SetMask(const math::DMatrix& value);
+		void ClearMask();
+
+		// Forward multiplies with a CSR copy of the weights, rebuilt whenever they change
+		bool IsSparse() const;
+		void SetSparse(bool value);
+		double GetDensity() const; // fraction of non-zero weights
+
+		// changes every time the weights or biases are set, drawn from one global counter so versions are never reused
+		uint64_t GetVersion() const;
 	private:
 		size_t n_nodes = 0;
 		math::DMatrix weights; // inputs x outputs
 		math::DMatrix biases;
 		math::DMatrix weightedInputs{};
 		math::DMatrix outputs{};
+		math::DMatrix derivatives{};
+		uint64_t version;
+
+		math::DMatrix mask{}; // empty unless the layer was pruned
+		math::DSparseMatrix sparse;
+		bool sparseForward = false;
+		uint64_t sparseVersion = 0;
 	};
 }
\ No newline at end of file
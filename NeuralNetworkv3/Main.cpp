@@ -2,7 +2,14 @@
 #include "ActivationFuncs.h"
 #include "CostFuncs.h"
 #include "Trainer.h"
+#include "Bench.h"
+#include "Checkpointer.h"
+#include "Distributed.h"
+#include "Autotune.h"
+#include "Sweep.h"
 #include <iostream>
+#include <chrono>
+#include <sstream>
 #include <conio.h>
 
 bool isSafe(int x, int y)
@@ -10,16 +17,8 @@ bool isSafe(int x, int y)
 	return ((x / 2) + (x / 2) * (x / 2)) < y && y < (- 6 * x * x + 10 * x * x * x);
 }
 
-int main()
+std::vector<util::DataPoint<double>> MakeData()
 {
-	using namespace net;
-	using std::string;
-
-	// {0, 1} unsafe
-	// {1, 0} safe
-	util::DataPoint<double> unsafe{ {{4.28, 2.87},1,2},{{0.0,1.0},1,2} };
-	util::DataPoint<double> safe{ {{2.45, 5.5},1,2},{{1.0,0.0},1,2} };
-
 	std::vector<util::DataPoint<double>> data;
 	for (int i = 0; i < 20000; i++)
 	{
@@ -33,13 +32,273 @@ int main()
 
 		data.push_back(dp);
 	}
+	return data;
+}
+
+// one process of a data-parallel run started by --launch, every worker trains on its shard of each batch
+int RunWorker(const net::dist::WorkerArgs& args)
+{
+	using namespace net;
+
+	std::vector<util::DataPoint<double>> data = MakeData();
+
+	cost::MSE<double> mse;
+	Network network{ {2,3,2}, &mse, std::make_unique<actf::Sigmoid>(), std::make_unique<actf::Sigmoid>() };
+	util::Trainer trainer{ data, 100, 0.8f };
+
+	std::vector<std::vector<util::DataPoint<double>>> shards;
+	for (const auto& batch : trainer.GetTrainBatches())
+	{
+		shards.push_back(dist::Shard(batch, args.rank, args.size));
+	}
+
+	std::unique_ptr<dist::Transport> transport = dist::MakeTransport(args);
+	dist::DataParallel parallel{ *transport };
+	parallel.SyncParameters(network);
+
+	// one step on the whole batch in a single process, every worker's parameters must match it after the first step
+	Network reference{ {2,3,2}, &mse, std::make_unique<actf::Sigmoid>(), std::make_unique<actf::Sigmoid>() };
+	if (args.rank == 0)
+	{
+		Snapshot initial;
+		network.TakeSnapshot(initial);
+		reference.Restore(initial);
+		reference.Learn(trainer.GetTrainBatches()[0], 0.05);
+	}
+
+	size_t samples = 0;
+	bool diverged = false;
+	auto start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < args.epochs; i++)
+	{
+		size_t index = i % shards.size();
+		parallel.Learn(network, shards[index], 0.05);
+		samples += trainer.GetTrainBatches()[index].size();
+
+		if (i == 0 && args.rank == 0)
+		{
+			// the gradients are summed in a different order, so only rounding may differ
+			const ParameterSlab& a = network.GetParameterSlab();
+			const ParameterSlab& b = reference.GetParameterSlab();
+			double difference = 0.0;
+			for (size_t k = 0; k < a.GetSize(); k++)
+			{
+				difference = std::max(difference, std::abs(a.GetData()[k] - b.GetData()[k]));
+			}
+			std::cout << "[" << args.size << " workers] parameters after one step differ from one process by at most " << difference << '\n';
+			// the other ranks still wait on this one in the all-reduce, so the run finishes before failing
+			diverged = difference > 1e-12;
+		}
+	}
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	dist::SyncStats stats = parallel.GetStats();
+	if (args.rank == 0)
+	{
+		std::cout << "[" << args.size << " workers] comm: " << stats.commSeconds << "s, exposed wait: " << stats.waitSeconds << "s of " << seconds << "s\n";
+	}
+	dist::ReportResult(args, samples / seconds);
+	return diverged ? 1 : 0;
+}
+
+// prunes a saved network, optionally fine-tunes it with the mask held fixed and saves it in the sparse format
+int RunPrune(const std::string& in, const std::string& out, double sparsity, size_t block, size_t epochs)
+{
+	using namespace net;
+
+	std::vector<util::DataPoint<double>> data = MakeData();
+	cost::MSE<double> mse;
+	const cost::Cost<double>& cost = mse;
+	Network network{ in, &mse };
+	util::Trainer trainer{ data, 100, 0.8f };
+
+	trainer.Test(network);
+	std::cout << "before: cost " << cost.Calculate(trainer.GetTestBatches()) << '\n';
+
+	network.Prune({ sparsity, block, block });
+	trainer.Test(network);
+	std::cout << "pruned to " << (network.GetSparsity() * 100.0) << "% zeros: cost " << cost.Calculate(trainer.GetTestBatches()) << '\n';
+
+	for (size_t i = 0; i < epochs; i++)
+	{
+		trainer.Train(network, 0.05, i % trainer.GetTrainBatches().size());
+	}
+	if (epochs > 0)
+	{
+		trainer.Test(network);
+		std::cout << "fine-tuned " << epochs << " epochs, " << (network.GetSparsity() * 100.0) << "% zeros: cost " << cost.Calculate(trainer.GetTestBatches()) << '\n';
+	}
+
+	// the sparse kernel only pays off below the crossover measured for the widest layer on this machine
+	const std::vector<size_t>& sizes = network.GetLayerSizes();
+	size_t widest = 1;
+	for (size_t i = 1; i < sizes.size(); i++)
+	{
+		widest = sizes[i - 1] * sizes[i] > sizes[widest - 1] * sizes[widest] ? i : widest;
+	}
+	double crossover = prune::MeasureCrossover(sizes[widest - 1], sizes[widest]);
+	network.SetSparseInference(crossover);
+	std::cout << "sparse inference below density " << crossover << '\n';
+
+	network.Save(out, true);
+	std::cout << "saved to " << out << '\n';
+	return 0;
+}
+
+// retrains only the layers from firstTrainable up, the frozen prefix is computed once per distinct input
+int RunFinetune(const std::string& in, const std::string& out, size_t firstTrainable, size_t epochs)
+{
+	using namespace net;
+
+	std::vector<util::DataPoint<double>> data = MakeData();
+	cost::MSE<double> mse;
+	const cost::Cost<double>& cost = mse;
+	Network network{ in, &mse };
+	util::Trainer trainer{ data, 100, 0.8f };
+
+	network.FreezeBelow(firstTrainable);
+	network.EnablePrefixCache(1 << 16);
+
+	trainer.Test(network);
+	std::cout << "before: cost " << cost.Calculate(trainer.GetTestBatches()) << '\n';
+
+	auto start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < epochs; i++)
+	{
+		trainer.Train(network, 0.05, i % trainer.GetTrainBatches().size());
+	}
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	trainer.Test(network);
+	CacheStats stats = network.GetPrefixCacheStats();
+	std::cout << "after " << epochs << " epochs (" << seconds << "s): cost " << cost.Calculate(trainer.GetTestBatches())
+		<< ", frozen prefix hit rate " << (stats.HitRate() * 100.0) << "%\n";
+
+	network.Save(out);
+	std::cout << "saved to " << out << '\n';
+	return 0;
+}
+
+// Hyperband over topology, activations, cost, learning rate and batch size on the usual data, every trial reads the same samples
+int RunSweep(const std::string& results, const std::string& best, size_t maxEpochs, size_t threads)
+{
+	using namespace net;
+
+	std::vector<util::DataPoint<double>> data = MakeData();
+	size_t trainSize = data.size() * 4 / 5;
+	util::sweep::Dataset dataset{ { data.begin(), data.begin() + trainSize }, { data.begin() + trainSize, data.end() } };
+
+	util::sweep::SearchSpace space;
+	space.topologies = { { 2, 3, 2 }, { 2, 8, 2 }, { 2, 16, 16, 2 } };
+	space.hiddenTypes = { actf::ACTIVATION_TYPE::SIGMOID, actf::ACTIVATION_TYPE::RELU };
+	space.costs = { cost::COST_TYPE::MSE, cost::COST_TYPE::CROSS_ENTROPY };
+	space.learnRates = { 0.01, 0.05, 0.2 };
+	space.batchSizes = { 50, 100 };
+
+	util::sweep::Options options;
+	options.maxEpochs = maxEpochs;
+	options.threads = threads;
+
+	util::sweep::SweepResult result = util::sweep::Hyperband(dataset, space, options);
+	result.Report(std::cout);
+	result.WriteCsv(results);
+	std::cout << "results written to " << results << '\n';
+	if (result.bestNetwork)
+	{
+		result.bestNetwork->Save(best);
+		std::cout << "best model saved to " << best << '\n';
+	}
+	return 0;
+}
+
+int main(int argc, char* argv[])
+{
+	using namespace net;
+	using std::string;
+
+	if (argc > 2 && string(argv[1]) == "--bench")
+	{
+		return util::bench::Run(argv[2], std::cout);
+	}
+
+	// --launch <workers> [shm|tcp] [epochs]
+	if (argc > 2 && string(argv[1]) == "--launch")
+	{
+		return dist::Launch(argv[0], std::stoul(argv[2]), argc > 3 ? argv[3] : "shm", argc > 4 ? std::stoul(argv[4]) : 2000, std::cout);
+	}
+
+	// --tune <n,n,...> [cache] [--force]
+	if (argc > 2 && string(argv[1]) == "--tune")
+	{
+		std::vector<size_t> layer_c;
+		std::stringstream sizes{ argv[2] };
+		for (string size; std::getline(sizes, size, ',');)
+		{
+			layer_c.push_back(std::stoul(size));
+		}
+		bool force = string(argv[argc - 1]) == "--force";
+		string cache = argc > 3 && string(argv[3]) != "--force" ? argv[3] : "autotune.cache";
+		util::tune::Autotune(layer_c, cache, force, &std::cout);
+		return 0;
+	}
+
+	// --prune <in> <out> <sparsity> [block] [fine-tune epochs]
+	if (argc > 4 && string(argv[1]) == "--prune")
+	{
+		return RunPrune(argv[2], argv[3], std::stod(argv[4]), argc > 5 ? std::stoul(argv[5]) : 1, argc > 6 ? std::stoul(argv[6]) : 0);
+	}
+
+	// --finetune <in> <out> <first trainable layer> [epochs]
+	if (argc > 4 && string(argv[1]) == "--finetune")
+	{
+		return RunFinetune(argv[2], argv[3], std::stoul(argv[4]), argc > 5 ? std::stoul(argv[5]) : 500);
+	}
+
+	// --sweep <results.csv> <best model> [max epochs] [threads]
+	if (argc > 3 && string(argv[1]) == "--sweep")
+	{
+		return RunSweep(argv[2], argv[3], argc > 4 ? std::stoul(argv[4]) : 27, argc > 5 ? std::stoul(argv[5]) : util::HardwareThreads());
+	}
+
+	// --trace <file> [sample rate]: trains interactively and writes a Chrome trace of the run on exit
+	string tracePath;
+	if (argc > 2 && string(argv[1]) == "--trace")
+	{
+		tracePath = argv[2];
+		util::trace::SetThreadName("main");
+		util::trace::Enable(argc > 3 ? std::stod(argv[3]) : 1.0);
+	}
+
+	dist::WorkerArgs workerArgs;
+	if (dist::ParseWorkerArgs(argc, argv, workerArgs))
+	{
+		return RunWorker(workerArgs);
+	}
+
+	// {0, 1} unsafe
+	// {1, 0} safe
+	util::DataPoint<double> unsafe{ {{4.28, 2.87},1,2},{{0.0,1.0},1,2} };
+	util::DataPoint<double> safe{ {{2.45, 5.5},1,2},{{1.0,0.0},1,2} };
+
+	std::vector<util::DataPoint<double>> data = MakeData();
 
 	cost::MSE<double> mse;
 
 	Network network{ {2,3,2}, &mse, std::move(std::make_unique<actf::Sigmoid>()), std::move(std::make_unique<actf::Sigmoid>()) };
 
+	// picks the fastest GEMM blocking for these layer sizes, cached per host so only the first run pays for it
+	util::tune::Autotune(network.GetLayerSizes(), "autotune.cache", false, &std::cout);
+
 	util::Trainer trainer{ data, 100, 0.8f };
 
+	// checkpoints are written and validated in the background every few hundred epochs
+	std::vector<util::DataPoint<double>> validation;
+	for (const auto& batch : trainer.GetTestBatches())
+	{
+		validation.insert(validation.end(), batch.begin(), batch.end());
+	}
+	Checkpointer checkpointer{ { "checkpoints", "state", 3 }, &mse, validation };
+
 	for (size_t index = 0, i = 0;;index++,i++)
 	{
 		trainer.Train(network, 0.05, index);
@@ -50,8 +309,22 @@ int main()
 		std::cout << "epoch: " << i << '\n';
 		std::cout << "0 | predicted: safe: " << (safe.output[0] * 100.0) << "% unsafe: " << (safe.output[1] * 100.0) << "% expected: safe: " << (safe.expected[0] * 100.0) << "% unsafe: " << (safe.expected[1] * 100.0) << '%' << '\n';
 		std::cout << "1 | predicted: safe: " << (unsafe.output[0] * 100.0) << "% unsafe: " << (unsafe.output[1] * 100.0) << "% expected: safe: " << (unsafe.expected[0] * 100.0) << "% unsafe: " << (unsafe.expected[1] * 100.0) << '%' << '\n';
+		if (checkpointer.HasResult())
+		{
+			CheckpointResult last = checkpointer.GetLastResult();
+			std::cout << "validation (epoch " << last.step << "): cost: " << last.cost << " accuracy: " << (last.accuracy * 100.0) << "%\n";
+			if (!last.error.empty())
+			{
+				std::cout << "checkpoint failed: " << last.error << '\n';
+			}
+		}
 		std::cout << "---------------------------------------------------\n";
 
+		if (i % 500 == 0)
+		{
+			checkpointer.Submit(network, i);
+		}
+
 		if (index == trainer.GetTrainBatches().size() - 1)
 		{
 			index = -1;
@@ -61,6 +334,12 @@ int main()
 			break;
 	}
 
+	checkpointer.Flush();
+
+	MemoryStats memStats = network.GetMemoryStats();
+	std::cout << "arena peak: " << memStats.arena.peakBytes << " bytes, hit rate: " << (memStats.arena.HitRate() * 100.0) << "%\n";
+	std::cout << "pool hit rate: " << (memStats.pool.HitRate() * 100.0) << "%\n";
+
 	string name;
 	std::cout << "file name: ";
 	std::cin >> name;
@@ -69,5 +348,13 @@ int main()
 
 	std::cout << "\n saved to " << name << ".txt\n";
 
+	if (!tracePath.empty())
+	{
+		util::trace::Disable();
+		util::trace::Write(tracePath);
+		util::trace::Stats stats = util::trace::GetStats();
+		std::cout << "trace: " << stats.events << " events (" << stats.dropped << " dropped) from " << stats.threads << " threads written to " << tracePath << '\n';
+	}
+
 	return 0;
 }
\ No newline at end of file
@@ -3,21 +3,41 @@
 #include <vector>
 #include <iterator>
 #include <cassert>
+#include <algorithm>
+#include <cstring>
+#include <type_traits>
+#include <initializer_list>
+#include "Memory.h"
+#include "Gemm.h"
+
+#ifndef MATRIX_INLINE_SIZE
+#define MATRIX_INLINE_SIZE 8 // matrices with at most this many elements are stored inline without allocating
+#endif
 
 namespace math
 {
 	template<typename T>
 	class Matrix
 	{
+		static_assert(std::is_trivially_copyable<T>::value, "Matrix elements are copied with memcpy");
 	public:
 		Matrix(std::vector<T> values, size_t rows, size_t columns, T init = 0);
+		Matrix(std::initializer_list<T> values, size_t rows, size_t columns, T init = 0); // avoids the temporary vector for literals
 		Matrix(size_t rows, size_t columns, T init = 0);
 		Matrix();
+
+		// storage comes from mem::CurrentResource() at construction and stays with the matrix,
+		// assignment copies into the existing storage instead of adopting the other resource
+		Matrix(const Matrix& other);
+		Matrix(Matrix&& other) noexcept;
+		Matrix& operator=(const Matrix& other);
+		Matrix& operator=(Matrix&& other) noexcept;
+		~Matrix();
 	public:
-		typename std::vector<T>::iterator begin(); // typename is there because the type of the iterator is unknown.
-		typename std::vector<T>::iterator end();
-		const typename std::vector<T>::const_iterator begin() const;
-		const typename std::vector<T>::const_iterator end() const;
+		T* begin();
+		T* end();
+		const T* begin() const;
+		const T* end() const;
 	public:
 		T& operator()(size_t row, size_t column);
 		const T& operator()(size_t row, size_t column) const;
@@ -41,57 +61,210 @@ namespace math
 		Matrix GetTransposed() const;
 		
 		bool SizeEqu(const Matrix& other) const;
+		void Resize(size_t rows, size_t columns); // keeps the storage if it is large enough, values are unspecified afterwards
+
+		// makes the matrix a rows x columns window onto memory it does not own, e.g. a slice of a parameter slab
+		// assignment then copies into that memory and the matrix can no longer grow, copies of it own their storage again
+		void Bind(T* data, size_t rows, size_t columns);
 	public:
 		 size_t GetRows() const;
 		 size_t GetColumns() const;
 		 size_t GetSize() const;
+
+		 T* GetData();
+		 const T* GetData() const;
+		 bool IsInline() const;
+		 bool IsExternal() const;
+		 std::pmr::memory_resource* GetResource() const;
+	private:
+		void Allocate(size_t size);
+		void Free();
+		void Reserve(size_t size);
 	private:
-		std::vector<T> values;
+		T* values; // points at buffer for small matrices, or at external memory when source is null and it is not the buffer
 		size_t rows;
 		size_t columns;
+		size_t capacity;
+		std::pmr::memory_resource* resource;
+		std::pmr::memory_resource* source; // where the current heap block came from
+		T buffer[MATRIX_INLINE_SIZE];
 	};
 	
 	template<typename T>
 	inline math::Matrix<T>::Matrix(std::vector<T> values, size_t rows, size_t columns, T init)
-		: values(values), rows(rows), columns(columns)
+		: rows(rows), columns(columns), resource(mem::CurrentResource())
+	{
+		Allocate(rows * columns);
+		size_t n = std::min(values.size(), rows * columns);
+		std::copy(values.begin(), values.begin() + n, this->values);
+		std::fill(this->values + n, this->values + rows * columns, init);
+	}
+
+	template<typename T>
+	inline math::Matrix<T>::Matrix(std::initializer_list<T> values, size_t rows, size_t columns, T init)
+		: rows(rows), columns(columns), resource(mem::CurrentResource())
 	{
-		values.resize(rows * columns, init);
+		Allocate(rows * columns);
+		size_t n = std::min(values.size(), rows * columns);
+		std::copy(values.begin(), values.begin() + n, this->values);
+		std::fill(this->values + n, this->values + rows * columns, init);
 	}
 
 	template<typename T>
 	inline math::Matrix<T>::Matrix(size_t rows, size_t columns, T init)
-		: rows(rows), columns(columns)
+		: rows(rows), columns(columns), resource(mem::CurrentResource())
 	{
-		values.resize(rows * columns, init);
+		Allocate(rows * columns);
+		std::fill(values, values + rows * columns, init);
 	}
 
 	template<typename T>
 	inline math::Matrix<T>::Matrix()
-		: rows(0), columns(0)
+		: values(buffer), rows(0), columns(0), capacity(MATRIX_INLINE_SIZE), resource(mem::CurrentResource()), source(nullptr)
 	{}
 
 	template<typename T>
-	inline typename std::vector<T>::iterator math::Matrix<T>::begin()
+	inline math::Matrix<T>::Matrix(const Matrix& other)
+		: rows(other.rows), columns(other.columns), resource(mem::CurrentResource())
+	{
+		Allocate(rows * columns);
+		std::memcpy(values, other.values, GetSize() * sizeof(T));
+	}
+
+	template<typename T>
+	inline math::Matrix<T>::Matrix(Matrix&& other) noexcept
+		: rows(other.rows), columns(other.columns), resource(other.resource)
+	{
+		if (other.IsInline())
+		{
+			values = buffer;
+			capacity = MATRIX_INLINE_SIZE;
+			source = nullptr;
+			std::memcpy(buffer, other.buffer, GetSize() * sizeof(T));
+		}
+		else
+		{
+			values = other.values;
+			capacity = other.capacity;
+			source = other.source;
+			other.values = other.buffer;
+			other.capacity = MATRIX_INLINE_SIZE;
+			other.source = nullptr;
+		}
+		other.rows = 0;
+		other.columns = 0;
+	}
+
+	template<typename T>
+	inline math::Matrix<T>& math::Matrix<T>::operator=(const Matrix& other)
+	{
+		if (this != &other)
+		{
+			Reserve(other.GetSize());
+			std::memcpy(values, other.values, other.GetSize() * sizeof(T));
+			rows = other.rows;
+			columns = other.columns;
+		}
+		return *this;
+	}
+
+	template<typename T>
+	inline math::Matrix<T>& math::Matrix<T>::operator=(Matrix&& other) noexcept
 	{
-		return values.begin();
+		if (this == &other)
+		{
+			return *this;
+		}
+		// only steal the block if it belongs to the same resource, otherwise a temporary from an arena could end up in a long-lived matrix
+		// bound matrices never swap their memory, they must keep writing where they were bound
+		if (other.IsInline() || other.resource != resource || IsExternal() || other.IsExternal())
+		{
+			return *this = other;
+		}
+		Free();
+		values = other.values;
+		capacity = other.capacity;
+		source = other.source;
+		rows = other.rows;
+		columns = other.columns;
+		other.values = other.buffer;
+		other.capacity = MATRIX_INLINE_SIZE;
+		other.source = nullptr;
+		other.rows = 0;
+		other.columns = 0;
+		return *this;
 	}
 
 	template<typename T>
-	inline typename std::vector<T>::iterator math::Matrix<T>::end()
+	inline math::Matrix<T>::~Matrix()
 	{
-		return values.end();
+		Free();
 	}
 
 	template<typename T>
-	inline const typename std::vector<T>::const_iterator math::Matrix<T>::begin() const
+	inline void math::Matrix<T>::Allocate(size_t size)
 	{
-		return values.begin();
+		if (size <= MATRIX_INLINE_SIZE)
+		{
+			values = buffer;
+			capacity = MATRIX_INLINE_SIZE;
+			source = nullptr;
+			return;
+		}
+		size_t bytes = size * sizeof(T);
+		source = mem::HugePagesEnabled() && bytes >= mem::hugePageThreshold ? &mem::HugePages() : resource;
+		values = (T*)source->allocate(bytes, mem::matrixAlign);
+		capacity = size;
 	}
 
 	template<typename T>
-	inline const typename std::vector<T>::const_iterator math::Matrix<T>::end() const
+	inline void math::Matrix<T>::Free()
 	{
-		return values.end();
+		if (!IsInline())
+		{
+			if (source)
+			{
+				source->deallocate(values, capacity * sizeof(T), mem::matrixAlign);
+			}
+			values = buffer;
+			capacity = MATRIX_INLINE_SIZE;
+			source = nullptr;
+		}
+	}
+
+	template<typename T>
+	inline void math::Matrix<T>::Reserve(size_t size)
+	{
+		if (size > capacity)
+		{
+			assert(!IsExternal() && "bound matrices cannot grow");
+			Free();
+			Allocate(size);
+		}
+	}
+
+	template<typename T>
+	inline T* math::Matrix<T>::begin()
+	{
+		return values;
+	}
+
+	template<typename T>
+	inline T* math::Matrix<T>::end()
+	{
+		return values + GetSize();
+	}
+
+	template<typename T>
+	inline const T* math::Matrix<T>::begin() const
+	{
+		return values;
+	}
+
+	template<typename T>
+	inline const T* math::Matrix<T>::end() const
+	{
+		return values + GetSize();
 	}
 
 	template<typename T>
@@ -123,16 +296,7 @@ namespace math
 	{
 		assert(columns == rhs.rows);
 		Matrix res{ rows, rhs.columns };
-		for (size_t i = 0; i < rows; i++)
-		{
-			for (size_t j = 0; j < rhs.columns; j++)
-			{
-				for (size_t k = 0; k < rhs.rows; k++)
-				{
-					res(i, j) += (*this)(i, k) * rhs(k, j);
-				}
-			}
-		}
+		Gemm<T>(res, *this, rhs);
 		return res;
 	}
 
@@ -198,7 +362,7 @@ namespace math
 	template<typename T>
 	inline bool math::Matrix<T>::operator==(const Matrix& rhs) const
 	{
-		return values == rhs.values && SizeEqu(rhs);
+		return SizeEqu(rhs) && std::equal(begin(), end(), rhs.begin());
 	}
 
 	template<typename T>
@@ -239,6 +403,24 @@ namespace math
 		return rows == other.rows && columns == other.columns;
 	}
 
+	template<typename T>
+	inline void math::Matrix<T>::Resize(size_t rows, size_t columns)
+	{
+		Reserve(rows * columns);
+		this->rows = rows;
+		this->columns = columns;
+	}
+
+	template<typename T>
+	inline void math::Matrix<T>::Bind(T* data, size_t rows, size_t columns)
+	{
+		Free();
+		values = data;
+		capacity = rows * columns;
+		this->rows = rows;
+		this->columns = columns;
+	}
+
 	template<typename T>
 	inline size_t math::Matrix<T>::GetRows() const
 	{
@@ -257,5 +439,35 @@ namespace math
 		return rows * columns;
 	}
 
+	template<typename T>
+	inline T* math::Matrix<T>::GetData()
+	{
+		return values;
+	}
+
+	template<typename T>
+	inline const T* math::Matrix<T>::GetData() const
+	{
+		return values;
+	}
+
+	template<typename T>
+	inline bool math::Matrix<T>::IsInline() const
+	{
+		return values == buffer;
+	}
+
+	template<typename T>
+	inline bool math::Matrix<T>::IsExternal() const
+	{
+		return !IsInline() && source == nullptr;
+	}
+
+	template<typename T>
+	inline std::pmr::memory_resource* math::Matrix<T>::GetResource() const
+	{
+		return resource;
+	}
+
 	typedef Matrix<double> DMatrix;
 }
\ No newline at end of file
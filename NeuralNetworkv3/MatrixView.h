@@ -0,0 +1,153 @@
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <type_traits>
+
+namespace math
+{
+	template<typename T>
+	class Matrix;
+
+	// non-owning strided window onto matrix storage, element (r, c) lives at data[r * rowStride + c * columnStride]
+	// T may be const for read-only views, a view never outlives the storage it was made from
+	template<typename T>
+	class MatrixView
+	{
+	public:
+		typedef std::remove_const_t<T> value_type;
+
+		MatrixView(T* data, size_t rows, size_t columns, size_t rowStride, size_t columnStride = 1);
+		MatrixView(Matrix<value_type>& matrix);
+		template<typename U = T, typename = std::enable_if_t<std::is_const<U>::value>>
+		MatrixView(const Matrix<value_type>& matrix);
+		template<typename U = T, typename = std::enable_if_t<std::is_const<U>::value>>
+		MatrixView(const MatrixView<value_type>& other);
+		MatrixView();
+	public:
+		T& operator()(size_t row, size_t column) const;
+
+		MatrixView Transposed() const; // swaps the strides, no data is moved
+		MatrixView Block(size_t row, size_t column, size_t rows, size_t columns) const;
+		MatrixView Row(size_t row) const;
+	public:
+		size_t GetRows() const;
+		size_t GetColumns() const;
+		size_t GetSize() const;
+		size_t GetRowStride() const;
+		size_t GetColumnStride() const;
+		T* GetData() const;
+
+		bool IsRowMajor() const; // rows are contiguous
+		bool IsTransposed() const; // columns are contiguous, i.e. a transposed row-major matrix
+	private:
+		T* data;
+		size_t rows;
+		size_t columns;
+		size_t rowStride;
+		size_t columnStride;
+	};
+
+	template<typename T>
+	inline math::MatrixView<T>::MatrixView(T* data, size_t rows, size_t columns, size_t rowStride, size_t columnStride)
+		: data(data), rows(rows), columns(columns), rowStride(rowStride), columnStride(columnStride)
+	{}
+
+	template<typename T>
+	inline math::MatrixView<T>::MatrixView(Matrix<value_type>& matrix)
+		: data(matrix.GetData()), rows(matrix.GetRows()), columns(matrix.GetColumns()), rowStride(matrix.GetColumns()), columnStride(1)
+	{}
+
+	template<typename T>
+	template<typename U, typename>
+	inline math::MatrixView<T>::MatrixView(const Matrix<value_type>& matrix)
+		: data(matrix.GetData()), rows(matrix.GetRows()), columns(matrix.GetColumns()), rowStride(matrix.GetColumns()), columnStride(1)
+	{}
+
+	template<typename T>
+	template<typename U, typename>
+	inline math::MatrixView<T>::MatrixView(const MatrixView<value_type>& other)
+		: data(other.GetData()), rows(other.GetRows()), columns(other.GetColumns()), rowStride(other.GetRowStride()), columnStride(other.GetColumnStride())
+	{}
+
+	template<typename T>
+	inline math::MatrixView<T>::MatrixView()
+		: data(nullptr), rows(0), columns(0), rowStride(0), columnStride(1)
+	{}
+
+	template<typename T>
+	inline T& math::MatrixView<T>::operator()(size_t row, size_t column) const
+	{
+		return data[row * rowStride + column * columnStride];
+	}
+
+	template<typename T>
+	inline math::MatrixView<T> math::MatrixView<T>::Transposed() const
+	{
+		return MatrixView{ data, columns, rows, columnStride, rowStride };
+	}
+
+	template<typename T>
+	inline math::MatrixView<T> math::MatrixView<T>::Block(size_t row, size_t column, size_t rows, size_t columns) const
+	{
+		assert(row + rows <= this->rows && column + columns <= this->columns);
+		return MatrixView{ data + row * rowStride + column * columnStride, rows, columns, rowStride, columnStride };
+	}
+
+	template<typename T>
+	inline math::MatrixView<T> math::MatrixView<T>::Row(size_t row) const
+	{
+		return Block(row, 0, 1, columns);
+	}
+
+	template<typename T>
+	inline size_t math::MatrixView<T>::GetRows() const
+	{
+		return rows;
+	}
+
+	template<typename T>
+	inline size_t math::MatrixView<T>::GetColumns() const
+	{
+		return columns;
+	}
+
+	template<typename T>
+	inline size_t math::MatrixView<T>::GetSize() const
+	{
+		return rows * columns;
+	}
+
+	template<typename T>
+	inline size_t math::MatrixView<T>::GetRowStride() const
+	{
+		return rowStride;
+	}
+
+	template<typename T>
+	inline size_t math::MatrixView<T>::GetColumnStride() const
+	{
+		return columnStride;
+	}
+
+	template<typename T>
+	inline T* math::MatrixView<T>::GetData() const
+	{
+		return data;
+	}
+
+	template<typename T>
+	inline bool math::MatrixView<T>::IsRowMajor() const
+	{
+		return columnStride == 1 || columns == 1;
+	}
+
+	template<typename T>
+	inline bool math::MatrixView<T>::IsTransposed() const
+	{
+		return !IsRowMajor() && (rowStride == 1 || rows == 1);
+	}
+
+	typedef MatrixView<double> DMatrixView;
+	typedef MatrixView<const double> ConstDMatrixView;
+}
@@ -0,0 +1,484 @@
+#include "Memory.h"
+#include <algorithm>
+#include <atomic>
+#include <new>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <Windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+namespace
+{
+	thread_local std::pmr::memory_resource* _current = nullptr;
+	std::atomic<bool> _hugePages{ false };
+
+	size_t AlignUp(size_t value, size_t alignment)
+	{
+		return (value + alignment - 1) & ~(alignment - 1);
+	}
+}
+
+double math::mem::Stats::HitRate() const
+{
+	return allocations == 0 ? 0.0 : (double)hits / allocations;
+}
+
+math::mem::Arena::Arena(size_t chunkSize, std::pmr::memory_resource* upstream)
+	: chunkSize(chunkSize), upstream(upstream)
+{}
+
+math::mem::Arena::~Arena()
+{
+	Release();
+}
+
+void math::mem::Arena::Reset()
+{
+	// a batch that spilled over several chunks gets one chunk big enough for the whole batch next time
+	if (chunks.size() > 1)
+	{
+		size_t total = stats.capacity;
+		Release();
+		AddChunk(total);
+	}
+	current = 0;
+	offset = 0;
+	used = 0;
+	stats.bytesInUse = 0;
+}
+
+void math::mem::Arena::Release()
+{
+	for (const Chunk& chunk : chunks)
+	{
+		upstream->deallocate(chunk.data, chunk.size, alignof(std::max_align_t));
+	}
+	chunks.clear();
+	current = 0;
+	offset = 0;
+	used = 0;
+	stats.bytesInUse = 0;
+	stats.capacity = 0;
+}
+
+void math::mem::Arena::SetUpstream(std::pmr::memory_resource* value)
+{
+	Release();
+	upstream = value;
+}
+
+math::mem::Stats math::mem::Arena::GetStats() const
+{
+	return stats;
+}
+
+void math::mem::Arena::ClearStats()
+{
+	stats.allocations = 0;
+	stats.hits = 0;
+	stats.misses = 0;
+	stats.peakBytes = stats.bytesInUse;
+}
+
+void* math::mem::Arena::do_allocate(size_t bytes, size_t alignment)
+{
+	stats.allocations++;
+
+	size_t start = chunks.empty() ? 0 : AlignUp((size_t)(chunks[current].data + offset), alignment) - (size_t)chunks[current].data;
+	if (chunks.empty() || start + bytes > chunks[current].size)
+	{
+		stats.misses++;
+
+		// move on to an already allocated chunk if a previous batch left one that is large enough
+		while (current + 1 < chunks.size() && chunks[current + 1].size < bytes + alignment)
+		{
+			current++;
+		}
+		if (current + 1 < chunks.size())
+		{
+			current++;
+		}
+		else
+		{
+			AddChunk(bytes + alignment);
+			current = chunks.size() - 1;
+		}
+		offset = 0;
+		start = AlignUp((size_t)chunks[current].data, alignment) - (size_t)chunks[current].data;
+	}
+	else
+	{
+		stats.hits++;
+	}
+
+	void* p = chunks[current].data + start;
+	used += start + bytes - offset;
+	offset = start + bytes;
+
+	stats.bytesInUse = used;
+	stats.peakBytes = std::max(stats.peakBytes, used);
+	return p;
+}
+
+void math::mem::Arena::do_deallocate(void*, size_t, size_t)
+{}
+
+bool math::mem::Arena::do_is_equal(const std::pmr::memory_resource& other) const noexcept
+{
+	return this == &other;
+}
+
+void math::mem::Arena::AddChunk(size_t minBytes)
+{
+	size_t size = std::max(chunkSize, minBytes);
+	chunks.push_back({ (char*)upstream->allocate(size, alignof(std::max_align_t)), size });
+	stats.capacity += size;
+}
+
+struct math::mem::Pool::Shared
+{
+	std::array<std::vector<void*>, n_classes> freeLists;
+	std::mutex mtx;
+	std::pmr::memory_resource* upstream;
+
+	// relaxed, they are only ever read as a whole by GetStats
+	std::atomic<size_t> allocations{ 0 };
+	std::atomic<size_t> hits{ 0 };
+	std::atomic<size_t> misses{ 0 };
+	std::atomic<size_t> bytesInUse{ 0 };
+	std::atomic<size_t> peakBytes{ 0 };
+	std::atomic<size_t> capacity{ 0 };
+
+	Shared(std::pmr::memory_resource* upstream)
+		: upstream(upstream)
+	{}
+
+	~Shared()
+	{
+		ReleaseLists();
+	}
+
+	void ReleaseLists() // mtx must be held, or nobody else can reach this any more
+	{
+		for (size_t c = 0; c < n_classes; c++)
+		{
+			size_t size = (size_t)1 << (c + minClassShift);
+			for (void* p : freeLists[c])
+			{
+				upstream->deallocate(p, size, blockAlign);
+			}
+			capacity.fetch_sub(size * freeLists[c].size(), std::memory_order_relaxed);
+			freeLists[c].clear();
+		}
+	}
+
+	void AddInUse(size_t bytes)
+	{
+		size_t now = bytesInUse.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+		size_t peak = peakBytes.load(std::memory_order_relaxed);
+		while (now > peak && !peakBytes.compare_exchange_weak(peak, now, std::memory_order_relaxed))
+		{
+		}
+	}
+};
+
+namespace
+{
+	// one thread's free lists for every pool it has used, handed back to the pools when the thread exits
+	struct ThreadCache
+	{
+		struct Entry
+		{
+			std::shared_ptr<math::mem::Pool::Shared> shared;
+			std::array<std::vector<void*>, math::mem::Pool::n_classes> lists;
+		};
+
+		std::vector<Entry> entries;
+
+		~ThreadCache();
+
+		Entry& Find(const std::shared_ptr<math::mem::Pool::Shared>& shared)
+		{
+			for (Entry& entry : entries)
+			{
+				if (entry.shared == shared)
+				{
+					return entry;
+				}
+			}
+			entries.push_back({ shared, {} });
+			return entries.back();
+		}
+	};
+
+	// trivially destructible, so it can still be read by matrices freed during thread or program exit
+	thread_local bool _cacheGone = false;
+
+	ThreadCache& LocalCache()
+	{
+		thread_local ThreadCache cache;
+		return cache;
+	}
+
+	void Flush(ThreadCache::Entry& entry)
+	{
+		std::lock_guard<std::mutex> lock{ entry.shared->mtx };
+		for (size_t c = 0; c < math::mem::Pool::n_classes; c++)
+		{
+			auto& shared = entry.shared->freeLists[c];
+			shared.insert(shared.end(), entry.lists[c].begin(), entry.lists[c].end());
+			entry.lists[c].clear();
+		}
+	}
+
+	ThreadCache::~ThreadCache()
+	{
+		_cacheGone = true;
+		for (Entry& entry : entries)
+		{
+			Flush(entry);
+		}
+	}
+
+	// blocks a thread keeps of one class before it hands half of them to the shared list
+	size_t CacheLimit(size_t size)
+	{
+		return std::max<size_t>(4, ((size_t)1 << 18) / size);
+	}
+}
+
+math::mem::Pool::Pool(std::pmr::memory_resource* upstream)
+	: shared(std::make_shared<Shared>(upstream))
+{}
+
+math::mem::Pool::~Pool()
+{
+	Release();
+}
+
+void math::mem::Pool::Release()
+{
+	if (!_cacheGone)
+	{
+		for (ThreadCache::Entry& entry : LocalCache().entries)
+		{
+			if (entry.shared == shared)
+			{
+				Flush(entry);
+			}
+		}
+	}
+	std::lock_guard<std::mutex> lock{ shared->mtx };
+	shared->ReleaseLists();
+}
+
+math::mem::Stats math::mem::Pool::GetStats() const
+{
+	Stats stats;
+	stats.allocations = shared->allocations.load(std::memory_order_relaxed);
+	stats.hits = shared->hits.load(std::memory_order_relaxed);
+	stats.misses = shared->misses.load(std::memory_order_relaxed);
+	stats.bytesInUse = shared->bytesInUse.load(std::memory_order_relaxed);
+	stats.peakBytes = shared->peakBytes.load(std::memory_order_relaxed);
+	stats.capacity = shared->capacity.load(std::memory_order_relaxed);
+	return stats;
+}
+
+void math::mem::Pool::ClearStats()
+{
+	shared->allocations.store(0, std::memory_order_relaxed);
+	shared->hits.store(0, std::memory_order_relaxed);
+	shared->misses.store(0, std::memory_order_relaxed);
+	shared->peakBytes.store(shared->bytesInUse.load(std::memory_order_relaxed), std::memory_order_relaxed);
+}
+
+size_t math::mem::Pool::ClassOf(size_t bytes)
+{
+	size_t c = 0;
+	while (((size_t)1 << (c + minClassShift)) < bytes)
+	{
+		c++;
+	}
+	return c;
+}
+
+void* math::mem::Pool::do_allocate(size_t bytes, size_t alignment)
+{
+	shared->allocations.fetch_add(1, std::memory_order_relaxed);
+	size_t c = ClassOf(bytes);
+	if (c >= n_classes || alignment > blockAlign)
+	{
+		shared->misses.fetch_add(1, std::memory_order_relaxed);
+		shared->AddInUse(bytes);
+		return shared->upstream->allocate(bytes, alignment);
+	}
+
+	size_t size = (size_t)1 << (c + minClassShift);
+	shared->AddInUse(size);
+	if (!_cacheGone)
+	{
+		std::vector<void*>& list = LocalCache().Find(shared).lists[c];
+		if (list.empty())
+		{
+			// refill half of the thread's share at once so the lock is taken once per batch, not per block
+			std::lock_guard<std::mutex> lock{ shared->mtx };
+			std::vector<void*>& from = shared->freeLists[c];
+			size_t n = std::min(from.size(), CacheLimit(size) / 2);
+			list.insert(list.end(), from.end() - n, from.end());
+			from.resize(from.size() - n);
+		}
+		if (!list.empty())
+		{
+			shared->hits.fetch_add(1, std::memory_order_relaxed);
+			void* p = list.back();
+			list.pop_back();
+			return p;
+		}
+	}
+	else
+	{
+		std::lock_guard<std::mutex> lock{ shared->mtx };
+		std::vector<void*>& from = shared->freeLists[c];
+		if (!from.empty())
+		{
+			shared->hits.fetch_add(1, std::memory_order_relaxed);
+			void* p = from.back();
+			from.pop_back();
+			return p;
+		}
+	}
+	shared->misses.fetch_add(1, std::memory_order_relaxed);
+	shared->capacity.fetch_add(size, std::memory_order_relaxed);
+	return shared->upstream->allocate(size, blockAlign);
+}
+
+void math::mem::Pool::do_deallocate(void* p, size_t bytes, size_t alignment)
+{
+	size_t c = ClassOf(bytes);
+	if (c >= n_classes || alignment > blockAlign)
+	{
+		shared->bytesInUse.fetch_sub(bytes, std::memory_order_relaxed);
+		shared->upstream->deallocate(p, bytes, alignment);
+		return;
+	}
+
+	size_t size = (size_t)1 << (c + minClassShift);
+	shared->bytesInUse.fetch_sub(size, std::memory_order_relaxed);
+	if (_cacheGone)
+	{
+		std::lock_guard<std::mutex> lock{ shared->mtx };
+		shared->freeLists[c].push_back(p);
+		return;
+	}
+
+	// blocks freed by another thread than the one that allocated them simply join this thread's list
+	std::vector<void*>& list = LocalCache().Find(shared).lists[c];
+	list.push_back(p);
+	if (list.size() > CacheLimit(size))
+	{
+		size_t n = list.size() / 2;
+		std::lock_guard<std::mutex> lock{ shared->mtx };
+		std::vector<void*>& to = shared->freeLists[c];
+		to.insert(to.end(), list.end() - n, list.end());
+		list.resize(list.size() - n);
+	}
+}
+
+bool math::mem::Pool::do_is_equal(const std::pmr::memory_resource& other) const noexcept
+{
+	return this == &other;
+}
+
+void* math::mem::HugePageResource::do_allocate(size_t bytes, [[maybe_unused]] size_t alignment)
+{
+	size_t size = AlignUp(bytes, hugePageThreshold);
+#ifdef _WIN32
+	void* p = nullptr;
+	size_t large = GetLargePageMinimum();
+	if (large != 0)
+	{
+		// needs SeLockMemoryPrivilege, without it the call fails and we use normal pages
+		p = VirtualAlloc(nullptr, AlignUp(bytes, large), MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+	}
+	if (!p)
+	{
+		p = VirtualAlloc(nullptr, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+	}
+	if (!p)
+	{
+		throw std::bad_alloc();
+	}
+	return p;
+#else
+	void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED)
+	{
+		throw std::bad_alloc();
+	}
+#ifdef MADV_HUGEPAGE
+	madvise(p, size, MADV_HUGEPAGE);
+#endif
+	return p;
+#endif
+}
+
+void math::mem::HugePageResource::do_deallocate(void* p, [[maybe_unused]] size_t bytes, [[maybe_unused]] size_t alignment)
+{
+#ifdef _WIN32
+	VirtualFree(p, 0, MEM_RELEASE);
+#else
+	munmap(p, AlignUp(bytes, hugePageThreshold));
+#endif
+}
+
+bool math::mem::HugePageResource::do_is_equal(const std::pmr::memory_resource& other) const noexcept
+{
+	return this == &other;
+}
+
+math::mem::Pool& math::mem::GlobalPool()
+{
+	// never destroyed so matrices with static storage duration can still free into it at exit
+	static Pool* pool = new Pool();
+	return *pool;
+}
+
+math::mem::HugePageResource& math::mem::HugePages()
+{
+	static HugePageResource* hugePages = new HugePageResource();
+	return *hugePages;
+}
+
+void math::mem::EnableHugePages(bool enable)
+{
+	_hugePages = enable;
+}
+
+bool math::mem::HugePagesEnabled()
+{
+	return _hugePages.load(std::memory_order_relaxed);
+}
+
+std::pmr::memory_resource* math::mem::CurrentResource()
+{
+	return _current ? _current : &GlobalPool();
+}
+
+void math::mem::SetCurrentResource(std::pmr::memory_resource* resource)
+{
+	_current = resource;
+}
+
+math::mem::ScopedResource::ScopedResource(std::pmr::memory_resource* resource)
+	: previous(_current)
+{
+	_current = resource;
+}
+
+math::mem::ScopedResource::~ScopedResource()
+{
+	_current = previous;
+}
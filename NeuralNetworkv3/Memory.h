@@ -0,0 +1,138 @@
+#pragma once
+
+#include <memory_resource>
+#include <mutex>
+#include <vector>
+#include <array>
+#include <atomic>
+#include <memory>
+
+namespace math
+{
+	namespace mem
+	{
+		struct Stats
+		{
+			size_t allocations = 0;
+			size_t hits = 0; // served without going to the upstream resource
+			size_t misses = 0;
+			size_t bytesInUse = 0;
+			size_t peakBytes = 0;
+			size_t capacity = 0; // bytes currently held from the upstream resource
+
+			double HitRate() const;
+		};
+
+		// bump-pointer allocator, deallocate is a no-op and everything is released at once by Reset
+		// matrices created while an arena is the current resource must not outlive the next Reset,
+		// assigning them into an existing matrix copies the values into that matrix's own storage
+		class Arena : public std::pmr::memory_resource
+		{
+		public:
+			Arena(size_t chunkSize = 1 << 16, std::pmr::memory_resource* upstream = std::pmr::new_delete_resource());
+			~Arena();
+
+			Arena(const Arena&) = delete;
+			Arena& operator=(const Arena&) = delete;
+		public:
+			void Reset();
+			void Release();
+			void SetUpstream(std::pmr::memory_resource* value); // releases every chunk, later chunks come from value
+
+			Stats GetStats() const;
+			void ClearStats();
+		private:
+			void* do_allocate(size_t bytes, size_t alignment) override;
+			void do_deallocate(void* p, size_t bytes, size_t alignment) override;
+			bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override;
+
+			void AddChunk(size_t minBytes);
+		private:
+			struct Chunk
+			{
+				char* data;
+				size_t size;
+			};
+
+			std::vector<Chunk> chunks;
+			size_t current = 0; // chunk being bumped
+			size_t offset = 0;
+			size_t used = 0; // bytes handed out since the last reset, including padding
+
+			size_t chunkSize;
+			std::pmr::memory_resource* upstream;
+			Stats stats;
+		};
+
+		// thread-safe size-class pool, freed blocks are kept on a free list per power-of-two class
+		// so the few recurring matrix shapes of a network are recycled instead of hitting the heap
+		// every thread allocates from and frees into lists of its own without locking, only when those run
+		// empty or overflow does it trade a batch of blocks with the shared lists under the lock
+		// the upstream resource must outlive every thread that used the pool
+		class Pool : public std::pmr::memory_resource
+		{
+		public:
+			Pool(std::pmr::memory_resource* upstream = std::pmr::new_delete_resource());
+			~Pool();
+
+			Pool(const Pool&) = delete;
+			Pool& operator=(const Pool&) = delete;
+		public:
+			// returns the shared free blocks and the calling thread's to the upstream resource,
+			// other threads hand theirs back when they exit
+			void Release();
+
+			Stats GetStats() const;
+			void ClearStats();
+		private:
+			void* do_allocate(size_t bytes, size_t alignment) override;
+			void do_deallocate(void* p, size_t bytes, size_t alignment) override;
+			bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override;
+		public:
+			static constexpr size_t minClassShift = 4; // 16 bytes
+			static constexpr size_t n_classes = 17; // up to 1 MiB
+			static constexpr size_t blockAlign = 64;
+
+			struct Shared; // free lists and stats, kept alive by the pool and by every thread cache holding its blocks
+		private:
+			static size_t ClassOf(size_t bytes);
+
+			std::shared_ptr<Shared> shared;
+		};
+
+		// maps large blocks directly from the OS and asks for transparent/large pages, falls back to normal pages
+		class HugePageResource : public std::pmr::memory_resource
+		{
+		private:
+			void* do_allocate(size_t bytes, size_t alignment) override;
+			void do_deallocate(void* p, size_t bytes, size_t alignment) override;
+			bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override;
+		};
+
+		constexpr size_t matrixAlign = 64; // cache line, also enough for any SIMD load
+		constexpr size_t hugePageThreshold = (size_t)1 << 21;
+
+		Pool& GlobalPool();
+		HugePageResource& HugePages();
+
+		// when enabled, matrix blocks of at least hugePageThreshold bytes come from HugePages() instead of the current resource
+		void EnableHugePages(bool enable);
+		bool HugePagesEnabled();
+
+		// resource used by matrices constructed on the calling thread
+		std::pmr::memory_resource* CurrentResource();
+		void SetCurrentResource(std::pmr::memory_resource* resource);
+
+		class ScopedResource
+		{
+		public:
+			ScopedResource(std::pmr::memory_resource* resource);
+			~ScopedResource();
+
+			ScopedResource(const ScopedResource&) = delete;
+			ScopedResource& operator=(const ScopedResource&) = delete;
+		private:
+			std::pmr::memory_resource* previous;
+		};
+	}
+}
@@ -0,0 +1,284 @@
+#include "MixedNetwork.h"
+#include "ActivationFuncs.h"
+#include <cmath>
+#include <algorithm>
+
+namespace
+{
+	// the same initialization as Network
+	net::Snapshot Initial(const std::vector<size_t>& layer_c, net::actf::ACTIVATION_TYPE hiddenType, net::actf::ACTIVATION_TYPE outputType, double bias, uint64_t id)
+	{
+		net::Snapshot snapshot;
+		snapshot.layer_c = layer_c;
+		snapshot.hiddenType = hiddenType;
+		snapshot.outputType = outputType;
+		snapshot.weights.resize(layer_c.size());
+		snapshot.biases.resize(layer_c.size());
+		for (size_t i = 1; i < layer_c.size(); i++)
+		{
+			snapshot.weights[i] = math::DMatrix{ layer_c[i - 1], layer_c[i] };
+			snapshot.biases[i] = math::DMatrix{ 1, layer_c[i], bias };
+			util::FillUniform(snapshot.weights[i].GetData(), snapshot.weights[i].GetSize(), -1.0, 1.0,
+				util::Philox{ SEED, util::LayerStream(id, i) }, 1.0 / std::sqrt((double)layer_c[i - 1]));
+		}
+		return snapshot;
+	}
+}
+
+net::MixedNetwork::MixedNetwork(std::vector<size_t> layer_c, cost::Cost<double>* cost,
+	actf::ACTIVATION_TYPE hiddenType, actf::ACTIVATION_TYPE outputType,
+	math::HALF_FORMAT format, double bias, uint64_t id)
+	: MixedNetwork(Initial(layer_c, hiddenType, outputType, bias, id), cost, format)
+{
+}
+
+net::MixedNetwork::MixedNetwork(const Snapshot& snapshot, cost::Cost<double>* cost, math::HALF_FORMAT format)
+	: layer_c(snapshot.layer_c), n_layers(snapshot.layer_c.size()), cost(cost), hiddenType(snapshot.hiddenType), outputType(snapshot.outputType), format(format)
+{
+	assert(hiddenType != actf::ACTIVATION_TYPE::SOFTMAX);
+
+	master.resize(n_layers);
+	weights.resize(n_layers);
+	biases.resize(n_layers);
+	weight_grad.resize(n_layers);
+	bias_grad.resize(n_layers);
+	outputs.resize(n_layers);
+
+	size_t widest = layer_c[0];
+	outputs[0].resize(layer_c[0]);
+	for (size_t i = 1; i < n_layers; i++)
+	{
+		size_t in = layer_c[i - 1], out = layer_c[i];
+		master[i].assign(snapshot.weights[i].begin(), snapshot.weights[i].end());
+		weights[i].resize(in * out);
+		biases[i].assign(snapshot.biases[i].begin(), snapshot.biases[i].end());
+		weight_grad[i].assign(in * out, 0.0f);
+		bias_grad[i].assign(out, 0.0f);
+		outputs[i].resize(out);
+		widest = std::max(widest, out);
+		Quantize(i);
+	}
+	for (std::vector<float>* scratch : { &sums, &result, &activations, &nodeValues, &propagated })
+	{
+		scratch->resize(widest);
+	}
+}
+
+void net::MixedNetwork::Quantize(size_t layer_i)
+{
+	math::half::Encode(master[layer_i].data(), weights[layer_i].data(), master[layer_i].size(), format);
+}
+
+void net::MixedNetwork::Activate(float* out, const float* in, size_t n, actf::ACTIVATION_TYPE type) const
+{
+	switch (type)
+	{
+	case actf::ACTIVATION_TYPE::SIGMOID:
+		for (size_t i = 0; i < n; i++)
+		{
+			out[i] = 1.0f / (1.0f + std::exp(-in[i]));
+		}
+		break;
+	case actf::ACTIVATION_TYPE::RELU:
+		for (size_t i = 0; i < n; i++)
+		{
+			out[i] = std::max(0.0f, in[i]);
+		}
+		break;
+	case actf::ACTIVATION_TYPE::SOFTMAX:
+	{
+		// shifted by the largest input so fp32 exp cannot overflow, the result is the same
+		float largest = *std::max_element(in, in + n);
+		float expSum = 0.0f;
+		for (size_t i = 0; i < n; i++)
+		{
+			out[i] = std::exp(in[i] - largest);
+			expSum += out[i];
+		}
+		for (size_t i = 0; i < n; i++)
+		{
+			out[i] /= expSum;
+		}
+		break;
+	}
+	}
+}
+
+void net::MixedNetwork::Derivative(float* out, const float* outputs, size_t n, actf::ACTIVATION_TYPE type) const
+{
+	// all three derivatives follow from the activations, so the weighted inputs never have to be stored
+	if (type == actf::ACTIVATION_TYPE::RELU)
+	{
+		for (size_t i = 0; i < n; i++)
+		{
+			out[i] = outputs[i] > 0.0f ? 1.0f : 0.0f;
+		}
+	}
+	else
+	{
+		for (size_t i = 0; i < n; i++)
+		{
+			out[i] = outputs[i] * (1.0f - outputs[i]);
+		}
+	}
+}
+
+void net::MixedNetwork::Forward(math::ConstDMatrixView input)
+{
+	assert(input.GetSize() == layer_c[0]);
+	for (size_t k = 0; k < layer_c[0]; k++)
+	{
+		activations[k] = (float)input(0, k);
+	}
+	math::half::Encode(activations.data(), outputs[0].data(), layer_c[0], format);
+
+	for (size_t i = 1; i < n_layers; i++)
+	{
+		size_t in = layer_c[i - 1], out = layer_c[i];
+		math::half::Decode(outputs[i - 1].data(), activations.data(), in, format);
+		std::copy(biases[i].begin(), biases[i].end(), sums.begin());
+
+		// row k of the weights scaled by input k, as in the dense Gemm, widened as it is loaded and summed in fp32
+		for (size_t k = 0; k < in; k++)
+		{
+			float a = activations[k];
+			if (a != 0.0f)
+			{
+				math::half::Axpy(a, weights[i].data() + k * out, sums.data(), out, format);
+			}
+		}
+
+		// result keeps the output layer's activations in fp32 for the cost
+		Activate(result.data(), sums.data(), out, i == n_layers - 1 ? outputType : hiddenType);
+		math::half::Encode(result.data(), outputs[i].data(), out, format);
+	}
+}
+
+void net::MixedNetwork::Learn(const std::vector<util::DataPoint<double>>& batch, double learnRate)
+{
+	util::trace::Span span{ "MixedNetwork::Learn", "train", -1, true };
+
+	for (const util::DataPoint<double>& dp : batch)
+	{
+		Forward(dp.input);
+
+		size_t out = layer_c[n_layers - 1];
+		Derivative(nodeValues.data(), result.data(), out, outputType);
+		for (size_t c = 0; c < out; c++)
+		{
+			nodeValues[c] *= (float)cost->Derivative((double)result[c], dp.expected[c]);
+		}
+
+		for (size_t i = n_layers - 1; i >= 1; --i)
+		{
+			size_t in = layer_c[i - 1];
+			out = layer_c[i];
+			bool propagate = i > 1;
+			math::half::Decode(outputs[i - 1].data(), activations.data(), in, format);
+
+			// one pass over the 16-bit weights per layer, as math::FusedBackward does for doubles
+			const float* __restrict nv = nodeValues.data();
+			for (size_t k = 0; k < in; k++)
+			{
+				float a = activations[k];
+				if (a != 0.0f)
+				{
+					float* __restrict g = weight_grad[i].data() + k * out;
+					for (size_t j = 0; j < out; j++)
+					{
+						g[j] += a * nv[j];
+					}
+				}
+				if (propagate)
+				{
+					propagated[k] = math::half::Dot(weights[i].data() + k * out, nv, out, format);
+				}
+			}
+			std::copy(nodeValues.begin(), nodeValues.begin() + out, bias_grad[i].begin()); // the last sample's, as in Network
+
+			if (!propagate)
+			{
+				break;
+			}
+			Derivative(nodeValues.data(), activations.data(), in, hiddenType);
+			for (size_t k = 0; k < in; k++)
+			{
+				nodeValues[k] *= propagated[k];
+			}
+		}
+	}
+
+	// the fp32 master weights take the step, the kernels get them rounded to 16 bits
+	float rate = (float)learnRate;
+	for (size_t i = 1; i < n_layers; i++)
+	{
+		for (auto [param, grad] : { std::make_pair(&master[i], &weight_grad[i]), std::make_pair(&biases[i], &bias_grad[i]) })
+		{
+			float* __restrict y = param->data();
+			const float* __restrict g = grad->data();
+			for (size_t p = 0; p < param->size(); p++)
+			{
+				y[p] += -rate * g[p];
+			}
+			std::fill(grad->begin(), grad->end(), 0.0f);
+		}
+		Quantize(i);
+	}
+}
+
+math::DMatrix net::MixedNetwork::Feed(math::ConstDMatrixView input)
+{
+	Forward(input);
+	size_t out = layer_c[n_layers - 1];
+	math::DMatrix res{ 1, out };
+	for (size_t c = 0; c < out; c++)
+	{
+		res[c] = result[c];
+	}
+	return res;
+}
+
+void net::MixedNetwork::CalculateOutputs(std::vector<util::DataPoint<double>>& batch)
+{
+	for (util::DataPoint<double>& dp : batch)
+	{
+		dp.output = Feed(dp.input);
+	}
+}
+
+void net::MixedNetwork::TakeSnapshot(Snapshot& snapshot) const
+{
+	math::mem::ScopedResource scope{ &math::mem::GlobalPool() };
+
+	snapshot.layer_c = layer_c;
+	snapshot.hiddenType = hiddenType;
+	snapshot.outputType = outputType;
+	snapshot.weights.assign(n_layers, math::DMatrix{});
+	snapshot.biases.assign(n_layers, math::DMatrix{});
+	for (size_t i = 1; i < n_layers; i++)
+	{
+		snapshot.weights[i] = math::DMatrix{ layer_c[i - 1], layer_c[i] };
+		snapshot.biases[i] = math::DMatrix{ 1, layer_c[i] };
+		std::copy(master[i].begin(), master[i].end(), snapshot.weights[i].begin());
+		std::copy(biases[i].begin(), biases[i].end(), snapshot.biases[i].begin());
+	}
+}
+
+std::unique_ptr<net::Network> net::MixedNetwork::Extract() const
+{
+	Snapshot snapshot;
+	TakeSnapshot(snapshot);
+	auto network = std::make_unique<Network>(layer_c, cost, actf::GetActivation(hiddenType), actf::GetActivation(outputType));
+	network->Restore(snapshot);
+	return network;
+}
+
+math::HALF_FORMAT net::MixedNetwork::GetFormat() const
+{
+	return format;
+}
+
+const std::vector<size_t>& net::MixedNetwork::GetLayerSizes() const
+{
+	return layer_c;
+}
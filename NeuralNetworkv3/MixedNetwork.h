@@ -0,0 +1,61 @@
+#pragma once
+
+#include "Network.h"
+#include "Half.h"
+#include <vector>
+#include <memory>
+
+namespace net
+{
+	// a network trained in mixed precision: the weights and the stored activations are 16-bit and every sum accumulates in fp32
+	// the updates go to an fp32 master copy of the weights, which is rounded back to 16 bits after each batch
+	// the kernels stream a quarter of the bytes Network's doubles take, at the cost of 8 (bf16) or 11 (fp16) significant bits
+	class MixedNetwork
+	{
+	public:
+		MixedNetwork(std::vector<size_t> layer_c, cost::Cost<double>* cost,
+			actf::ACTIVATION_TYPE hiddenType, actf::ACTIVATION_TYPE outputType,
+			math::HALF_FORMAT format = math::HALF_FORMAT::BF16, double bias = 0.0, uint64_t id = 0); // the weights of a Network with this id
+		MixedNetwork(const Snapshot& snapshot, cost::Cost<double>* cost, math::HALF_FORMAT format = math::HALF_FORMAT::BF16); // e.g. from a Network
+	public:
+		// the same steps as Network::Learn in lower precision
+		void Learn(const std::vector<util::DataPoint<double>>& batch, double learnRate);
+
+		math::DMatrix Feed(math::ConstDMatrixView input);
+		void CalculateOutputs(std::vector<util::DataPoint<double>>& batch);
+
+		// the fp32 master weights, widened to double
+		void TakeSnapshot(Snapshot& snapshot) const;
+		std::unique_ptr<Network> Extract() const;
+
+		math::HALF_FORMAT GetFormat() const;
+		const std::vector<size_t>& GetLayerSizes() const;
+	private:
+		void Forward(math::ConstDMatrixView input);
+		void Activate(float* out, const float* in, size_t n, actf::ACTIVATION_TYPE type) const;
+		void Derivative(float* out, const float* outputs, size_t n, actf::ACTIVATION_TYPE type) const; // from the decoded stored activations
+		void Quantize(size_t layer_i); // rounds the master weights into the 16-bit copy
+	private:
+		std::vector<size_t> layer_c;
+		size_t n_layers;
+		cost::Cost<double>* cost;
+		actf::ACTIVATION_TYPE hiddenType;
+		actf::ACTIVATION_TYPE outputType;
+		math::HALF_FORMAT format;
+
+		// per layer, index 0 is the input layer, weights are inputs x outputs
+		std::vector<std::vector<float>> master;
+		std::vector<std::vector<uint16_t>> weights; // what the kernels read
+		std::vector<std::vector<float>> biases; // one per node, kept in fp32
+		std::vector<std::vector<float>> weight_grad;
+		std::vector<std::vector<float>> bias_grad;
+		std::vector<std::vector<uint16_t>> outputs; // stored activations of the current sample
+
+		// fp32 scratch of the widest layer
+		std::vector<float> sums; // weighted inputs of the layer being computed
+		std::vector<float> result; // the output layer's activations at full fp32
+		std::vector<float> activations; // the decoded outputs of the previous layer
+		std::vector<float> nodeValues;
+		std::vector<float> propagated;
+	};
+}
@@ -0,0 +1,139 @@
+#include "ModelHandle.h"
+#include "Rcu.h"
+
+net::ModelHandle::ModelHandle(std::string path, std::chrono::milliseconds poll)
+	: path(path), poll(poll)
+{
+	Changed();
+	current.store(new Model{ std::make_unique<Network>(path), 1 });
+	stats.generation = 1;
+
+	if (poll.count() > 0)
+	{
+		watcher = std::thread{ &ModelHandle::Watch, this };
+	}
+}
+
+net::ModelHandle::~ModelHandle()
+{
+	if (watcher.joinable())
+	{
+		{
+			std::lock_guard<std::mutex> lock{ watchMtx };
+			stop = true;
+		}
+		cv.notify_all();
+		watcher.join();
+	}
+	delete current.load();
+}
+
+math::DMatrix net::ModelHandle::Feed(math::ConstDMatrixView input, uint64_t* generation) const
+{
+	util::rcu::ReadGuard guard;
+	const Model* model = current.load(); // sequentially consistent, pairs with the epoch store in ReadGuard
+	if (generation)
+	{
+		*generation = model->generation;
+	}
+	return model->network->Infer(input);
+}
+
+bool net::ModelHandle::Reload()
+{
+	util::trace::Span span{ "ModelHandle::Reload", "io" };
+	std::lock_guard<std::mutex> lock{ publishMtx };
+	Changed();
+
+	auto start = std::chrono::steady_clock::now();
+	std::unique_ptr<Network> network;
+	try
+	{
+		network = std::make_unique<Network>(path);
+	}
+	catch (const std::exception& e)
+	{
+		std::lock_guard<std::mutex> statsLock{ statsMtx };
+		stats.failures++;
+		stats.lastError = e.what();
+		return false;
+	}
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	{
+		std::lock_guard<std::mutex> statsLock{ statsMtx };
+		stats.reloads++;
+		stats.lastLoadSeconds = seconds;
+	}
+	Swap(std::move(network));
+	return true;
+}
+
+void net::ModelHandle::Publish(std::unique_ptr<Network> network)
+{
+	std::lock_guard<std::mutex> lock{ publishMtx };
+	Swap(std::move(network));
+}
+
+void net::ModelHandle::Swap(std::unique_ptr<Network> network)
+{
+	// one Feed while the network is still private builds its CSR weights, Infer only reads them
+	network->Feed(math::DMatrix{ 1, network->GetLayerSizes().front() });
+
+	Model* next = new Model{ std::move(network), current.load()->generation + 1 };
+	Model* old = current.exchange(next);
+
+	// readers that loaded old before the swap may still be using it
+	util::rcu::Synchronize();
+	delete old;
+
+	std::lock_guard<std::mutex> statsLock{ statsMtx };
+	stats.generation = next->generation;
+}
+
+uint64_t net::ModelHandle::GetGeneration() const
+{
+	// the model is freed once a swap's Synchronize returns, so it may only be read inside a read section
+	util::rcu::ReadGuard guard;
+	return current.load()->generation;
+}
+
+net::ReloadStats net::ModelHandle::GetStats() const
+{
+	std::lock_guard<std::mutex> lock{ statsMtx };
+	return stats;
+}
+
+void net::ModelHandle::Watch()
+{
+	util::trace::SetThreadName("model reload");
+	std::unique_lock<std::mutex> lock{ watchMtx };
+	while (!cv.wait_for(lock, poll, [this] { return stop; }))
+	{
+		lock.unlock();
+		bool changed;
+		{
+			std::lock_guard<std::mutex> publishLock{ publishMtx };
+			changed = Changed();
+		}
+		if (changed)
+		{
+			Reload();
+		}
+		lock.lock();
+	}
+}
+
+bool net::ModelHandle::Changed()
+{
+	std::error_code ec;
+	auto time = std::filesystem::last_write_time(path, ec);
+	uintmax_t size = ec ? 0 : std::filesystem::file_size(path, ec);
+	if (ec || (time == loadedTime && size == loadedSize))
+	{
+		return false;
+	}
+	loadedTime = time;
+	loadedSize = size;
+	return true;
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include "Network.h"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+
+namespace net
+{
+	struct ReloadStats
+	{
+		uint64_t generation = 0; // 1 for the model loaded by the constructor, +1 per publish
+		size_t reloads = 0;
+		size_t failures = 0; // loads that threw, the previous model kept serving
+		double lastLoadSeconds = 0.0;
+		std::string lastError;
+	};
+
+	// serves a model file and swaps in new weights whenever the file changes, without stopping inference
+	// a background thread loads the new file into a fresh network and publishes it with one atomic pointer swap,
+	// inferences already running finish on the old network, which is freed once the last of them returns
+	// a reload never blocks Feed, though Feed's Gemm calls still take a shared lock on the tuned configs once any exist
+	// writers should replace the file atomically (write a temp file and rename it)
+	class ModelHandle
+	{
+	public:
+		// loads path right away, throwing like Network(path), poll 0 turns the watcher off
+		ModelHandle(std::string path, std::chrono::milliseconds poll = std::chrono::milliseconds{ 500 });
+		~ModelHandle(); // no Feed may still be running
+
+		ModelHandle(const ModelHandle&) = delete;
+		ModelHandle& operator=(const ModelHandle&) = delete;
+	public:
+		// runs on whichever model is current when it starts, generation receives that model's generation
+		math::DMatrix Feed(math::ConstDMatrixView input, uint64_t* generation = nullptr) const;
+
+		bool Reload(); // loads the file now, false if that failed and the current model was kept
+		void Publish(std::unique_ptr<Network> network); // swaps in a network built some other way, e.g. freshly trained
+
+		uint64_t GetGeneration() const;
+		ReloadStats GetStats() const;
+	private:
+		struct Model
+		{
+			std::unique_ptr<Network> network;
+			uint64_t generation;
+		};
+
+		void Watch();
+		void Swap(std::unique_ptr<Network> network); // publishMtx must be held
+		bool Changed(); // compares the file's modification time and size with the last load, publishMtx must be held
+	private:
+		std::string path;
+		std::chrono::milliseconds poll;
+
+		std::atomic<Model*> current{ nullptr };
+
+		std::mutex publishMtx; // one writer at a time, readers never take it
+		std::filesystem::file_time_type loadedTime{};
+		uintmax_t loadedSize = 0;
+		ReloadStats stats;
+		mutable std::mutex statsMtx;
+
+		bool stop = false;
+		std::mutex watchMtx;
+		std::condition_variable cv;
+		std::thread watcher;
+	};
+}
@@ -0,0 +1,528 @@
+#include "ModelIO.h"
+#include "SparseMatrix.h"
+#include "Parallel.h"
+#include <charconv>
+#include <string_view>
+#include <fstream>
+#include <stdexcept>
+#include <cstring>
+#include <cstdint>
+
+namespace
+{
+	// collects output and hands it to the stream one chunk at a time
+	class ChunkWriter
+	{
+	public:
+		ChunkWriter(const std::string& path)
+			: out(path, std::ios::binary), path(path)
+		{
+			if (!out)
+			{
+				throw std::runtime_error("cannot open " + path + " for writing");
+			}
+			buffer.reserve(net::io::ioChunk + 64);
+		}
+
+		template<typename T>
+		void Put(T value)
+		{
+			char text[32];
+			std::to_chars_result res = std::to_chars(text, text + sizeof(text), value);
+			buffer.append(text, res.ptr - text);
+			buffer.push_back(' ');
+			Flush(false);
+		}
+
+		void EndLine()
+		{
+			buffer.push_back('\n');
+			Flush(false);
+		}
+
+		void Put(const char* text)
+		{
+			buffer.append(text);
+			Flush(false);
+		}
+
+		void Flush(bool force)
+		{
+			if (force || buffer.size() >= net::io::ioChunk)
+			{
+				out.write(buffer.data(), buffer.size());
+				buffer.clear();
+			}
+			if (force)
+			{
+				out.flush();
+			}
+			if (!out)
+			{
+				throw std::runtime_error("write to " + path + " failed");
+			}
+		}
+	private:
+		std::ofstream out;
+		std::string path;
+		std::string buffer;
+	};
+
+	struct Line
+	{
+		std::string_view text;
+		size_t number; // 1-based, for error messages
+	};
+
+	// a piece of one line, long lines are split at whitespace so the pieces can be parsed on different threads
+	struct Segment
+	{
+		size_t line_i;
+		std::string_view text;
+		bool integer;
+		std::vector<double> reals;
+		std::vector<uint64_t> ints;
+		std::string error;
+	};
+
+	bool IsSpace(char c)
+	{
+		return c == ' ' || c == '\t' || c == '\r';
+	}
+
+	void ParseSegment(Segment& segment)
+	{
+		const char* p = segment.text.data();
+		const char* end = p + segment.text.size();
+		while (true)
+		{
+			while (p != end && IsSpace(*p))
+			{
+				++p;
+			}
+			if (p == end)
+			{
+				return;
+			}
+
+			std::from_chars_result res;
+			if (segment.integer)
+			{
+				uint64_t v = 0;
+				res = std::from_chars(p, end, v);
+				segment.ints.push_back(v);
+			}
+			else
+			{
+				double v = 0.0;
+				res = std::from_chars(p, end, v);
+				segment.reals.push_back(v);
+			}
+			if (res.ec != std::errc{} || (res.ptr != end && !IsSpace(*res.ptr)))
+			{
+				const char* tokenEnd = p;
+				while (tokenEnd != end && !IsSpace(*tokenEnd))
+				{
+					++tokenEnd;
+				}
+				segment.error = "malformed " + std::string(segment.integer ? "integer" : "number") + " '" + std::string(p, tokenEnd) + "'";
+				return;
+			}
+			p = res.ptr;
+		}
+	}
+
+	class Parser
+	{
+	public:
+		Parser(const std::string& path, std::string text)
+			: path(path), text(std::move(text))
+		{
+			size_t number = 1;
+			for (size_t start = 0; start < this->text.size(); number++)
+			{
+				const char* nl = (const char*)std::memchr(this->text.data() + start, '\n', this->text.size() - start);
+				size_t end = nl ? nl - this->text.data() : this->text.size();
+				lines.push_back({ std::string_view{ this->text.data() + start, end - start }, number });
+				start = end + 1;
+			}
+		}
+
+		[[noreturn]] void Fail(size_t line_i, const std::string& message) const
+		{
+			throw std::runtime_error(path + ":" + std::to_string(line_i < lines.size() ? lines[line_i].number : lines.size() + 1) + ": " + message);
+		}
+
+		const Line& Get(size_t line_i) const
+		{
+			if (line_i >= lines.size())
+			{
+				Fail(line_i, "unexpected end of file");
+			}
+			return lines[line_i];
+		}
+
+		// queues the line for parsing, its values are available from Take after Run
+		size_t Queue(size_t line_i, bool integer)
+		{
+			std::string_view line = Get(line_i).text;
+			size_t first = segments.size();
+			while (true)
+			{
+				size_t cut = line.size();
+				if (line.size() > net::io::ioChunk)
+				{
+					cut = net::io::ioChunk;
+					while (cut < line.size() && !IsSpace(line[cut]))
+					{
+						cut++;
+					}
+				}
+				segments.push_back({ line_i, line.substr(0, cut), integer, {}, {}, {} });
+				if (cut == line.size())
+				{
+					break;
+				}
+				line.remove_prefix(cut);
+			}
+			queued.push_back({ first, segments.size() });
+			return queued.size() - 1;
+		}
+
+		void Run()
+		{
+			util::ParallelFor(segments.size(), 1, [this](size_t begin, size_t end) {
+				for (size_t i = begin; i < end; i++)
+				{
+					ParseSegment(segments[i]);
+				}
+			});
+			for (const Segment& segment : segments)
+			{
+				if (!segment.error.empty())
+				{
+					Fail(segment.line_i, segment.error);
+				}
+			}
+		}
+
+		template<typename T>
+		std::vector<T> Take(size_t queued_i, size_t count)
+		{
+			// counted before anything is reserved, so a corrupt count fails here instead of in the allocator
+			auto [first, last] = queued[queued_i];
+			size_t found = 0;
+			for (size_t s = first; s < last; s++)
+			{
+				found += segments[s].integer ? segments[s].ints.size() : segments[s].reals.size();
+			}
+			if (found != count)
+			{
+				Fail(segments[first].line_i, "expected " + std::to_string(count) + " values, found " + std::to_string(found));
+			}
+
+			std::vector<T> values;
+			values.reserve(count);
+			for (size_t s = first; s < last; s++)
+			{
+				if (segments[s].integer)
+				{
+					values.insert(values.end(), segments[s].ints.begin(), segments[s].ints.end());
+				}
+				else
+				{
+					values.insert(values.end(), segments[s].reals.begin(), segments[s].reals.end());
+				}
+			}
+			return values;
+		}
+
+		// parses one line right away, for the short header lines
+		template<typename T>
+		std::vector<T> Parse(size_t line_i, size_t count, bool integer)
+		{
+			size_t q = Queue(line_i, integer);
+			for (size_t s = queued[q].first; s < queued[q].second; s++)
+			{
+				ParseSegment(segments[s]);
+				if (!segments[s].error.empty())
+				{
+					Fail(line_i, segments[s].error);
+				}
+			}
+			std::vector<T> values = Take<T>(q, count);
+			segments.clear();
+			queued.clear();
+			return values;
+		}
+
+		size_t GetLineCount() const
+		{
+			return lines.size();
+		}
+	private:
+		std::string path;
+		std::string text;
+		std::vector<Line> lines;
+		std::vector<Segment> segments;
+		std::vector<std::pair<size_t, size_t>> queued;
+	};
+
+	std::string ReadFile(const std::string& path)
+	{
+		std::ifstream in{ path, std::ios::binary };
+		if (!in)
+		{
+			throw std::runtime_error("cannot open " + path);
+		}
+		std::string text;
+		in.seekg(0, std::ios::end);
+		std::streamoff size = in.tellg();
+		in.seekg(0, std::ios::beg);
+		if (size > 0)
+		{
+			text.reserve((size_t)size);
+		}
+
+		std::vector<char> chunk(net::io::ioChunk);
+		while (in)
+		{
+			in.read(chunk.data(), chunk.size());
+			text.append(chunk.data(), (size_t)in.gcount());
+		}
+		if (in.bad())
+		{
+			throw std::runtime_error("read from " + path + " failed");
+		}
+		return text;
+	}
+
+	net::actf::ACTIVATION_TYPE ToActivation(const Parser& parser, size_t line_i, uint64_t value)
+	{
+		if (value > (uint64_t)net::actf::ACTIVATION_TYPE::SOFTMAX)
+		{
+			parser.Fail(line_i, "unknown activation type " + std::to_string(value));
+		}
+		return (net::actf::ACTIVATION_TYPE)value;
+	}
+}
+
+void net::io::Write(const Snapshot& snapshot, const std::string& path, bool sparse)
+{
+	ChunkWriter out{ path };
+
+	// sparse files start with a marker, the rest of the header is the same
+	if (sparse)
+	{
+		out.Put("csr\n");
+	}
+
+	// n layers
+	out.Put(snapshot.layer_c.size());
+	out.EndLine();
+
+	// layer sizes
+	// l0 l1 l2 ...
+	for (size_t c : snapshot.layer_c)
+	{
+		out.Put(c);
+	}
+	out.EndLine();
+
+	// activation functions
+	// hidden output
+	out.Put((int)snapshot.hiddenType);
+	out.Put((int)snapshot.outputType);
+	out.EndLine();
+
+	// biases and weights
+	// l1 weights ...
+	// l1 biases ...
+	// l2 weights ...
+	// l2 biases ...
+
+	// sparse weights are written as
+	// non-zeros
+	// row offsets ...
+	// column indices ...
+	// values ...
+	for (size_t i = 1; i < snapshot.weights.size(); i++)
+	{
+		if (sparse)
+		{
+			math::DSparseMatrix csr{ snapshot.weights[i] };
+			out.Put(csr.GetNonZeros());
+			out.EndLine();
+			for (size_t o : csr.GetOffsets())
+			{
+				out.Put(o);
+			}
+			out.EndLine();
+			for (uint32_t c : csr.GetIndices())
+			{
+				out.Put(c);
+			}
+			out.EndLine();
+			for (double w : csr.GetValues())
+			{
+				out.Put(w);
+			}
+			out.EndLine();
+		}
+		else
+		{
+			for (double w : snapshot.weights[i])
+			{
+				out.Put(w);
+			}
+			out.EndLine();
+		}
+
+		for (double b : snapshot.biases[i])
+		{
+			out.Put(b);
+		}
+		out.EndLine();
+	}
+	out.Flush(true);
+}
+
+void net::io::Read(const std::string& path, Snapshot& snapshot, std::vector<math::DMatrix>* masks)
+{
+	Parser parser{ path, ReadFile(path) };
+
+	size_t line_i = 0;
+	bool sparse = parser.Get(0).text.substr(0, 3) == "csr";
+	if (sparse)
+	{
+		line_i++;
+	}
+
+	size_t n_layers = (size_t)parser.Parse<uint64_t>(line_i++, 1, true)[0];
+	if (n_layers < 2)
+	{
+		parser.Fail(line_i - 1, "a network needs at least 2 layers, found " + std::to_string(n_layers));
+	}
+	std::vector<uint64_t> sizes = parser.Parse<uint64_t>(line_i++, n_layers, true);
+	for (uint64_t size : sizes)
+	{
+		if (size == 0)
+		{
+			parser.Fail(line_i - 1, "empty layer");
+		}
+	}
+	std::vector<uint64_t> activations = parser.Parse<uint64_t>(line_i++, 2, true);
+
+	snapshot.layer_c.assign(sizes.begin(), sizes.end());
+	snapshot.hiddenType = ToActivation(parser, line_i - 1, activations[0]);
+	snapshot.outputType = ToActivation(parser, line_i - 1, activations[1]);
+
+	// every layer's lines are queued first so all of them are parsed in one parallel pass
+	struct Block
+	{
+		size_t line_i;
+		size_t nonZeros, offsets, indices, values, biases;
+	};
+	std::vector<Block> blocks(n_layers);
+	for (size_t i = 1; i < n_layers; i++)
+	{
+		Block& block = blocks[i];
+		block.line_i = line_i;
+		if (sparse)
+		{
+			block.nonZeros = parser.Queue(line_i++, true);
+			block.offsets = parser.Queue(line_i++, true);
+			block.indices = parser.Queue(line_i++, true);
+		}
+		block.values = parser.Queue(line_i++, false);
+		block.biases = parser.Queue(line_i++, false);
+	}
+	for (; line_i < parser.GetLineCount(); line_i++)
+	{
+		if (parser.Get(line_i).text.find_first_not_of(" \t\r") != std::string_view::npos)
+		{
+			parser.Fail(line_i, "unexpected data after the last layer");
+		}
+	}
+	parser.Run();
+
+	// the snapshot outlives any batch, so never let its matrices come from the arena
+	math::mem::ScopedResource scope{ &math::mem::GlobalPool() };
+
+	snapshot.weights.assign(n_layers, math::DMatrix{});
+	snapshot.biases.assign(n_layers, math::DMatrix{});
+	if (masks)
+	{
+		masks->assign(sparse ? n_layers : 0, math::DMatrix{});
+	}
+
+	for (size_t i = 1; i < n_layers; i++)
+	{
+		const Block& block = blocks[i];
+		size_t rows = snapshot.layer_c[i - 1], columns = snapshot.layer_c[i];
+		math::DMatrix& weights = snapshot.weights[i];
+		if (columns > SIZE_MAX / sizeof(double) / rows)
+		{
+			parser.Fail(block.line_i, "a " + std::to_string(rows) + "x" + std::to_string(columns) + " layer is too large");
+		}
+
+		if (sparse)
+		{
+			size_t nonZeros = (size_t)parser.Take<uint64_t>(block.nonZeros, 1)[0];
+			if (nonZeros > rows * columns)
+			{
+				parser.Fail(block.line_i, std::to_string(nonZeros) + " non-zeros in a " + std::to_string(rows) + "x" + std::to_string(columns) + " layer");
+			}
+			std::vector<uint64_t> offsets = parser.Take<uint64_t>(block.offsets, rows + 1);
+			std::vector<uint64_t> indices = parser.Take<uint64_t>(block.indices, nonZeros);
+			std::vector<double> values = parser.Take<double>(block.values, nonZeros);
+
+			// every offset is checked before any is used, an offset past nonZeros would index outside indices and values
+			if (offsets.front() != 0 || offsets.back() != nonZeros)
+			{
+				parser.Fail(block.line_i + 1, "row offsets must run from 0 to the number of non-zeros");
+			}
+			for (size_t r = 0; r < rows; r++)
+			{
+				if (offsets[r] > offsets[r + 1] || offsets[r + 1] > nonZeros)
+				{
+					parser.Fail(block.line_i + 1, "row offsets must not decrease or pass the number of non-zeros");
+				}
+			}
+
+			weights = math::DMatrix{ rows, columns };
+			math::DMatrix mask{ rows, columns };
+			for (size_t r = 0; r < rows; r++)
+			{
+				for (size_t n = offsets[r]; n < offsets[r + 1]; n++)
+				{
+					if (indices[n] >= columns)
+					{
+						parser.Fail(block.line_i + 2, "column index " + std::to_string(indices[n]) + " out of range");
+					}
+					// CSR keeps the columns of a row strictly increasing, a repeat would silently overwrite a weight
+					if (n > offsets[r] && indices[n] <= indices[n - 1])
+					{
+						parser.Fail(block.line_i + 2, "column indices of row " + std::to_string(r) + " must be strictly increasing");
+					}
+					weights[r * columns + indices[n]] = values[n];
+					mask[r * columns + indices[n]] = 1.0;
+				}
+			}
+			if (masks)
+			{
+				(*masks)[i] = std::move(mask);
+			}
+		}
+		else
+		{
+			std::vector<double> values = parser.Take<double>(block.values, rows * columns);
+			weights = math::DMatrix{ rows, columns };
+			std::memcpy(weights.GetData(), values.data(), values.size() * sizeof(double));
+		}
+
+		std::vector<double> biases = parser.Take<double>(block.biases, columns);
+		snapshot.biases[i] = math::DMatrix{ 1, columns };
+		std::memcpy(snapshot.biases[i].GetData(), biases.data(), biases.size() * sizeof(double));
+	}
+}
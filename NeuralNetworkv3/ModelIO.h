@@ -0,0 +1,21 @@
+#pragma once
+
+#include "Snapshot.h"
+#include <string>
+#include <vector>
+
+namespace net
+{
+	namespace io
+	{
+		constexpr size_t ioChunk = (size_t)1 << 20; // bytes per file read/write and the most text one thread parses in a go
+
+		// writes the text model format, numbers are printed with the fewest digits that read back to the same double
+		void Write(const Snapshot& snapshot, const std::string& path, bool sparse = false);
+
+		// reads a file written by Write, layers and long lines are parsed in parallel
+		// masks receives the non-zero pattern of every layer for sparse files and is left empty for dense ones
+		// throws std::runtime_error naming the file and line if it is malformed or truncated
+		void Read(const std::string& path, Snapshot& snapshot, std::vector<math::DMatrix>* masks = nullptr);
+	}
+}
@@ -1,233 +1,501 @@
 #include "Network.h"
-#include <fstream>
 #include "ActivationFuncs.h"
+#include "ModelIO.h"
+#include "Numa.h"
 
 net::Network::Network(std::vector<size_t> layer_c, cost::Cost<double>* cost, 
 	std::unique_ptr<actf::Activation> hiddenActiv,
 	std::unique_ptr<actf::Activation> outputActiv, 
-	double bias)
+	double bias, uint64_t id)
 	: layer_c(layer_c), cost(cost), hiddenActiv(std::move(hiddenActiv)), outputActiv(std::move(outputActiv))
 {
 	n_layers = layer_c.size();
+	BuildLayers(bias, id);
+}
+
+net::Network::Network(std::string path, cost::Cost<double>* cost)
+	: cost(cost)
+{
+	Load(path);
+}
+
+void net::Network::CalculateOutputs(util::DataPoint<double>& dp)
+{
+	dp.output = Feed(dp.input);
+}
+
+void net::Network::CalculateOutputs(std::vector<util::DataPoint<double>>& batch)
+{
+	for (auto& dp : batch)
+	{
+		CalculateOutputs(dp);
+	}
+}
+
+void net::Network::BuildLayers(double bias, uint64_t id)
+{
+	layers.clear();
+	layers.reserve(layer_c.size());
 
 	layers.emplace_back(layer_c[0]);
 	for (auto c = layer_c.begin() + 1; c != layer_c.end() - 1; ++c)
 	{
 		size_t i = c - layer_c.begin();
-		layers.emplace_back(layers[i - 1], math::DMatrix{ 1, *c, bias }, *c);
+		layers.emplace_back(layers[i - 1], math::DMatrix{ 1, *c, bias }, *c, -1.0, 1.0, util::LayerStream(id, i));
 	}
-	layers.emplace_back(layers[layers.size() - 1], math::DMatrix{ 1, layer_c[layer_c.size() - 1], bias }, layer_c[layer_c.size() - 1]);
+	layers.emplace_back(layers[layers.size() - 1], math::DMatrix{ 1, layer_c[layer_c.size() - 1], bias }, layer_c[layer_c.size() - 1],
+		-1.0, 1.0, util::LayerStream(id, layer_c.size() - 1));
 
-	weight_grad.resize(layers.size());
-	bias_grad.resize(layers.size());
+	parameters.Layout(layer_c);
+	PlaceSlab(parameters);
+	for (size_t i = 1; i < layers.size(); i++)
+	{
+		layers[i].Bind(parameters.GetWeights(i), parameters.GetBiases(i));
+	}
 
-	ClearGradients();
+	trainable.assign(layers.size(), true);
+	lowestTrainable = 1;
+	BindGradients();
 }
 
-net::Network::Network(std::string path)
+void net::Network::BindGradients()
 {
-	Load(path);
+	// frozen layers get no gradient storage at all
+	gradients.Layout(layer_c, trainable);
+	PlaceSlab(gradients);
+	weight_grad.assign(layers.size(), math::DMatrix{});
+	bias_grad.assign(layers.size(), math::DMatrix{});
+	for (size_t i = 1; i < layers.size(); i++)
+	{
+		if (trainable[i])
+		{
+			weight_grad[i].Bind(gradients.GetWeights(i), layer_c[i - 1], layer_c[i]);
+			bias_grad[i].Bind(gradients.GetBiases(i), 1, layer_c[i]);
+		}
+	}
 }
 
-void net::Network::CalculateOutputs(util::DataPoint<double>& dp)
+void net::Network::Save(std::string path, bool sparse) const
 {
-	dp.output = Feed(dp.input);
+	util::trace::Span span{ "Network::Save", "io" };
+	Snapshot snapshot;
+	TakeSnapshot(snapshot);
+	snapshot.Save(path, sparse);
 }
 
-void net::Network::CalculateOutputs(std::vector<util::DataPoint<double>>& batch)
+void net::Network::TakeSnapshot(Snapshot& snapshot) const
 {
-	for (auto& dp : batch)
+	// the snapshot outlives any batch, so never let its matrices come from the arena
+	math::mem::ScopedResource scope{ &math::mem::GlobalPool() };
+
+	snapshot.layer_c = layer_c;
+	snapshot.hiddenType = hiddenActiv->GetType();
+	snapshot.outputType = outputActiv->GetType();
+
+	snapshot.weights.resize(n_layers);
+	snapshot.biases.resize(n_layers);
+	for (size_t i = 0; i < n_layers; i++)
 	{
-		CalculateOutputs(dp);
+		snapshot.weights[i] = layers[i].GetWeights();
+		snapshot.biases[i] = layers[i].GetBiases();
 	}
 }
 
-void net::Network::Save(std::string path) const
+void net::Network::Restore(const Snapshot& snapshot)
 {
-	std::ofstream out{ path };
+	assert(snapshot.layer_c == layer_c);
+	for (size_t i = 0; i < n_layers; i++)
+	{
+		layers[i].SetWeights(snapshot.weights[i]);
+		layers[i].SetBiases(snapshot.biases[i]);
+	}
+}
 
-	// n layers
-	out << layer_c.size() << '\n';
+void net::Network::Load(std::string path)
+{
+	util::trace::Span span{ "Network::Load", "io" };
+	Snapshot snapshot;
+	std::vector<math::DMatrix> masks;
+	io::Read(path, snapshot, &masks);
+
+	layer_c = snapshot.layer_c;
+	n_layers = layer_c.size();
+	hiddenActiv = actf::GetActivation(snapshot.hiddenType);
+	outputActiv = actf::GetActivation(snapshot.outputType);
+
+	BuildLayers(0.0, 0);
+	Restore(snapshot);
+
+	// the stored pattern of a sparse file becomes the mask, so training a loaded pruned network keeps it pruned
+	for (size_t i = 1; i < masks.size(); i++)
+	{
+		layers[i].SetMask(masks[i]);
+	}
+}
 
-	// layer sizes
-	// l0 l1 l2 ...
-	for (const size_t& c : layer_c)
+void net::Network::ApplyGradients(double learnRate)
+{
+	util::trace::Span span{ "Network::ApplyGradients", "train" };
+	if (lowestTrainable == 1 && std::find(trainable.begin() + 1, trainable.end(), false) == trainable.end())
 	{
-		out << c << ' ';
+		// one pass over the whole slab instead of a temporary per matrix
+		parameters.Axpy(-learnRate, gradients);
+		ParametersChanged();
+		return;
 	}
-	out << '\n';
 
-	// activation functions
-	// hidden output
-	out << (int)hiddenActiv->GetType() << ' ' << (int)outputActiv->GetType() << '\n';
+	for (size_t i = lowestTrainable; i < n_layers; i++)
+	{
+		if (trainable[i])
+		{
+			parameters.Axpy(-learnRate, gradients, i);
+			layers[i].MarkChanged();
+		}
+	}
+}
 
-	// biases and weights
-	// l0 weights ...
-	// l0 biases ...
-	// l1 weights ...
-	// l1 biases ...
+void net::Network::ClearGradients()
+{
+	gradients.Zero();
+}
 
-	bool f = true;
-	for (const Layer& layer : layers)
+const math::DMatrix& net::Network::GetGradients(const util::DataPoint<double>& dp, GradientSync* sync)
+{
+	const math::DMatrix& output = Forward(dp.input, lowestTrainable < n_layers);
+	if (lowestTrainable == n_layers)
 	{
-		if (f)
+		return output;
+	}
+
+	// node values are only propagated down to the lowest trainable layer, frozen layers above it pass them through
+	// each step is one pass over the layer's weights that accumulates its gradients and yields the node values below it
+	math::DMatrix nodeValues = OutputLayerValues(output, dp);
+	math::DMatrix propagated;
+	for (size_t i = n_layers - 1; i >= lowestTrainable; --i)
+	{
+		util::trace::Span span{ "backward", "layer", (int64_t)i };
+		bool propagate = i > lowestTrainable;
+		if (propagate)
 		{
-			f = false; continue;
+			propagated.Resize(1, layer_c[i - 1]);
 		}
-		for (const double& w : layer.GetWeights())
+		math::FusedBackward<double>(layers[i].GetWeights(), nodeValues, layers[i - 1].GetOutputs(), layers[i - 1].GetDerivatives(),
+			trainable[i] ? math::DMatrixView{ weight_grad[i] } : math::DMatrixView{}, propagate ? math::DMatrixView{ propagated } : math::DMatrixView{});
+
+		if (trainable[i])
 		{
-			out << w << ' ';
+			bias_grad[i] = nodeValues;
+			if (sync)
+			{
+				sync->LayerReady(i, weight_grad[i], bias_grad[i]);
+			}
 		}
-		out << '\n';
-		for (const double& b : layer.GetBiases())
+		if (!propagate)
 		{
-			out << b << ' ';
+			break;
 		}
-		out << '\n';
+		std::swap(nodeValues, propagated);
 	}
-	out.close();
+	return output;
 }
 
-void net::Network::Load(std::string path)
+math::DMatrix net::Network::OutputLayerValues(const math::DMatrix& output, const util::DataPoint<double>& dp) const
 {
-	std::ifstream in{ path };
-	in >> n_layers;
+	// the cost takes a whole data point, it gets one with this output so dp itself is never written
+	return layers[n_layers - 1].GetDerivatives().Hadamard(cost->Derivative(util::DataPoint<double>{ math::DMatrix{}, dp.expected, output }));
+}
 
-	std::vector<size_t> layer_c;
-	for (size_t i = 0; i < n_layers; i++)
+math::DMatrix net::Network::Feed(math::ConstDMatrixView input)
+{
+	if (!cache)
 	{
-		size_t c = 0;
-		in >> c;
-		layer_c.push_back(c);
+		return Forward(input);
 	}
 
-	this->layer_c = layer_c;
+	// a miss is computed with the re-entrant Infer, Forward would write the layers' buffers that other callers share
+	uint64_t version = GetVersion();
+	math::DMatrix output;
+	if (!cache->Lookup(input, version, output))
+	{
+		output = Infer(input);
+		cache->Insert(input, version, output);
+	}
+	return output;
+}
 
-	int hiddenActiv = 0;
-	int outputActiv = 0;
+math::DMatrix net::Network::Infer(math::ConstDMatrixView input) const
+{
+	// every intermediate result is a local, the layers are only read
+	math::DMatrix values = layers[1].Apply(input, n_layers == 2 ? *outputActiv : *hiddenActiv);
+	for (size_t i = 2; i < n_layers; i++)
+	{
+		values = layers[i].Apply(values, i == n_layers - 1 ? *outputActiv : *hiddenActiv);
+	}
+	return values;
+}
 
-	in >> hiddenActiv;
-	in >> outputActiv;
+const math::DMatrix& net::Network::Forward(math::ConstDMatrixView input, bool keepDerivatives)
+{
+	// each layer reads the previous layer's outputs in place, only the final result is copied out
+	const math::DMatrix* values = &layers[0].Forward(input, *hiddenActiv, true); // the activation is not actually used
+	auto layer = layers.begin() + 1;
 
-	this->hiddenActiv = std::move(std::make_unique<actf::Sigmoid>());
-	this->outputActiv = std::move(std::make_unique<actf::Sigmoid>());
+	// the outputs of a frozen prefix only depend on the input, a cached copy is loaded into the last frozen layer
+	// so backprop still finds its outputs there
+	if (prefixCache && lowestTrainable > 1 && lowestTrainable < n_layers)
+	{
+		Layer& top = layers[lowestTrainable - 1];
+		uint64_t version = 0;
+		for (size_t i = 0; i < lowestTrainable; i++)
+		{
+			version = std::max(version, layers[i].GetVersion());
+		}
 
-	layers.reserve(layer_c.size());
+		if (prefixCache->Lookup(input, version, prefixOutputs))
+		{
+			values = &top.Forward(prefixOutputs, *hiddenActiv, true);
+		}
+		else
+		{
+			for (; layer != layers.begin() + lowestTrainable; ++layer)
+			{
+				util::trace::Span span{ "forward", "layer", layer - layers.begin() };
+				values = &layer->Forward(*values, *hiddenActiv);
+			}
+			prefixCache->Insert(input, version, *values);
+		}
+		layer = layers.begin() + lowestTrainable;
+	}
 
-	layers.emplace_back(layer_c[0]);
-	for (auto c = layer_c.begin() + 1; c != layer_c.end() - 1; ++c)
+	for (; layer != layers.end() - 1; ++layer)
 	{
-		size_t i = c - layer_c.begin();
-		layers.emplace_back(layers[i - 1], math::DMatrix{ 1, *c, 0.0 }, *c);
+		util::trace::Span span{ "forward", "layer", layer - layers.begin() };
+		values = &layer->Forward(*values, *hiddenActiv, false, keepDerivatives && (size_t)(layer - layers.begin()) >= lowestTrainable);
 	}
-	layers.emplace_back(layers[layers.size() - 1], math::DMatrix{ 1, layer_c[layer_c.size() - 1], 0.0 }, layer_c[layer_c.size() - 1]);
+	util::trace::Span span{ "forward", "layer", (int64_t)n_layers - 1 };
+	return layers[layers.size() - 1].Forward(*values, *outputActiv, false, keepDerivatives);
+}
 
-	for (Layer& layer : layers)
+void net::Network::Learn(std::vector<util::DataPoint<double>>& batch, double learnRate, GradientSync* sync)
+{
+	LearnBatch(batch, learnRate, sync, &batch);
+}
+
+void net::Network::Learn(const std::vector<util::DataPoint<double>>& batch, double learnRate, GradientSync* sync)
+{
+	LearnBatch(batch, learnRate, sync, nullptr);
+}
+
+void net::Network::LearnBatch(const std::vector<util::DataPoint<double>>& batch, double learnRate, GradientSync* sync, std::vector<util::DataPoint<double>>* outputs)
+{
+	util::trace::Span span{ "Network::Learn", "train", -1, true }; // batches are the sampling unit
 	{
-		math::DMatrix weights{layer.GetWeights().GetRows(), layer.GetWeights().GetColumns()};
-		for (size_t i = 0; i < layer.GetWeights().GetSize(); i++)
+		math::mem::ScopedResource scope{ &arena };
+
+		// the gradients are only final during the last data point, that one reports them to sync layer by layer
+		for (auto dp = batch.begin(); dp != batch.end(); ++dp)
 		{
-			double w = 0.0;
-			in >> w;
-			weights[i] = w;
+			const math::DMatrix& output = GetGradients(*dp, dp == batch.end() - 1 ? sync : nullptr);
+			if (outputs)
+			{
+				(*outputs)[dp - batch.begin()].output = output;
+			}
 		}
-		layer.SetWeights(weights);
 
-		math::DMatrix biases{ layer.GetBiases().GetRows(), layer.GetBiases().GetColumns() };
-		for (size_t i = 0; i < layer.GetBiases().GetSize(); i++)
+		if (sync)
 		{
-			double b = 0.0;
-			in >> b;
-			biases[i] = b;
+			if (batch.empty())
+			{
+				for (size_t i = n_layers - 1; i > 0; --i)
+				{
+					if (trainable[i])
+					{
+						sync->LayerReady(i, weight_grad[i], bias_grad[i]);
+					}
+				}
+			}
+			sync->Wait();
 		}
-		layer.SetBiases(biases);
+
+		ApplyGradients(learnRate);
+		ClearGradients();
+	}
+	arena.Reset();
+}
+
+void net::Network::BindToNode(int physical)
+{
+	node = physical;
+	arena.SetUpstream(node < 0 ? std::pmr::new_delete_resource() : &util::numa::NodeMemory(node));
+	PlaceSlab(parameters);
+	PlaceSlab(gradients);
+}
+
+int net::Network::GetNode() const
+{
+	return node;
+}
+
+void net::Network::PlaceSlab(const ParameterSlab& slab) const
+{
+	if (node >= 0)
+	{
+		util::numa::Migrate(slab.GetData(), slab.GetSize() * sizeof(double), node);
 	}
+}
 
-	weight_grad.resize(layers.size());
-	bias_grad.resize(layers.size());
+net::MemoryStats net::Network::GetMemoryStats() const
+{
+	return { arena.GetStats(), math::mem::GlobalPool().GetStats() };
+}
+
+void net::Network::ClearMemoryStats()
+{
+	arena.ClearStats();
+	math::mem::GlobalPool().ClearStats();
+}
 
-	ClearGradients();
+const std::vector<size_t>& net::Network::GetLayerSizes() const
+{
+	return layer_c;
+}
 
-	in.close();
+void net::Network::EnableCache(size_t capacity, size_t shards)
+{
+	cache = std::make_unique<InferenceCache>(capacity, shards);
 }
 
-void net::Network::ApplyGradients(double learnRate)
+void net::Network::DisableCache()
 {
-	for (size_t i = 0; i < n_layers; ++i)
+	cache.reset();
+}
+
+net::CacheStats net::Network::GetCacheStats() const
+{
+	return cache ? cache->GetStats() : CacheStats{};
+}
+
+uint64_t net::Network::GetVersion() const
+{
+	// every update draws a fresh, larger version, so the largest one moves whenever anything changes
+	uint64_t version = 0;
+	for (const Layer& layer : layers)
 	{
-		layers[i].SetWeights(layers[i].GetWeights() - weight_grad[i] * learnRate);
-		layers[i].SetBiases(layers[i].GetBiases() - bias_grad[i] * learnRate);
+		version = std::max(version, layer.GetVersion());
 	}
+	return version;
 }
 
-void net::Network::ClearGradients()
+void net::Network::Prune(const prune::PruneConfig& config)
+{
+	for (size_t i = 1; i < n_layers; i++)
+	{
+		layers[i].SetMask(prune::MagnitudeMask(layers[i].GetWeights(), config));
+	}
+}
+
+void net::Network::ClearMasks()
 {
-	for (auto grad = weight_grad.begin(); grad != weight_grad.end(); ++grad)
+	for (Layer& layer : layers)
 	{
-		size_t i = grad - weight_grad.begin();
-		*grad = math::DMatrix{ layers[i].GetWeights().GetRows(), layers[i].GetWeights().GetColumns() };
+		layer.ClearMask();
 	}
+}
 
-	for (auto grad = bias_grad.begin(); grad != bias_grad.end(); ++grad)
+void net::Network::SetSparseInference(double maxDensity)
+{
+	for (size_t i = 1; i < n_layers; i++)
 	{
-		size_t i = grad - bias_grad.begin();
-		*grad = math::DMatrix{ layers[i].GetBiases().GetRows(), layers[i].GetBiases().GetColumns() };
+		layers[i].SetSparse(maxDensity > 0.0 && layers[i].GetDensity() <= maxDensity);
 	}
 }
 
-void net::Network::UpdateGradients(size_t layer_i, math::DMatrix nodeValues)
+double net::Network::GetSparsity() const
 {
-	weight_grad[layer_i] += layers[layer_i - 1].GetOutputs().GetTransposed() * nodeValues;
-	bias_grad[layer_i] = nodeValues;
+	size_t total = 0;
+	double zeros = 0.0;
+	for (size_t i = 1; i < n_layers; i++)
+	{
+		size_t size = layers[i].GetWeights().GetSize();
+		zeros += (1.0 - layers[i].GetDensity()) * size;
+		total += size;
+	}
+	return total == 0 ? 0.0 : zeros / total;
 }
 
-void net::Network::GetGradients(util::DataPoint<double>& dp)
+net::ParameterSlab& net::Network::GetParameterSlab()
 {
-	CalculateOutputs(dp);
+	return parameters;
+}
 
-	math::DMatrix nodeValues = OutputLayerValues(dp);
-	UpdateGradients(n_layers - 1, nodeValues);
+const net::ParameterSlab& net::Network::GetParameterSlab() const
+{
+	return parameters;
+}
 
-	for (size_t i = n_layers - 2; i > 0; --i)
+void net::Network::ParametersChanged()
+{
+	for (Layer& layer : layers)
 	{
-		nodeValues = HiddenLayerValues(i, nodeValues);
-		UpdateGradients(i, nodeValues);
+		layer.MarkChanged();
 	}
 }
 
-math::DMatrix net::Network::OutputLayerValues(util::DataPoint<double>& dp) const
+uint64_t net::Network::GetChecksum() const
 {
-	return outputActiv->
-		Derivative(layers[n_layers - 1].GetWeightedInputs())
-		.Hadamard(cost->Derivative(dp));
+	return parameters.Checksum();
 }
 
-math::DMatrix net::Network::HiddenLayerValues(size_t layer_i, math::DMatrix nodeValues) const
+void net::Network::SetTrainable(size_t layer_i, bool value)
 {
-	return (nodeValues * layers[layer_i + 1].GetWeights().GetTransposed())
-		.Hadamard(
-			hiddenActiv
-			->Derivative(layers[layer_i].GetWeightedInputs()));
+	assert(layer_i > 0 && layer_i < n_layers);
+	trainable[layer_i] = value;
+	UpdateTrainable();
 }
 
-math::DMatrix net::Network::Feed(math::DMatrix input)
+void net::Network::FreezeBelow(size_t layer_i)
 {
-	input = layers[0].Forward(input, *hiddenActiv, true); // the activation is not actually used
-	for (auto layer = layers.begin() + 1; layer != layers.end() - 1; ++layer)
+	for (size_t i = 1; i < n_layers; i++)
 	{
-		input = layer->Forward(input, *hiddenActiv);
+		trainable[i] = i >= layer_i;
 	}
-	input = layers[layers.size() - 1].Forward(input, *outputActiv);
-	return input;
+	UpdateTrainable();
 }
 
-void net::Network::Learn(std::vector<util::DataPoint<double>>& batch, double learnRate)
+void net::Network::UpdateTrainable()
 {
-	for (auto& dp : batch)
+	lowestTrainable = n_layers;
+	for (size_t i = n_layers - 1; i > 0; --i)
 	{
-		GetGradients(dp);
+		if (trainable[i])
+		{
+			lowestTrainable = i;
+		}
 	}
+	BindGradients();
+}
+
+bool net::Network::IsTrainable(size_t layer_i) const
+{
+	return trainable[layer_i];
+}
 
-	ApplyGradients(learnRate);
-	ClearGradients();
+size_t net::Network::GetLowestTrainable() const
+{
+	return lowestTrainable;
+}
+
+void net::Network::EnablePrefixCache(size_t capacity, size_t shards)
+{
+	prefixCache = std::make_unique<InferenceCache>(capacity, shards);
+}
+
+void net::Network::DisablePrefixCache()
+{
+	prefixCache.reset();
+}
+
+net::CacheStats net::Network::GetPrefixCacheStats() const
+{
+	return prefixCache ? prefixCache->GetStats() : CacheStats{};
 }
@@ -4,40 +4,121 @@
 #include "Cost.h"
 #include "Utility.h"
 #include "Layer.h"
+#include "Memory.h"
+#include "Snapshot.h"
+#include "InferenceCache.h"
+#include "Prune.h"
+#include "ParameterSlab.h"
+#include "Trace.h"
 #include <string>
 #include <memory>
 
 namespace net
 {	
+	struct MemoryStats
+	{
+		math::mem::Stats arena; // per-batch temporaries of Learn, peakBytes is the arena size a batch needs
+		math::mem::Stats pool; // every other matrix allocation, shared by all networks
+	};
+
+	// receives each layer's gradients as soon as they are final for the batch, so distributed training
+	// can reduce them while the earlier layers are still being backpropagated
+	class GradientSync
+	{
+	public:
+		virtual void LayerReady(size_t layer_i, math::DMatrix& weightGrad, math::DMatrix& biasGrad) = 0;
+		virtual void Wait() = 0; // called before the gradients are applied
+	};
+
 	class Network
 	{
+		friend class Pipeline; // runs the layers of a stage on batches of samples and shares the gradient slab
 	public:
 		Network(std::vector<size_t> layer_c, cost::Cost<double>* cost,
 			std::unique_ptr<actf::Activation> hiddenActiv,
 			std::unique_ptr<actf::Activation> outputActiv,
-			double bias = 0.0);
-		Network(std::string path);
+			double bias = 0.0, uint64_t id = 0); // networks with the same id and layer sizes start from the same weights
+		Network(std::string path, cost::Cost<double>* cost = nullptr); // the cost is only needed to keep training a loaded network
 	public:
 		void CalculateOutputs(util::DataPoint<double>& dp);
 		void CalculateOutputs(std::vector<util::DataPoint<double>>& batch);
 
-		math::DMatrix Feed(math::DMatrix input);
-		void Learn(std::vector<util::DataPoint<double>>& batch, double learnRate);
+		// served from the inference cache when it is enabled, then safe to call from many threads while nothing trains the network,
+		// without the cache it runs Forward and is single-threaded
+		math::DMatrix Feed(math::ConstDMatrixView input);
+		math::DMatrix Infer(math::ConstDMatrixView input) const; // like Feed without the caches, re-entrant and safe to call from many threads
+		void Learn(std::vector<util::DataPoint<double>>& batch, double learnRate, GradientSync* sync = nullptr); // also sets each point's output
+		// leaves the batch untouched, so any number of networks can learn from the same data on different threads
+		void Learn(const std::vector<util::DataPoint<double>>& batch, double learnRate, GradientSync* sync = nullptr);
+
+		void Save(std::string path, bool sparse = false) const; // sparse files store the weights as CSR
+		void Load(std::string path); // throws std::runtime_error if the file is missing, malformed or truncated
+
+		// copies the parameters into snapshot, reusing its matrices so repeated snapshots do not allocate
+		void TakeSnapshot(Snapshot& snapshot) const;
+		void Restore(const Snapshot& snapshot); // the snapshot must come from a network with the same layer sizes
+
+		MemoryStats GetMemoryStats() const;
+		void ClearMemoryStats();
+
+		const std::vector<size_t>& GetLayerSizes() const;
 
-		void Save(std::string path) const;
-		void Load(std::string path);
+		// memoizes Feed and CalculateOutputs by input, entries are dropped automatically once the weights change
+		void EnableCache(size_t capacity, size_t shards = 16);
+		void DisableCache();
+		CacheStats GetCacheStats() const;
+
+		uint64_t GetVersion() const; // changes whenever any layer's parameters change
+
+		// zeroes the smallest weights of every layer and keeps them at zero through later Learn calls
+		void Prune(const prune::PruneConfig& config);
+		void ClearMasks();
+		// layers with at most this fraction of non-zero weights run the sparse kernel, 0 turns it off
+		void SetSparseInference(double maxDensity);
+		double GetSparsity() const; // fraction of zero weights over all layers
+
+		// all layers' weights and biases live in one slab and all gradients in another, the layers only hold views
+		ParameterSlab& GetParameterSlab();
+		const ParameterSlab& GetParameterSlab() const;
+		void ParametersChanged(); // call after writing to the parameter slab directly
+		uint64_t GetChecksum() const; // of every weight and bias
+
+		// frozen layers keep their parameters, get no gradient storage and backprop stops at the lowest trainable layer
+		void SetTrainable(size_t layer_i, bool value);
+		void FreezeBelow(size_t layer_i); // layers below layer_i frozen, the rest trainable
+		bool IsTrainable(size_t layer_i) const;
+		size_t GetLowestTrainable() const; // n_layers if everything is frozen
+
+		// caches the outputs of the frozen layers below the lowest trainable one per input, so repeated
+		// epochs over the same samples only run the trainable suffix
+		void EnablePrefixCache(size_t capacity, size_t shards = 16);
+		void DisablePrefixCache();
+		CacheStats GetPrefixCacheStats() const;
+
+		// moves the parameters and gradients to a NUMA node and takes Learn's scratch from it, for a network
+		// trained by threads pinned to that node, -1 takes the scratch from the heap again and leaves the pages where they are
+		void BindToNode(int physical);
+		int GetNode() const;
 	private:
+		// always runs every layer, backprop needs their outputs, and with keepDerivatives the trainable layers also keep their derivatives
+		const math::DMatrix& Forward(math::ConstDMatrixView input, bool keepDerivatives = false);
+		void BuildLayers(double bias, uint64_t id); // creates the layers for layer_c with the initial weights of network id
+		void BindGradients(); // lays out the gradient slab for the trainable layers
+		void UpdateTrainable();
+		void PlaceSlab(const ParameterSlab& slab) const; // on the bound node, if any
+
 		void ApplyGradients(double learnRate);
 		void ClearGradients();
-		void UpdateGradients(size_t layer_i, math::DMatrix nodeValues); // accumulates the gradients and use the average of the gradients when being applied
-		void GetGradients(util::DataPoint<double>& dp);
+		void LearnBatch(const std::vector<util::DataPoint<double>>& batch, double learnRate, GradientSync* sync, std::vector<util::DataPoint<double>>* outputs);
+		const math::DMatrix& GetGradients(const util::DataPoint<double>& dp, GradientSync* sync = nullptr); // returns the network's output
 
-		math::DMatrix OutputLayerValues(util::DataPoint<double>& dp) const;
-		math::DMatrix HiddenLayerValues(size_t layer_i, math::DMatrix nodeValues) const;
+		math::DMatrix OutputLayerValues(const math::DMatrix& output, const util::DataPoint<double>& dp) const;
 	private:
 		std::vector<Layer> layers;
 
-		std::vector<math::DMatrix> weight_grad;
+		ParameterSlab parameters;
+		ParameterSlab gradients;
+		std::vector<math::DMatrix> weight_grad; // bound to gradients
 		std::vector<math::DMatrix> bias_grad;
 
 		std::unique_ptr<actf::Activation> hiddenActiv;
@@ -47,5 +128,16 @@ namespace net
 
 		std::vector<size_t> layer_c;
 		size_t n_layers;
+
+		math::mem::Arena arena; // reset once per batch by Learn
+
+		std::unique_ptr<InferenceCache> cache;
+
+		std::vector<bool> trainable;
+		size_t lowestTrainable = 1;
+		std::unique_ptr<InferenceCache> prefixCache;
+		math::DMatrix prefixOutputs; // outputs of the frozen prefix looked up for the current sample
+
+		int node = -1;
 	};
 }
\ No newline at end of file
@@ -0,0 +1,421 @@
+#include "Numa.h"
+#include "Parallel.h"
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <cctype>
+#include <map>
+#include <mutex>
+#include <new>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <Windows.h>
+#include <Psapi.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+namespace
+{
+#ifdef __linux__
+	// from linux/mempolicy.h, called through syscall so there is no dependency on libnuma
+	constexpr int mpolPreferred = 1;
+	constexpr unsigned mpolMoveFlag = 1 << 1;
+
+	long SetPolicy(void* p, size_t bytes, int mode, size_t physical, unsigned flags)
+	{
+		constexpr size_t bits = sizeof(unsigned long) * 8;
+		std::vector<unsigned long> mask(physical / bits + 1, 0);
+		mask[physical / bits] |= 1ul << (physical % bits);
+		// the kernel reads maxnode - 1 bits
+		return syscall(SYS_mbind, p, bytes, mode, mask.data(), mask.size() * bits + 1, flags);
+	}
+#endif
+
+	size_t PageSize()
+	{
+#ifdef _WIN32
+		SYSTEM_INFO info;
+		GetSystemInfo(&info);
+		return info.dwPageSize;
+#elif defined(__linux__)
+		return (size_t)sysconf(_SC_PAGESIZE);
+#else
+		return 4096;
+#endif
+	}
+
+	size_t AlignUp(size_t value, size_t alignment)
+	{
+		return (value + alignment - 1) & ~(alignment - 1);
+	}
+
+	bool IsNodeName(const std::string& name)
+	{
+		return name.size() > 4 && name.compare(0, 4, "node") == 0
+			&& std::all_of(name.begin() + 4, name.end(), [](char c) { return std::isdigit((unsigned char)c); });
+	}
+
+	struct NodeMemories
+	{
+		util::numa::NodeResource resource;
+		math::mem::Pool pool;
+
+		NodeMemories(size_t physical)
+			: resource(physical), pool(&resource)
+		{}
+	};
+
+	NodeMemories& Memories(size_t physical)
+	{
+		// never destroyed so matrices with static storage duration can still free into their pool at exit
+		static std::mutex* mtx = new std::mutex();
+		static std::map<size_t, NodeMemories*>* nodes = new std::map<size_t, NodeMemories*>();
+
+		std::lock_guard<std::mutex> lock{ *mtx };
+		NodeMemories*& memories = (*nodes)[physical];
+		if (!memories)
+		{
+			memories = new NodeMemories(physical);
+		}
+		return *memories;
+	}
+}
+
+size_t util::numa::Topology::NodeOfCpu(size_t cpu) const
+{
+	for (const Node& node : nodes)
+	{
+		if (std::find(node.cpus.begin(), node.cpus.end(), cpu) != node.cpus.end())
+		{
+			return node.id;
+		}
+	}
+	return 0;
+}
+
+size_t util::numa::Topology::GetCpuCount() const
+{
+	size_t count = 0;
+	for (const Node& node : nodes)
+	{
+		count += node.cpus.size();
+	}
+	return count;
+}
+
+util::numa::Topology util::numa::Discover(const std::string& root)
+{
+	Topology topology;
+#ifdef _WIN32
+	ULONG highest = 0;
+	if (GetNumaHighestNodeNumber(&highest))
+	{
+		for (ULONG n = 0; n <= highest; n++)
+		{
+			GROUP_AFFINITY affinity{};
+			if (!GetNumaNodeProcessorMaskEx((USHORT)n, &affinity))
+			{
+				continue;
+			}
+			Node node;
+			node.physical = n;
+			for (size_t bit = 0; bit < 64; bit++)
+			{
+				if (affinity.Mask & ((KAFFINITY)1 << bit))
+				{
+					node.cpus.push_back(affinity.Group * 64 + bit);
+				}
+			}
+			ULONGLONG available = 0;
+			if (GetNumaAvailableMemoryNodeEx((USHORT)n, &available))
+			{
+				node.memoryBytes = available;
+			}
+			topology.nodes.push_back(node);
+		}
+	}
+#else
+	std::error_code error;
+	for (const auto& entry : std::filesystem::directory_iterator(root, error))
+	{
+		std::string name = entry.path().filename().string();
+		if (!IsNodeName(name))
+		{
+			continue;
+		}
+		Node node;
+		node.physical = std::stoul(name.substr(4));
+
+		std::ifstream cpulist{ entry.path() / "cpulist" };
+		std::string list;
+		std::getline(cpulist, list);
+		node.cpus = ParseCpuList(list);
+
+		// "Node 0 MemTotal:       4685560 kB"
+		std::ifstream meminfo{ entry.path() / "meminfo" };
+		std::string line;
+		while (std::getline(meminfo, line))
+		{
+			size_t at = line.find("MemTotal:");
+			if (at != std::string::npos)
+			{
+				node.memoryBytes = std::stoull(line.substr(at + 9)) * 1024;
+				break;
+			}
+		}
+		topology.nodes.push_back(node);
+	}
+	std::sort(topology.nodes.begin(), topology.nodes.end(), [](const Node& a, const Node& b) { return a.physical < b.physical; });
+#endif
+
+	if (topology.nodes.empty())
+	{
+		Node node;
+		for (size_t cpu = 0; cpu < HardwareThreads(); cpu++)
+		{
+			node.cpus.push_back(cpu);
+		}
+		topology.nodes.push_back(node);
+	}
+	for (size_t i = 0; i < topology.nodes.size(); i++)
+	{
+		topology.nodes[i].id = i;
+	}
+	return topology;
+}
+
+util::numa::Topology util::numa::Emulate(const Topology& topology, size_t n)
+{
+	Topology emulated;
+	emulated.emulated = true;
+	emulated.nodes.resize(n);
+
+	// emulated node k lives on real node k % r, and the real node's CPUs and memory are shared out between its emulated nodes
+	size_t r = topology.nodes.size();
+	for (size_t j = 0; j < r && j < n; j++)
+	{
+		const Node& real = topology.nodes[j];
+		size_t shares = (n - j + r - 1) / r;
+		for (size_t s = 0; s < shares; s++)
+		{
+			Node& node = emulated.nodes[j + s * r];
+			node.id = j + s * r;
+			node.physical = real.physical;
+			node.memoryBytes = real.memoryBytes / shares;
+			size_t count = real.cpus.size();
+			if (count >= shares)
+			{
+				node.cpus.assign(real.cpus.begin() + count * s / shares, real.cpus.begin() + count * (s + 1) / shares);
+			}
+			else if (count > 0)
+			{
+				node.cpus.push_back(real.cpus[s % count]);
+			}
+		}
+	}
+	return emulated;
+}
+
+std::vector<size_t> util::numa::ParseCpuList(const std::string& list)
+{
+	std::vector<size_t> cpus;
+	std::stringstream stream{ list };
+	std::string range;
+	while (std::getline(stream, range, ','))
+	{
+		if (range.empty() || !std::isdigit((unsigned char)range[0]))
+		{
+			continue;
+		}
+		size_t dash = range.find('-');
+		size_t first = std::stoul(range);
+		size_t last = dash == std::string::npos ? first : std::stoul(range.substr(dash + 1));
+		for (size_t cpu = first; cpu <= last; cpu++)
+		{
+			cpus.push_back(cpu);
+		}
+	}
+	return cpus;
+}
+
+std::vector<int> util::numa::AssignCpus(const Topology& topology, size_t threads, PIN_POLICY policy)
+{
+	std::vector<int> cpus(threads, -1);
+	std::vector<const Node*> nodes;
+	for (const Node& node : topology.nodes)
+	{
+		if (!node.cpus.empty())
+		{
+			nodes.push_back(&node);
+		}
+	}
+	if (policy == PIN_POLICY::NONE || nodes.empty())
+	{
+		return cpus;
+	}
+
+	if (policy == PIN_POLICY::COMPACT)
+	{
+		std::vector<size_t> all;
+		for (const Node* node : nodes)
+		{
+			all.insert(all.end(), node->cpus.begin(), node->cpus.end());
+		}
+		for (size_t t = 0; t < threads; t++)
+		{
+			cpus[t] = (int)all[t % all.size()];
+		}
+	}
+	else
+	{
+		for (size_t t = 0; t < threads; t++)
+		{
+			const Node* node = nodes[t % nodes.size()];
+			cpus[t] = (int)node->cpus[(t / nodes.size()) % node->cpus.size()];
+		}
+	}
+	return cpus;
+}
+
+bool util::numa::PinThread(int cpu)
+{
+	if (cpu < 0)
+	{
+		return false;
+	}
+#ifdef _WIN32
+	// only the calling thread's processor group, enough for machines with up to 64 logical CPUs
+	return cpu < 64 && SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << cpu) != 0;
+#elif defined(__linux__)
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+	return false;
+#endif
+}
+
+int util::numa::CurrentCpu()
+{
+#ifdef _WIN32
+	return (int)GetCurrentProcessorNumber();
+#elif defined(__linux__)
+	return sched_getcpu();
+#else
+	return -1;
+#endif
+}
+
+size_t util::numa::CurrentNode(const Topology& topology)
+{
+	int cpu = CurrentCpu();
+	return cpu < 0 ? 0 : topology.NodeOfCpu(cpu);
+}
+
+util::numa::NodeResource::NodeResource(size_t physical)
+	: physical(physical)
+{}
+
+void* util::numa::NodeResource::do_allocate(size_t bytes, [[maybe_unused]] size_t alignment)
+{
+	size_t size = AlignUp(bytes, PageSize());
+#ifdef _WIN32
+	void* p = VirtualAllocExNuma(GetCurrentProcess(), nullptr, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE, (DWORD)physical);
+	if (!p)
+	{
+		p = VirtualAlloc(nullptr, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+	}
+	if (!p)
+	{
+		throw std::bad_alloc();
+	}
+	return p;
+#elif defined(__linux__)
+	void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED)
+	{
+		throw std::bad_alloc();
+	}
+	// preferred rather than bound, a full node spills over instead of failing the allocation
+	// if the kernel has no NUMA support the pages simply go wherever they are first touched
+	SetPolicy(p, size, mpolPreferred, physical, 0);
+	return p;
+#else
+	return ::operator new(size, std::align_val_t{ std::max(alignment, PageSize()) });
+#endif
+}
+
+void util::numa::NodeResource::do_deallocate(void* p, [[maybe_unused]] size_t bytes, [[maybe_unused]] size_t alignment)
+{
+#ifdef _WIN32
+	VirtualFree(p, 0, MEM_RELEASE);
+#elif defined(__linux__)
+	munmap(p, AlignUp(bytes, PageSize()));
+#else
+	::operator delete(p, std::align_val_t{ std::max(alignment, PageSize()) });
+#endif
+}
+
+bool util::numa::NodeResource::do_is_equal(const std::pmr::memory_resource& other) const noexcept
+{
+	return this == &other;
+}
+
+util::numa::NodeResource& util::numa::NodeMemory(size_t physical)
+{
+	return Memories(physical).resource;
+}
+
+math::mem::Pool& util::numa::NodePool(size_t physical)
+{
+	return Memories(physical).pool;
+}
+
+bool util::numa::Migrate(const void* p, size_t bytes, size_t physical)
+{
+	size_t page = PageSize();
+	size_t begin = AlignUp((size_t)p, page);
+	size_t end = ((size_t)p + bytes) & ~(page - 1);
+	if (end <= begin)
+	{
+		return true;
+	}
+#ifdef __linux__
+	// preferred like NodeResource, so pages the range faults in later spill to other nodes instead of failing when this one is full
+	return SetPolicy((void*)begin, end - begin, mpolPreferred, physical, mpolMoveFlag) == 0;
+#else
+	return false; // committed pages cannot be moved between nodes
+#endif
+}
+
+int util::numa::NodeOf(const void* p)
+{
+#ifdef _WIN32
+	PSAPI_WORKING_SET_EX_INFORMATION info{};
+	info.VirtualAddress = const_cast<void*>(p);
+	if (!QueryWorkingSetEx(GetCurrentProcess(), &info, sizeof(info)) || !info.VirtualAttributes.Valid)
+	{
+		return -1;
+	}
+	return (int)info.VirtualAttributes.Node;
+#elif defined(__linux__)
+	// move_pages without target nodes only reports where each page is, or a negative errno if it is not mapped yet
+	void* page = (void*)((size_t)p & ~(PageSize() - 1));
+	int status = -1;
+	if (syscall(SYS_move_pages, 0, 1, &page, nullptr, &status, 0) != 0)
+	{
+		return -1;
+	}
+	return status < 0 ? -1 : status;
+#else
+	return -1;
+#endif
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include "Memory.h"
+#include <vector>
+#include <string>
+
+namespace util
+{
+	// NUMA topology, thread pinning and node-local memory
+	// every call degrades to a single node holding all CPUs where the OS has no NUMA support
+	namespace numa
+	{
+		struct Node
+		{
+			size_t id = 0; // index in Topology::nodes
+			size_t physical = 0; // number of the OS node whose memory backs this one, what the memory calls below take
+			std::vector<size_t> cpus;
+			size_t memoryBytes = 0;
+		};
+
+		struct Topology
+		{
+			std::vector<Node> nodes; // never empty
+			bool emulated = false;
+
+			size_t NodeOfCpu(size_t cpu) const; // 0 for CPUs that belong to no node
+			size_t GetCpuCount() const;
+		};
+
+		// reads /sys/devices/system/node, one node with every CPU if it is missing
+		Topology Discover(const std::string& root = "/sys/devices/system/node");
+		// splits the CPUs of topology into n nodes backed by its real nodes in turn, to try NUMA layouts on a machine
+		// without them, nodes share CPUs when there are fewer CPUs than nodes
+		Topology Emulate(const Topology& topology, size_t n);
+
+		std::vector<size_t> ParseCpuList(const std::string& list); // sysfs cpulist syntax, e.g. "0-3,8,10-11"
+
+		enum class PIN_POLICY
+		{
+			NONE, // leave placement to the OS
+			COMPACT, // fill the CPUs of node 0, then node 1, ...
+			SCATTER // round-robin over the nodes, so the threads spread over every memory controller
+		};
+
+		// the CPU for each of threads threads, -1 for NONE, wraps around when there are more threads than CPUs
+		std::vector<int> AssignCpus(const Topology& topology, size_t threads, PIN_POLICY policy);
+		bool PinThread(int cpu); // the calling thread, false if the OS refused or cpu is -1
+		int CurrentCpu(); // -1 if unknown
+		size_t CurrentNode(const Topology& topology);
+
+		// whole pages bound to one node, put a Pool in front of it for small blocks
+		class NodeResource : public std::pmr::memory_resource
+		{
+		public:
+			NodeResource(size_t physical);
+		private:
+			void* do_allocate(size_t bytes, size_t alignment) override;
+			void do_deallocate(void* p, size_t bytes, size_t alignment) override;
+			bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override;
+		private:
+			size_t physical;
+		};
+
+		NodeResource& NodeMemory(size_t physical); // never destroyed, like GlobalPool
+		math::mem::Pool& NodePool(size_t physical);
+
+		// moves the whole pages inside [p, p + bytes) to a node, the partial pages at either end stay where they are
+		// the range is left with a preferred policy for the node, not bound to it
+		bool Migrate(const void* p, size_t bytes, size_t physical);
+		int NodeOf(const void* p); // node of the page holding p, -1 if unknown or not yet touched
+	}
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <thread>
+#include <vector>
+#include <algorithm>
+
+namespace util
+{
+	inline size_t HardwareThreads()
+	{
+		return std::max<size_t>(1, std::thread::hardware_concurrency());
+	}
+
+	// splits [0, n) into chunks of at least grain items and runs f(begin, end) for each chunk on its own thread
+	// the calling thread takes the first chunk, a range below 2 * grain runs inline
+	template<typename F>
+	inline void ParallelFor(size_t n, size_t grain, F&& f, size_t threads = HardwareThreads())
+	{
+		size_t chunks = std::min(threads, std::max<size_t>(1, n / std::max<size_t>(1, grain)));
+		if (chunks <= 1)
+		{
+			f((size_t)0, n);
+			return;
+		}
+
+		std::vector<std::thread> workers;
+		workers.reserve(chunks - 1);
+		for (size_t c = 1; c < chunks; c++)
+		{
+			workers.emplace_back([&f, c, n, chunks] { f(n * c / chunks, n * (c + 1) / chunks); });
+		}
+		f((size_t)0, n / chunks);
+		for (std::thread& worker : workers)
+		{
+			worker.join();
+		}
+	}
+}
@@ -0,0 +1,117 @@
+#include "ParameterSlab.h"
+#include <cstring>
+
+size_t net::ParameterSlab::Padded(size_t n)
+{
+	constexpr size_t line = math::mem::matrixAlign / sizeof(double);
+	return (n + line - 1) / line * line;
+}
+
+void net::ParameterSlab::Layout(const std::vector<size_t>& layer_c, const std::vector<bool>& include)
+{
+	weightOffsets.assign(layer_c.size(), 0);
+	biasOffsets.assign(layer_c.size(), 0);
+	layerSizes.assign(layer_c.size(), 0);
+
+	size_t size = 0;
+	for (size_t i = 1; i < layer_c.size(); i++)
+	{
+		weightOffsets[i] = size;
+		biasOffsets[i] = size;
+		if (!include.empty() && !include[i])
+		{
+			continue;
+		}
+		size += Padded(layer_c[i - 1] * layer_c[i]);
+		biasOffsets[i] = size;
+		size += Padded(layer_c[i]);
+		layerSizes[i] = size - weightOffsets[i];
+	}
+
+	// never inline, layers keep pointers into the slab and an inline buffer would move with it
+	size = std::max<size_t>(size, MATRIX_INLINE_SIZE + 1);
+
+	// the slab lives as long as the network, so never let it come from a batch arena
+	math::mem::ScopedResource scope{ &math::mem::GlobalPool() };
+	data = math::DMatrix{};
+	data = math::DMatrix{ 1, size };
+}
+
+double* net::ParameterSlab::GetWeights(size_t layer_i)
+{
+	return data.GetData() + weightOffsets[layer_i];
+}
+
+double* net::ParameterSlab::GetBiases(size_t layer_i)
+{
+	return data.GetData() + biasOffsets[layer_i];
+}
+
+double* net::ParameterSlab::GetData()
+{
+	return data.GetData();
+}
+
+const double* net::ParameterSlab::GetData() const
+{
+	return data.GetData();
+}
+
+size_t net::ParameterSlab::GetSize() const
+{
+	return data.GetSize();
+}
+
+size_t net::ParameterSlab::GetLayerSize(size_t layer_i) const
+{
+	return layerSizes[layer_i];
+}
+
+void net::ParameterSlab::Zero()
+{
+	std::memset(data.GetData(), 0, data.GetSize() * sizeof(double));
+}
+
+void net::ParameterSlab::CopyFrom(const ParameterSlab& other)
+{
+	assert(other.GetSize() == GetSize());
+	std::memcpy(data.GetData(), other.data.GetData(), GetSize() * sizeof(double));
+}
+
+void net::ParameterSlab::Axpy(double alpha, const ParameterSlab& x)
+{
+	assert(x.GetSize() == GetSize());
+	double* __restrict y = data.GetData();
+	const double* __restrict v = x.data.GetData();
+	const size_t n = GetSize();
+	for (size_t i = 0; i < n; i++)
+	{
+		y[i] += alpha * v[i];
+	}
+}
+
+void net::ParameterSlab::Axpy(double alpha, const ParameterSlab& x, size_t layer_i)
+{
+	assert(x.GetLayerSize(layer_i) == GetLayerSize(layer_i));
+	double* __restrict y = data.GetData() + weightOffsets[layer_i];
+	const double* __restrict v = x.data.GetData() + x.weightOffsets[layer_i];
+	const size_t n = GetLayerSize(layer_i);
+	for (size_t i = 0; i < n; i++)
+	{
+		y[i] += alpha * v[i];
+	}
+}
+
+uint64_t net::ParameterSlab::Checksum() const
+{
+	// FNV-1a over 64-bit words
+	uint64_t h = 14695981039346656037ull;
+	const double* values = data.GetData();
+	for (size_t i = 0; i < GetSize(); i++)
+	{
+		uint64_t bits;
+		std::memcpy(&bits, values + i, sizeof(bits));
+		h = (h ^ bits) * 1099511628211ull;
+	}
+	return h;
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include "Matrix.h"
+#include <vector>
+
+namespace net
+{
+	// every layer's weights and biases, or their gradients, in one 64-byte aligned buffer
+	// layer i holds weights then biases, each block padded to a cache line so no two blocks share one
+	// the padding stays zero, so whole-slab passes may run over it freely
+	class ParameterSlab
+	{
+	public:
+		// reallocates for these layer sizes and zeroes everything, layers with include[i] false get no space
+		void Layout(const std::vector<size_t>& layer_c, const std::vector<bool>& include = {});
+	public:
+		double* GetWeights(size_t layer_i);
+		double* GetBiases(size_t layer_i);
+
+		double* GetData();
+		const double* GetData() const;
+		size_t GetSize() const; // including padding
+		size_t GetLayerSize(size_t layer_i) const; // weights, padding and biases of one layer, 0 if it was left out
+	public:
+		void Zero();
+		void CopyFrom(const ParameterSlab& other); // other must have the same layout
+		void Axpy(double alpha, const ParameterSlab& x); // this += alpha * x
+		void Axpy(double alpha, const ParameterSlab& x, size_t layer_i); // only layer i, the slabs may be laid out differently elsewhere
+		uint64_t Checksum() const; // of the raw bits, equal slabs give equal checksums
+
+		static size_t Padded(size_t n); // n rounded up to whole cache lines of doubles
+	private:
+		math::DMatrix data;
+		std::vector<size_t> weightOffsets;
+		std::vector<size_t> biasOffsets;
+		std::vector<size_t> layerSizes;
+	};
+}
@@ -0,0 +1,374 @@
+#include "Pipeline.h"
+#include <thread>
+#include <chrono>
+#include <iomanip>
+
+namespace
+{
+	double Seconds(std::chrono::steady_clock::time_point start)
+	{
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+}
+
+double net::PipelineStats::Utilization(size_t stage) const
+{
+	return wallSeconds == 0.0 ? 0.0 : busySeconds[stage] / wallSeconds;
+}
+
+double net::PipelineStats::Bubble() const
+{
+	if (busySeconds.empty() || wallSeconds == 0.0)
+	{
+		return 0.0;
+	}
+	double busy = 0.0;
+	for (double b : busySeconds)
+	{
+		busy += b;
+	}
+	return 1.0 - busy / (wallSeconds * busySeconds.size());
+}
+
+net::Pipeline::Pipeline(Network& network, size_t stages, PIPELINE_SCHEDULE schedule)
+	: Pipeline(network, Balance(network.GetLayerSizes(), stages), schedule)
+{
+}
+
+net::Pipeline::Pipeline(Network& network, std::vector<size_t> boundaries, PIPELINE_SCHEDULE schedule)
+	: network(network), boundaries(boundaries), schedule(schedule)
+{
+	assert(boundaries.size() >= 2 && boundaries.front() == 1 && boundaries.back() == network.GetLayerSizes().size());
+	size_t stages = boundaries.size() - 1;
+	stats.busySeconds.assign(stages, 0.0);
+	stats.peakStash.assign(stages, 0);
+}
+
+std::vector<size_t> net::Pipeline::Balance(const std::vector<size_t>& layer_c, size_t stages)
+{
+	// contiguous groups with roughly the same number of weights, every stage gets at least one layer
+	size_t n_layers = layer_c.size();
+	stages = std::max<size_t>(1, std::min(stages, n_layers - 1));
+
+	size_t total = 0;
+	for (size_t i = 1; i < n_layers; i++)
+	{
+		total += layer_c[i - 1] * layer_c[i];
+	}
+
+	std::vector<size_t> bounds{ 1 };
+	size_t acc = 0;
+	for (size_t i = 1; i < n_layers && bounds.size() < stages; i++)
+	{
+		acc += layer_c[i - 1] * layer_c[i];
+		size_t remainingLayers = n_layers - 1 - i;
+		size_t remainingStages = stages - bounds.size();
+		if (acc * stages >= total * bounds.size() || remainingLayers == remainingStages)
+		{
+			bounds.push_back(i + 1);
+		}
+	}
+	bounds.push_back(n_layers);
+	return bounds;
+}
+
+bool net::Pipeline::NeedsBackward(size_t s) const
+{
+	// stages entirely below the lowest trainable layer never see a gradient
+	return boundaries[s + 1] - 1 >= network.lowestTrainable;
+}
+
+math::DMatrix net::Pipeline::Apply(const actf::Activation& activation, const math::DMatrix& nodes, bool derivative) const
+{
+	if (activation.GetType() != actf::ACTIVATION_TYPE::SOFTMAX)
+	{
+		return derivative ? activation.Derivative(nodes) : activation.Activate(nodes);
+	}
+
+	// softmax normalizes over a whole matrix, so every sample gets its own call
+	math::DMatrix res{ nodes.GetRows(), nodes.GetColumns() };
+	math::DMatrix row{ 1, nodes.GetColumns() };
+	for (size_t r = 0; r < nodes.GetRows(); r++)
+	{
+		math::Copy<double>(row, math::ConstDMatrixView{ nodes }.Row(r));
+		math::DMatrix values = derivative ? activation.Derivative(row) : activation.Activate(row);
+		math::Copy<double>(math::DMatrixView{ res }.Row(r), values);
+	}
+	return res;
+}
+
+void net::Pipeline::Forward(size_t s, size_t m, math::DMatrix input, Stash& stash)
+{
+	const size_t first = boundaries[s], last = boundaries[s + 1];
+	const size_t rows = input.GetRows();
+	stash.weighted.resize(last - first);
+	stash.outputs.resize(last - first + 1);
+	stash.outputs[0] = std::move(input);
+
+	for (size_t i = first; i < last; i++)
+	{
+		size_t j = i - first;
+		const Layer& layer = network.layers[i];
+		const actf::Activation& activation = i == network.n_layers - 1 ? *network.outputActiv : *network.hiddenActiv;
+
+		// the biases go into every row first and the product is accumulated on top, as in Layer::Forward
+		math::DMatrix& weighted = stash.weighted[j];
+		weighted = math::DMatrix{ rows, layer.GetBiases().GetColumns() };
+		for (size_t r = 0; r < rows; r++)
+		{
+			math::Copy<double>(math::DMatrixView{ weighted }.Row(r), layer.GetBiases());
+		}
+		math::Gemm<double>(weighted, stash.outputs[j], layer.GetWeights(), 1.0, 1.0);
+		stash.outputs[j + 1] = Apply(activation, weighted, false);
+	}
+
+	if (s + 1 < boundaries.size() - 1)
+	{
+		Message message{ m, stash.outputs.back() };
+		forwardQueues[s]->Push(std::move(message));
+	}
+}
+
+void net::Pipeline::Backward(size_t s, size_t m, math::DMatrix nodeValues, Stash& stash, std::vector<util::DataPoint<double>>& batch, const std::vector<size_t>& rows)
+{
+	const size_t first = boundaries[s], last = boundaries[s + 1];
+	const size_t top = last - 1 - first;
+
+	if (last == network.n_layers)
+	{
+		// output layer: activation derivative hadamard cost derivative, one sample per row
+		const math::DMatrix& outputs = stash.outputs.back();
+		nodeValues = Apply(*network.outputActiv, stash.weighted[top], true);
+		for (size_t r = 0; r < outputs.GetRows(); r++)
+		{
+			util::DataPoint<double>& dp = batch[rows[m] + r];
+			dp.output.Resize(1, outputs.GetColumns());
+			math::Copy<double>(dp.output, math::ConstDMatrixView{ outputs }.Row(r));
+			math::DMatrix costDerivative = network.cost->Derivative(dp);
+			for (size_t c = 0; c < outputs.GetColumns(); c++)
+			{
+				nodeValues(r, c) *= costDerivative[c];
+			}
+		}
+	}
+	else
+	{
+		nodeValues = nodeValues.Hadamard(Apply(*network.hiddenActiv, stash.weighted[top], true));
+	}
+
+	for (size_t i = last - 1; i >= first && i >= network.lowestTrainable; --i)
+	{
+		size_t j = i - first;
+		if (network.trainable[i])
+		{
+			// summed over the rows in sample order, the same order Network::Learn adds them in
+			math::Gemm<double>(network.weight_grad[i], math::ConstDMatrixView{ stash.outputs[j] }.Transposed(), nodeValues, 1.0, 1.0);
+			math::Copy<double>(network.bias_grad[i], math::ConstDMatrixView{ nodeValues }.Row(nodeValues.GetRows() - 1)); // the last sample's, as in Network
+		}
+
+		if (i - 1 < network.lowestTrainable)
+		{
+			break;
+		}
+
+		const math::DMatrix& weights = network.layers[i].GetWeights();
+		math::DMatrix propagated{ nodeValues.GetRows(), weights.GetRows() };
+		math::Gemm<double>(propagated, nodeValues, math::ConstDMatrixView{ weights }.Transposed());
+
+		if (j == 0)
+		{
+			backwardQueues[s - 1]->Push(Message{ m, std::move(propagated) });
+			break;
+		}
+		nodeValues = propagated.Hadamard(Apply(*network.hiddenActiv, stash.weighted[j - 1], true));
+	}
+	stash = Stash{};
+}
+
+void net::Pipeline::RunStage(size_t s, std::vector<util::DataPoint<double>>& batch, const std::vector<size_t>& rows)
+{
+	const size_t stages = boundaries.size() - 1;
+	const size_t M = rows.size() - 1;
+	const bool backward = NeedsBackward(s);
+
+	// GPipe runs every forward before any backward, 1F1B warms up with stages - s - 1 forwards and then alternates
+	std::vector<bool> ops; // true = forward
+	size_t warmup = schedule == PIPELINE_SCHEDULE::GPIPE || !backward ? M : std::min(M, stages - s - 1);
+	for (size_t m = 0; m < warmup; m++)
+	{
+		ops.push_back(true);
+	}
+	for (size_t m = warmup; m < M; m++)
+	{
+		ops.push_back(true);
+		ops.push_back(false);
+	}
+	for (size_t m = 0; m < warmup && backward; m++)
+	{
+		ops.push_back(false);
+	}
+
+	util::trace::SetThreadName("pipeline stage " + std::to_string(s));
+	if (!nodes.empty())
+	{
+		util::numa::PinThread(cpus[s]);
+	}
+	math::mem::ScopedResource scope{ nodes.empty() ? math::mem::CurrentResource() : &util::numa::NodePool(nodes[s]) };
+	std::vector<Stash> stashes(M);
+	size_t nextForward = 0, nextBackward = 0;
+	double busy = 0.0;
+	for (bool forward : ops)
+	{
+		if (forward)
+		{
+			size_t m = nextForward++;
+			math::DMatrix input;
+			if (s == 0)
+			{
+				input = math::DMatrix{ rows[m + 1] - rows[m], batch[rows[m]].input.GetSize() };
+				for (size_t r = rows[m]; r < rows[m + 1]; r++)
+				{
+					math::Copy<double>(math::DMatrixView{ input }.Row(r - rows[m]), math::ConstDMatrixView{ batch[r].input.GetData(), 1, input.GetColumns(), input.GetColumns() });
+				}
+			}
+			else
+			{
+				Message message = forwardQueues[s - 1]->Pop();
+				assert(message.micro == m);
+				input = std::move(message.values);
+			}
+
+			util::trace::Span span{ "pipeline forward", "pipeline", (int64_t)m };
+			auto start = std::chrono::steady_clock::now();
+			Forward(s, m, std::move(input), stashes[m]);
+			busy += Seconds(start);
+
+			if (!backward)
+			{
+				stashes[m] = Stash{};
+			}
+			stats.peakStash[s] = std::max(stats.peakStash[s], backward ? nextForward - nextBackward : 1);
+		}
+		else
+		{
+			size_t m = nextBackward++;
+			math::DMatrix nodeValues;
+			if (s + 1 < stages)
+			{
+				Message message = backwardQueues[s]->Pop();
+				assert(message.micro == m);
+				nodeValues = std::move(message.values);
+			}
+
+			util::trace::Span span{ "pipeline backward", "pipeline", (int64_t)m };
+			auto start = std::chrono::steady_clock::now();
+			Backward(s, m, std::move(nodeValues), stashes[m], batch, rows);
+			busy += Seconds(start);
+		}
+	}
+	stats.busySeconds[s] += busy;
+}
+
+void net::Pipeline::Learn(std::vector<util::DataPoint<double>>& batch, double learnRate, size_t microBatches)
+{
+	const size_t stages = boundaries.size() - 1;
+	microBatches = std::max<size_t>(1, std::min(microBatches, batch.size()));
+
+	// micro-batch m is rows[m] .. rows[m + 1] of the batch
+	std::vector<size_t> rows(microBatches + 1);
+	for (size_t m = 0; m <= microBatches; m++)
+	{
+		rows[m] = batch.size() * m / microBatches;
+	}
+
+	forwardQueues.clear();
+	backwardQueues.clear();
+	for (size_t s = 0; s + 1 < stages; s++)
+	{
+		forwardQueues.push_back(std::make_unique<util::SpscQueue<Message>>(microBatches));
+		backwardQueues.push_back(std::make_unique<util::SpscQueue<Message>>(microBatches));
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	if (!batch.empty())
+	{
+		// a placed pipeline never pins the calling thread, stage 0 gets a thread too
+		size_t first = nodes.empty() ? 1 : 0;
+		std::vector<std::thread> threads;
+		for (size_t s = first; s < stages; s++)
+		{
+			threads.emplace_back([this, s, &batch, &rows] { RunStage(s, batch, rows); });
+		}
+		if (first == 1)
+		{
+			RunStage(0, batch, rows);
+		}
+		for (std::thread& thread : threads)
+		{
+			thread.join();
+		}
+	}
+	network.ApplyGradients(learnRate);
+	network.ClearGradients();
+
+	stats.wallSeconds += Seconds(start);
+	stats.batches++;
+	stats.microBatches = microBatches;
+}
+
+void net::Pipeline::Place(const util::numa::Topology& topology, util::numa::PIN_POLICY policy)
+{
+	size_t stages = boundaries.size() - 1;
+	cpus = util::numa::AssignCpus(topology, stages, policy);
+	nodes.resize(stages);
+	for (size_t s = 0; s < stages; s++)
+	{
+		// unpinned stages still spread their memory over the nodes in turn
+		const util::numa::Node& node = topology.nodes[cpus[s] < 0 ? s % topology.nodes.size() : topology.NodeOfCpu(cpus[s])];
+		nodes[s] = node.physical;
+		for (size_t i = boundaries[s]; i < boundaries[s + 1]; i++)
+		{
+			util::numa::Migrate(network.parameters.GetWeights(i), network.parameters.GetLayerSize(i) * sizeof(double), nodes[s]);
+			util::numa::Migrate(network.gradients.GetWeights(i), network.gradients.GetLayerSize(i) * sizeof(double), nodes[s]);
+		}
+	}
+}
+
+const std::vector<size_t>& net::Pipeline::GetNodes() const
+{
+	return nodes;
+}
+
+const std::vector<size_t>& net::Pipeline::GetBoundaries() const
+{
+	return boundaries;
+}
+
+net::PipelineStats net::Pipeline::GetStats() const
+{
+	return stats;
+}
+
+void net::Pipeline::ClearStats()
+{
+	size_t stages = boundaries.size() - 1;
+	stats = PipelineStats{};
+	stats.busySeconds.assign(stages, 0.0);
+	stats.peakStash.assign(stages, 0);
+}
+
+void net::Pipeline::Report(std::ostream& out) const
+{
+	size_t stages = boundaries.size() - 1;
+	double ideal = stats.microBatches == 0 ? 0.0 : (double)(stages - 1) / (stats.microBatches + stages - 1);
+	out << stages << " stages, " << stats.microBatches << " micro-batches, "
+		<< (schedule == PIPELINE_SCHEDULE::GPIPE ? "GPipe" : "1F1B") << ", " << stats.batches << " batches in " << stats.wallSeconds << "s\n";
+	for (size_t s = 0; s < stages; s++)
+	{
+		out << "  stage " << s << " layers " << boundaries[s] << "-" << boundaries[s + 1] - 1 << ": utilization "
+			<< std::setw(6) << std::fixed << std::setprecision(1) << stats.Utilization(s) * 100.0 << std::defaultfloat << std::setprecision(6)
+			<< "%, peak stash " << stats.peakStash[s] << '\n';
+	}
+	out << "  bubble " << std::fixed << std::setprecision(1) << stats.Bubble() * 100.0 << "% (schedule bound " << ideal * 100.0 << "%)"
+		<< std::defaultfloat << std::setprecision(6) << '\n';
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include "Network.h"
+#include "SpscQueue.h"
+#include "Numa.h"
+#include <ostream>
+
+namespace net
+{
+	enum class PIPELINE_SCHEDULE
+	{
+		GPIPE, // every micro-batch forward, then every micro-batch backward, all activations stashed at once
+		ONE_F_ONE_B // after a short warm-up each stage alternates forward and backward, at most stages - s micro-batches stashed
+	};
+
+	struct PipelineStats
+	{
+		std::vector<double> busySeconds; // per stage, time spent computing
+		std::vector<size_t> peakStash; // per stage, most micro-batches whose activations were held at once
+		double wallSeconds = 0.0;
+		size_t batches = 0;
+		size_t microBatches = 0; // per batch
+
+		double Utilization(size_t stage) const; // busy time over wall time
+		double Bubble() const; // idle fraction over all stages
+	};
+
+	// pipeline-parallel training, each stage owns a contiguous group of layers and runs on its own thread
+	// micro-batches travel forward and backward between neighbouring stages through SPSC queues, the gradients
+	// are applied once per batch so the result is the same as Network::Learn on the whole batch up to rounding:
+	// the node values go back through the transposed weights as whole micro-batches, a tuned config for that Gemm shape
+	// can use other Dot lanes than the one Network looks up for a single row
+	class Pipeline
+	{
+	public:
+		Pipeline(Network& network, size_t stages, PIPELINE_SCHEDULE schedule = PIPELINE_SCHEDULE::ONE_F_ONE_B); // balances the weights per stage
+		Pipeline(Network& network, std::vector<size_t> boundaries, PIPELINE_SCHEDULE schedule = PIPELINE_SCHEDULE::ONE_F_ONE_B); // first layer of every stage
+	public:
+		void Learn(std::vector<util::DataPoint<double>>& batch, double learnRate, size_t microBatches);
+
+		// pins stage s to the s-th CPU of policy and keeps its memory on that CPU's node: the weights and gradients
+		// of its layers move there and its micro-batch matrices come from the node's pool
+		// every stage then runs on a thread of its own, call again after changing which layers are trainable
+		void Place(const util::numa::Topology& topology, util::numa::PIN_POLICY policy);
+		const std::vector<size_t>& GetNodes() const; // physical node per stage, empty unless placed
+
+		const std::vector<size_t>& GetBoundaries() const;
+		PipelineStats GetStats() const;
+		void ClearStats();
+		void Report(std::ostream& out) const;
+	private:
+		struct Message
+		{
+			size_t micro = 0;
+			math::DMatrix values; // one row per sample
+		};
+
+		// activations of one micro-batch kept for its backward pass, outputs[0] is the stage input
+		struct Stash
+		{
+			std::vector<math::DMatrix> weighted;
+			std::vector<math::DMatrix> outputs;
+		};
+
+		static std::vector<size_t> Balance(const std::vector<size_t>& layer_c, size_t stages);
+
+		void RunStage(size_t s, std::vector<util::DataPoint<double>>& batch, const std::vector<size_t>& rows);
+		void Forward(size_t s, size_t m, math::DMatrix input, Stash& stash);
+		void Backward(size_t s, size_t m, math::DMatrix nodeValues, Stash& stash, std::vector<util::DataPoint<double>>& batch, const std::vector<size_t>& rows);
+		bool NeedsBackward(size_t s) const;
+
+		math::DMatrix Apply(const actf::Activation& activation, const math::DMatrix& nodes, bool derivative) const;
+	private:
+		Network& network;
+		std::vector<size_t> boundaries; // boundaries[s] .. boundaries[s + 1] are the layers of stage s
+		PIPELINE_SCHEDULE schedule;
+
+		std::vector<int> cpus; // per stage, -1 leaves the thread unpinned
+		std::vector<size_t> nodes;
+
+		std::vector<std::unique_ptr<util::SpscQueue<Message>>> forwardQueues; // stage s to s + 1
+		std::vector<std::unique_ptr<util::SpscQueue<Message>>> backwardQueues; // stage s + 1 to s
+		PipelineStats stats;
+	};
+}
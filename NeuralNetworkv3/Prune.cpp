@@ -0,0 +1,105 @@
+#include "Prune.h"
+#include "Layer.h"
+#include "ActivationFuncs.h"
+#include "Bench.h"
+#include <vector>
+#include <numeric>
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+
+namespace
+{
+	volatile double _sink = 0.0;
+}
+
+math::DMatrix net::prune::MagnitudeMask(const math::DMatrix& weights, const PruneConfig& config)
+{
+	const size_t rows = weights.GetRows(), columns = weights.GetColumns();
+	const size_t bRows = std::max<size_t>(1, config.blockRows), bColumns = std::max<size_t>(1, config.blockColumns);
+	const size_t gridRows = (rows + bRows - 1) / bRows, gridColumns = (columns + bColumns - 1) / bColumns;
+
+	std::vector<double> scores(gridRows * gridColumns, 0.0);
+	std::vector<size_t> counts(scores.size(), 0);
+	for (size_t r = 0; r < rows; r++)
+	{
+		for (size_t c = 0; c < columns; c++)
+		{
+			size_t block = (r / bRows) * gridColumns + c / bColumns;
+			scores[block] += std::abs(weights[r * columns + c]);
+			counts[block]++;
+		}
+	}
+
+	// edge blocks may be smaller, so blocks are dropped by the number of weights they hold rather than a fixed block count
+	std::vector<size_t> order(scores.size());
+	std::iota(order.begin(), order.end(), 0);
+	std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return scores[a] < scores[b]; });
+
+	std::vector<bool> pruned(scores.size(), false);
+	size_t target = (size_t)std::llround(config.sparsity * (double)weights.GetSize());
+	size_t removed = 0;
+	for (size_t block : order)
+	{
+		// stop at whichever side of the target is closer
+		if (removed >= target || (removed + counts[block] > target && removed + counts[block] - target > target - removed))
+		{
+			break;
+		}
+		pruned[block] = true;
+		removed += counts[block];
+	}
+
+	math::DMatrix mask{ rows, columns, 1.0 };
+	for (size_t r = 0; r < rows; r++)
+	{
+		for (size_t c = 0; c < columns; c++)
+		{
+			if (pruned[(r / bRows) * gridColumns + c / bColumns])
+			{
+				mask[r * columns + c] = 0.0;
+			}
+		}
+	}
+	return mask;
+}
+
+double net::prune::MeasureCrossover(size_t inputs, size_t outputs, std::ostream* log)
+{
+	actf::Sigmoid sigmoid;
+	Layer in{ inputs };
+	Layer layer{ in, math::DMatrix{ 1, outputs }, outputs };
+	math::DMatrix input{ 1, inputs, 0.5 };
+	const math::DMatrix dense = layer.GetWeights();
+
+	size_t iterations = std::max<size_t>(10, 4000000 / (inputs * outputs));
+	const size_t repeats = 5;
+	const std::vector<double> densities{ 1.0, 0.75, 0.5, 0.3, 0.2, 0.1, 0.05, 0.02, 0.01 };
+	std::vector<bool> wins;
+	for (double density : densities)
+	{
+		layer.ClearMask();
+		layer.SetWeights(dense);
+		layer.SetMask(MagnitudeMask(dense, { 1.0 - density }));
+
+		layer.SetSparse(false);
+		double denseNs = util::bench::MedianNs([&] { _sink = _sink + layer.Forward(input, sigmoid)[0]; }, iterations, repeats);
+		layer.SetSparse(true);
+		double sparseNs = util::bench::MedianNs([&] { _sink = _sink + layer.Forward(input, sigmoid)[0]; }, iterations, repeats);
+
+		wins.push_back(sparseNs < denseNs);
+		if (log)
+		{
+			*log << inputs << "x" << outputs << " density " << std::setw(5) << density << ": dense " << std::setw(10) << denseNs
+				<< " ns, sparse " << std::setw(10) << sparseNs << " ns" << (wins.back() ? " *" : "") << '\n';
+		}
+	}
+
+	// a lone win above a loss is noise, the crossover is where sparse starts winning and keeps winning as density drops
+	double crossover = 0.0;
+	for (size_t i = densities.size(); i-- > 0 && wins[i];)
+	{
+		crossover = densities[i];
+	}
+	return crossover;
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include "Matrix.h"
+#include <ostream>
+
+namespace net
+{
+	namespace prune
+	{
+		struct PruneConfig
+		{
+			double sparsity = 0.5; // fraction of each layer's weights set to zero
+			size_t blockRows = 1; // 1x1 blocks prune single weights, larger blocks remove whole tiles
+			size_t blockColumns = 1;
+		};
+
+		// 1 for kept weights, 0 for the pruned ones
+		// blocks are ranked by the sum of their absolute weights and the smallest ones are dropped until the target sparsity is reached
+		math::DMatrix MagnitudeMask(const math::DMatrix& weights, const PruneConfig& config);
+
+		// times dense and sparse Layer::Forward for an inputs x outputs layer at decreasing densities
+		// by the median of several runs and returns the highest density from which on the sparse kernel is faster
+		// at every lower density, 0 if it is not faster even at the lowest
+		double MeasureCrossover(size_t inputs, size_t outputs, std::ostream* log = nullptr);
+	}
+}
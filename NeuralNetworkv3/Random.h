@@ -0,0 +1,136 @@
+#pragma once
+
+#include <cstdint>
+#include <array>
+#include <limits>
+#include <atomic>
+#include "Parallel.h"
+
+namespace util
+{
+	// Philox4x32-10 counter-based generator (Salmon et al., "Parallel random numbers: as easy as 1, 2, 3")
+	// every output is a pure function of (seed, stream, position), so streams never overlap and any element
+	// of a stream can be computed directly, which makes parallel fills independent of the thread count
+	class Philox
+	{
+	public:
+		typedef uint32_t result_type;
+
+		Philox(uint64_t seed, uint64_t stream = 0);
+	public:
+		result_type operator()();
+
+		void Seek(uint64_t position); // position counts 32-bit outputs from the start of the stream
+		Philox Split(uint64_t stream) const; // same seed, different stream
+
+		// uniform double in [0, 1) for element index of the stream, does not touch the sequential position
+		double Canonical(uint64_t index) const;
+
+		static constexpr result_type min() { return 0; }
+		static constexpr result_type max() { return std::numeric_limits<result_type>::max(); }
+
+		static std::array<uint32_t, 4> Block(std::array<uint32_t, 4> counter, std::array<uint32_t, 2> key);
+	private:
+		std::array<uint32_t, 4> Counter(uint64_t block) const;
+	private:
+		uint64_t seed;
+		uint64_t stream;
+		uint64_t position = 0;
+		std::array<uint32_t, 4> buffer{};
+	};
+
+	// mixes a stream id so neighbouring ids (layer 1, layer 2, ...) end up in unrelated streams
+	inline uint64_t StreamId(uint64_t domain, uint64_t index)
+	{
+		uint64_t x = domain * 0x9E3779B97F4A7C15ull + index;
+		x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+		x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+		return x ^ (x >> 31);
+	}
+
+	enum STREAM_DOMAIN : uint64_t
+	{
+		STREAM_THREAD = 1,
+		STREAM_LAYER = 2,
+		STREAM_SHUFFLE = 3,
+		STREAM_DATA = 4
+	};
+
+	inline Philox::Philox(uint64_t seed, uint64_t stream)
+		: seed(seed), stream(stream)
+	{}
+
+	inline std::array<uint32_t, 4> Philox::Block(std::array<uint32_t, 4> c, std::array<uint32_t, 2> k)
+	{
+		for (int round = 0; round < 10; round++)
+		{
+			uint64_t p0 = (uint64_t)0xD2511F53u * c[0];
+			uint64_t p1 = (uint64_t)0xCD9E8D57u * c[2];
+			c = { (uint32_t)(p1 >> 32) ^ c[1] ^ k[0], (uint32_t)p1, (uint32_t)(p0 >> 32) ^ c[3] ^ k[1], (uint32_t)p0 };
+			k[0] += 0x9E3779B9u;
+			k[1] += 0xBB67AE85u;
+		}
+		return c;
+	}
+
+	inline std::array<uint32_t, 4> Philox::Counter(uint64_t block) const
+	{
+		return { (uint32_t)block, (uint32_t)(block >> 32), (uint32_t)stream, (uint32_t)(stream >> 32) };
+	}
+
+	inline Philox::result_type Philox::operator()()
+	{
+		if (position % 4 == 0)
+		{
+			buffer = Block(Counter(position / 4), { (uint32_t)seed, (uint32_t)(seed >> 32) });
+		}
+		return buffer[position++ % 4];
+	}
+
+	inline void Philox::Seek(uint64_t position)
+	{
+		this->position = position;
+		if (position % 4 != 0)
+		{
+			buffer = Block(Counter(position / 4), { (uint32_t)seed, (uint32_t)(seed >> 32) });
+		}
+	}
+
+	inline Philox Philox::Split(uint64_t stream) const
+	{
+		return Philox{ seed, stream };
+	}
+
+	inline double Philox::Canonical(uint64_t index) const
+	{
+		// two 32-bit words per double, a block holds two elements
+		std::array<uint32_t, 4> r = Block(Counter(index / 2), { (uint32_t)seed, (uint32_t)(seed >> 32) });
+		uint64_t bits = index % 2 == 0 ? ((uint64_t)r[0] << 32 | r[1]) : ((uint64_t)r[2] << 32 | r[3]);
+		return (bits >> 11) * (1.0 / 9007199254740992.0);
+	}
+
+	// fills out[i] with a uniform value in [min, max) * scale taken from element i of the stream,
+	// the result is the same for any number of threads
+	inline void FillUniform(double* out, size_t n, double min, double max, const Philox& gen, double scale = 1.0)
+	{
+		ParallelFor(n, 1 << 16, [&](size_t begin, size_t end) {
+			for (size_t i = begin; i < end; i++)
+			{
+				out[i] = (min + (max - min) * gen.Canonical(i)) * scale;
+			}
+		});
+	}
+
+	// stream of the weights of one layer, network 0 layer i is the stream an Ensemble member uses for layer i
+	inline uint64_t LayerStream(uint64_t network, size_t layer)
+	{
+		return StreamId(STREAM_LAYER, network << 20 | layer);
+	}
+
+	// process-wide stream ids handed out in order of first use, deterministic as long as the calling order is
+	inline uint64_t NextStream(uint64_t domain)
+	{
+		static std::atomic<uint64_t> counters[8]{};
+		return StreamId(domain, counters[domain % 8]++);
+	}
+}
@@ -0,0 +1,84 @@
+#include "Rcu.h"
+#include <atomic>
+#include <thread>
+#include <stdexcept>
+#include <string>
+
+namespace
+{
+	// each reader thread owns one slot, on its own cache line so readers never contend
+	struct alignas(64) Slot
+	{
+		std::atomic<uint64_t> epoch{ 0 }; // epoch the current read section started in, 0 outside read sections
+		std::atomic<bool> used{ false };
+	};
+
+	Slot _slots[util::rcu::maxReaders];
+	std::atomic<uint64_t> _epoch{ 1 };
+
+	struct ThreadSlot
+	{
+		Slot* slot = nullptr;
+		size_t depth = 0;
+
+		~ThreadSlot()
+		{
+			if (slot)
+			{
+				slot->used.store(false, std::memory_order_release);
+			}
+		}
+
+		Slot& Get()
+		{
+			if (slot)
+			{
+				return *slot;
+			}
+			for (Slot& s : _slots)
+			{
+				bool expected = false;
+				if (s.used.compare_exchange_strong(expected, true, std::memory_order_acq_rel))
+				{
+					slot = &s;
+					return s;
+				}
+			}
+			throw std::runtime_error("util::rcu: more than " + std::to_string(util::rcu::maxReaders) + " live threads have entered read sections");
+		}
+	};
+
+	thread_local ThreadSlot _thread;
+}
+
+util::rcu::ReadGuard::ReadGuard()
+{
+	Slot& slot = _thread.Get();
+	if (_thread.depth++ == 0)
+	{
+		// sequentially consistent, so either Synchronize sees this section or the reader sees the writer's new pointer
+		slot.epoch.store(_epoch.load());
+	}
+}
+
+util::rcu::ReadGuard::~ReadGuard()
+{
+	if (--_thread.depth == 0)
+	{
+		_thread.slot->epoch.store(0, std::memory_order_release);
+	}
+}
+
+void util::rcu::Synchronize()
+{
+	// sections starting from now see the new epoch and whatever was published before it, only older ones are waited for
+	uint64_t target = _epoch.fetch_add(1) + 1;
+	for (Slot& slot : _slots)
+	{
+		uint64_t epoch;
+		while ((epoch = slot.epoch.load()) != 0 && epoch < target)
+		{
+			std::this_thread::yield();
+		}
+	}
+}
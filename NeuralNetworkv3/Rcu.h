@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+namespace util
+{
+	// epoch-based read-copy-update: read sections take no lock, a writer publishes a new pointer, calls Synchronize
+	// and can free the old object once it returns
+	namespace rcu
+	{
+		// live threads that have ever entered a read section, a thread keeps its slot until it exits
+		// so a pool of more threads than this cannot read even if only a few of them do so at once
+		constexpr size_t maxReaders = 256;
+
+		// marks a read section on this thread, costs one store on entry and one on exit, sections may nest
+		// throws std::runtime_error on a thread's first section if maxReaders other live threads already hold slots
+		class ReadGuard
+		{
+		public:
+			ReadGuard();
+			~ReadGuard();
+
+			ReadGuard(const ReadGuard&) = delete;
+			ReadGuard& operator=(const ReadGuard&) = delete;
+		};
+
+		// blocks until every read section that was active when it was called has ended
+		void Synchronize();
+	}
+}
@@ -0,0 +1,99 @@
+#include "Replicas.h"
+#include "ActivationFuncs.h"
+#include "Rcu.h"
+#include <thread>
+
+net::Replicas::Replicas(const Network& source, const util::numa::Topology& topology)
+	: topology(topology)
+{
+	for (const util::numa::Node& node : topology.nodes)
+	{
+		for (size_t cpu : node.cpus)
+		{
+			if (cpu >= nodeOfCpu.size())
+			{
+				nodeOfCpu.resize(cpu + 1, 0);
+			}
+			nodeOfCpu[cpu] = topology.NodeOfCpu(cpu); // emulated nodes may share a CPU, the first one wins
+		}
+	}
+	current.store(BuildSet(source, 1));
+}
+
+net::Replicas::~Replicas()
+{
+	delete current.load();
+}
+
+std::unique_ptr<net::Network> net::Replicas::Build(const Snapshot& snapshot, const util::numa::Node& node) const
+{
+	// built on a thread pinned to the node, so even the pages the OS places by first touch land there
+	std::unique_ptr<Network> replica;
+	std::thread builder{ [&] {
+		if (!node.cpus.empty())
+		{
+			util::numa::PinThread((int)node.cpus.front());
+		}
+		math::mem::ScopedResource scope{ &util::numa::NodePool(node.physical) };
+		replica = std::make_unique<Network>(snapshot.layer_c, nullptr, actf::GetActivation(snapshot.hiddenType), actf::GetActivation(snapshot.outputType));
+		replica->BindToNode((int)node.physical);
+		replica->Restore(snapshot);
+	} };
+	builder.join();
+	return replica;
+}
+
+net::Replicas::Set* net::Replicas::BuildSet(const Network& source, uint64_t generation) const
+{
+	Snapshot snapshot;
+	source.TakeSnapshot(snapshot);
+
+	Set* set = new Set{ {}, generation };
+	for (const util::numa::Node& node : topology.nodes)
+	{
+		set->replicas.push_back(Build(snapshot, node));
+	}
+	return set;
+}
+
+math::DMatrix net::Replicas::Infer(math::ConstDMatrixView input) const
+{
+	int cpu = util::numa::CurrentCpu();
+	return Infer(input, cpu >= 0 && (size_t)cpu < nodeOfCpu.size() ? nodeOfCpu[cpu] : 0);
+}
+
+math::DMatrix net::Replicas::Infer(math::ConstDMatrixView input, size_t node) const
+{
+	util::rcu::ReadGuard guard;
+	const Set* set = current.load(); // sequentially consistent, pairs with the epoch store in ReadGuard
+	return set->replicas[node]->Infer(input);
+}
+
+void net::Replicas::Update(const Network& source)
+{
+	std::lock_guard<std::mutex> lock{ updateMtx };
+	Set* old = current.load();
+	current.store(BuildSet(source, old->generation + 1));
+
+	// every Infer that could still see the old set has returned once Synchronize does
+	util::rcu::Synchronize();
+	delete old;
+}
+
+size_t net::Replicas::GetNodeCount() const
+{
+	return topology.nodes.size();
+}
+
+int net::Replicas::GetPlacement(size_t node) const
+{
+	util::rcu::ReadGuard guard;
+	const Set* set = current.load();
+	return util::numa::NodeOf(set->replicas[node]->GetParameterSlab().GetData());
+}
+
+uint64_t net::Replicas::GetGeneration() const
+{
+	util::rcu::ReadGuard guard;
+	return current.load()->generation;
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include "Network.h"
+#include "Numa.h"
+#include <atomic>
+#include <mutex>
+
+namespace net
+{
+	// one copy of a network per NUMA node, so inference threads read weights from their own node's memory
+	// each replica is built by a thread pinned to its node and bound there with Network::BindToNode
+	// the weights are read-mostly: Update builds a fresh set and swaps it in like ModelHandle, Infer never waits for it
+	// (its Gemm calls still take a shared lock on the tuned configs once any exist)
+	class Replicas
+	{
+	public:
+		Replicas(const Network& source, const util::numa::Topology& topology);
+		~Replicas(); // no Infer may still be running
+
+		Replicas(const Replicas&) = delete;
+		Replicas& operator=(const Replicas&) = delete;
+	public:
+		math::DMatrix Infer(math::ConstDMatrixView input) const; // on the replica of the node the calling thread runs on
+		math::DMatrix Infer(math::ConstDMatrixView input, size_t node) const; // for threads that know their node, e.g. pinned ones
+
+		void Update(const Network& source); // copies source's parameters into a new set of replicas
+
+		size_t GetNodeCount() const;
+		int GetPlacement(size_t node) const; // node the replica's first weights actually live on, -1 if unknown
+		uint64_t GetGeneration() const; // 1 after construction, +1 per Update
+	private:
+		struct Set
+		{
+			std::vector<std::unique_ptr<Network>> replicas; // by node id
+			uint64_t generation;
+		};
+
+		std::unique_ptr<Network> Build(const Snapshot& snapshot, const util::numa::Node& node) const;
+		Set* BuildSet(const Network& source, uint64_t generation) const;
+	private:
+		util::numa::Topology topology;
+		std::vector<size_t> nodeOfCpu;
+
+		std::atomic<Set*> current{ nullptr };
+		std::mutex updateMtx; // one writer at a time
+	};
+}
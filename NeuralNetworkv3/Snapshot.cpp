@@ -0,0 +1,24 @@
+#include "Snapshot.h"
+#include "ActivationFuncs.h"
+#include "ModelIO.h"
+
+math::DMatrix net::Snapshot::Feed(math::ConstDMatrixView input) const
+{
+	std::unique_ptr<actf::Activation> hiddenActiv = actf::GetActivation(hiddenType);
+	std::unique_ptr<actf::Activation> outputActiv = actf::GetActivation(outputType);
+
+	math::DMatrix values{ input.GetRows(), input.GetColumns() };
+	math::Copy<double>(values, input);
+	for (size_t i = 1; i < weights.size(); i++)
+	{
+		math::DMatrix weighted = biases[i];
+		math::Gemm<double>(weighted, values, weights[i], 1.0, 1.0);
+		values = (i == weights.size() - 1 ? outputActiv : hiddenActiv)->Activate(weighted);
+	}
+	return values;
+}
+
+void net::Snapshot::Save(std::string path, bool sparse) const
+{
+	io::Write(*this, path, sparse);
+}
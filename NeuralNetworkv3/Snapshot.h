@@ -0,0 +1,26 @@
+#pragma once
+
+#include "Matrix.h"
+#include "Activation.h"
+#include <vector>
+#include <string>
+
+namespace net
+{
+	// point-in-time copy of a network's parameters, detached from the network so another thread can read it
+	struct Snapshot
+	{
+		math::DMatrix Feed(math::ConstDMatrixView input) const; // forward pass on the copied weights, safe to run beside training
+		void Save(std::string path, bool sparse = false) const;
+
+		std::vector<size_t> layer_c;
+		actf::ACTIVATION_TYPE hiddenType = actf::ACTIVATION_TYPE::SIGMOID;
+		actf::ACTIVATION_TYPE outputType = actf::ACTIVATION_TYPE::SIGMOID;
+
+		// index 0 is the input layer and has no parameters
+		std::vector<math::DMatrix> weights;
+		std::vector<math::DMatrix> biases;
+
+		size_t step = 0;
+	};
+}
@@ -0,0 +1,166 @@
+#pragma once
+
+#include "Matrix.h"
+#include <vector>
+#include <cstdint>
+
+namespace math
+{
+	// compressed sparse rows: the non-zeros of row r are values[offsets[r]..offsets[r + 1]) in columns indices[...]
+	template<typename T>
+	class SparseMatrix
+	{
+	public:
+		SparseMatrix();
+		explicit SparseMatrix(const Matrix<T>& dense);
+	public:
+		void Assign(const Matrix<T>& dense); // keeps the exact zeros out, reuses the storage of the previous contents
+		void Assign(size_t rows, size_t columns, std::vector<size_t> offsets, std::vector<uint32_t> indices, std::vector<T> values);
+		Matrix<T> ToDense() const;
+	public:
+		size_t GetRows() const;
+		size_t GetColumns() const;
+		size_t GetNonZeros() const;
+		double GetDensity() const;
+
+		const std::vector<size_t>& GetOffsets() const;
+		const std::vector<uint32_t>& GetIndices() const;
+		const std::vector<T>& GetValues() const;
+	private:
+		size_t rows = 0;
+		size_t columns = 0;
+		std::vector<size_t> offsets;
+		std::vector<uint32_t> indices;
+		std::vector<T> values;
+	};
+
+	typedef SparseMatrix<double> DSparseMatrix;
+
+	// C += alpha * A * B for a sparse B, each non-zero of row k of B is scaled by A(i, k) and added to row i of C,
+	// the same order as the dense row-major Gemm so both give identical results
+	template<typename T>
+	inline void SpMM(MatrixView<T> C, MatrixView<const T> A, const SparseMatrix<T>& B, T alpha = 1)
+	{
+		assert(A.GetColumns() == B.GetRows() && C.GetRows() == A.GetRows() && C.GetColumns() == B.GetColumns());
+		const size_t* offsets = B.GetOffsets().data();
+		const uint32_t* indices = B.GetIndices().data();
+		const T* values = B.GetValues().data();
+
+		for (size_t i = 0; i < C.GetRows(); i++)
+		{
+			for (size_t k = 0; k < B.GetRows(); k++)
+			{
+				T a = alpha * A(i, k);
+				if (a == 0)
+				{
+					continue;
+				}
+				for (size_t n = offsets[k]; n < offsets[k + 1]; n++)
+				{
+					C(i, indices[n]) += a * values[n];
+				}
+			}
+		}
+	}
+
+	template<typename T>
+	inline math::SparseMatrix<T>::SparseMatrix()
+		: offsets(1, 0)
+	{}
+
+	template<typename T>
+	inline math::SparseMatrix<T>::SparseMatrix(const Matrix<T>& dense)
+	{
+		Assign(dense);
+	}
+
+	template<typename T>
+	inline void math::SparseMatrix<T>::Assign(const Matrix<T>& dense)
+	{
+		rows = dense.GetRows();
+		columns = dense.GetColumns();
+		offsets.assign(1, 0);
+		indices.clear();
+		values.clear();
+		for (size_t r = 0; r < rows; r++)
+		{
+			for (size_t c = 0; c < columns; c++)
+			{
+				T v = dense[r * columns + c];
+				if (v != 0)
+				{
+					indices.push_back((uint32_t)c);
+					values.push_back(v);
+				}
+			}
+			offsets.push_back(values.size());
+		}
+	}
+
+	template<typename T>
+	inline void math::SparseMatrix<T>::Assign(size_t rows, size_t columns, std::vector<size_t> offsets, std::vector<uint32_t> indices, std::vector<T> values)
+	{
+		assert(offsets.size() == rows + 1 && offsets.back() == values.size() && indices.size() == values.size());
+		this->rows = rows;
+		this->columns = columns;
+		this->offsets = std::move(offsets);
+		this->indices = std::move(indices);
+		this->values = std::move(values);
+	}
+
+	template<typename T>
+	inline math::Matrix<T> math::SparseMatrix<T>::ToDense() const
+	{
+		Matrix<T> dense{ rows, columns };
+		for (size_t r = 0; r < rows; r++)
+		{
+			for (size_t n = offsets[r]; n < offsets[r + 1]; n++)
+			{
+				dense[r * columns + indices[n]] = values[n];
+			}
+		}
+		return dense;
+	}
+
+	template<typename T>
+	inline size_t math::SparseMatrix<T>::GetRows() const
+	{
+		return rows;
+	}
+
+	template<typename T>
+	inline size_t math::SparseMatrix<T>::GetColumns() const
+	{
+		return columns;
+	}
+
+	template<typename T>
+	inline size_t math::SparseMatrix<T>::GetNonZeros() const
+	{
+		return values.size();
+	}
+
+	template<typename T>
+	inline double math::SparseMatrix<T>::GetDensity() const
+	{
+		return rows * columns == 0 ? 0.0 : (double)values.size() / (double)(rows * columns);
+	}
+
+	template<typename T>
+	inline const std::vector<size_t>& math::SparseMatrix<T>::GetOffsets() const
+	{
+		return offsets;
+	}
+
+	template<typename T>
+	inline const std::vector<uint32_t>& math::SparseMatrix<T>::GetIndices() const
+	{
+		return indices;
+	}
+
+	template<typename T>
+	inline const std::vector<T>& math::SparseMatrix<T>::GetValues() const
+	{
+		return values;
+	}
+}
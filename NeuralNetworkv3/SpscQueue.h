@@ -0,0 +1,91 @@
+#pragma once
+
+#include <atomic>
+#include <vector>
+#include <thread>
+#include <cstddef>
+
+namespace util
+{
+	// bounded lock-free queue for exactly one producer thread and one consumer thread
+	// the producer only writes tail and the consumer only writes head, each on its own cache line
+	template<typename T>
+	class SpscQueue
+	{
+	public:
+		explicit SpscQueue(size_t capacity);
+
+		SpscQueue(const SpscQueue&) = delete;
+		SpscQueue& operator=(const SpscQueue&) = delete;
+	public:
+		bool TryPush(T& value); // moves value in if there is room
+		bool TryPop(T& value);
+
+		// spin, yielding the core, until there is room or a value
+		void Push(T value);
+		T Pop();
+	private:
+		std::vector<T> slots;
+		size_t mask;
+		alignas(64) std::atomic<size_t> head{ 0 }; // next slot to pop
+		alignas(64) std::atomic<size_t> tail{ 0 }; // next slot to push
+	};
+
+	template<typename T>
+	inline util::SpscQueue<T>::SpscQueue(size_t capacity)
+	{
+		size_t size = 2;
+		while (size < capacity)
+		{
+			size *= 2;
+		}
+		slots.resize(size);
+		mask = size - 1;
+	}
+
+	template<typename T>
+	inline bool util::SpscQueue<T>::TryPush(T& value)
+	{
+		size_t t = tail.load(std::memory_order_relaxed);
+		if (t - head.load(std::memory_order_acquire) == slots.size())
+		{
+			return false;
+		}
+		slots[t & mask] = std::move(value);
+		tail.store(t + 1, std::memory_order_release);
+		return true;
+	}
+
+	template<typename T>
+	inline bool util::SpscQueue<T>::TryPop(T& value)
+	{
+		size_t h = head.load(std::memory_order_relaxed);
+		if (h == tail.load(std::memory_order_acquire))
+		{
+			return false;
+		}
+		value = std::move(slots[h & mask]);
+		head.store(h + 1, std::memory_order_release);
+		return true;
+	}
+
+	template<typename T>
+	inline void util::SpscQueue<T>::Push(T value)
+	{
+		while (!TryPush(value))
+		{
+			std::this_thread::yield();
+		}
+	}
+
+	template<typename T>
+	inline T util::SpscQueue<T>::Pop()
+	{
+		T value;
+		while (!TryPop(value))
+		{
+			std::this_thread::yield();
+		}
+		return value;
+	}
+}
@@ -0,0 +1,422 @@
+#include "Sweep.h"
+#include "ActivationFuncs.h"
+#include "CostFuncs.h"
+#include "Random.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <numeric>
+#include <thread>
+
+namespace
+{
+	struct Trial
+	{
+		util::sweep::TrialResult result;
+		std::unique_ptr<net::cost::Cost<double>> cost;
+		std::unique_ptr<net::Network> network;
+	};
+
+	// what the brackets of one sweep add up to
+	struct State
+	{
+		std::vector<Trial> trials;
+		size_t epochs = 0;
+		bool hasBest = false;
+		size_t best = 0;
+	};
+
+	const char* Name(net::actf::ACTIVATION_TYPE type)
+	{
+		switch (type)
+		{
+		case net::actf::ACTIVATION_TYPE::SIGMOID:
+			return "sigmoid";
+		case net::actf::ACTIVATION_TYPE::RELU:
+			return "relu";
+		case net::actf::ACTIVATION_TYPE::SOFTMAX:
+			return "softmax";
+		default:
+			return "?";
+		}
+	}
+
+	const char* Name(net::cost::COST_TYPE type)
+	{
+		return type == net::cost::COST_TYPE::MSE ? "mse" : "cross_entropy";
+	}
+
+	std::string Topology(const std::vector<size_t>& layer_c)
+	{
+		std::string name;
+		for (size_t i = 0; i < layer_c.size(); i++)
+		{
+			name += (i == 0 ? "" : "-") + std::to_string(layer_c[i]);
+		}
+		return name;
+	}
+
+	// mean metric over the samples, with Infer so the validation set is only read
+	void Evaluate(const net::Network& network, const std::vector<util::DataPoint<double>>& validation, const net::cost::Cost<double>& metric, util::sweep::TrialResult& result)
+	{
+		double loss = 0.0;
+		size_t correct = 0;
+		for (const util::DataPoint<double>& dp : validation)
+		{
+			math::DMatrix output = network.Infer(dp.input);
+			for (size_t c = 0; c < output.GetSize(); c++)
+			{
+				loss += metric.Calculate(output[c], dp.expected[c]);
+			}
+			correct += std::max_element(output.begin(), output.end()) - output.begin() == std::max_element(dp.expected.begin(), dp.expected.end()) - dp.expected.begin();
+		}
+		loss /= std::max<size_t>(1, validation.size());
+		result.loss = std::isfinite(loss) ? loss : std::numeric_limits<double>::infinity();
+		result.accuracy = validation.empty() ? 0.0 : (double)correct / validation.size();
+	}
+
+	// trains each trial until it has epochs epochs and validates it, the trials are handed out to the workers one at a time
+	void RunRung(util::sweep::Dataset& data, const std::vector<Trial*>& trials, size_t epochs, const util::sweep::Options& options,
+		const util::numa::Topology& topology, const net::cost::Cost<double>& metric)
+	{
+		for (Trial* trial : trials)
+		{
+			data.Prepare(trial->result.config.batchSize);
+		}
+
+		size_t threads = std::max<size_t>(1, std::min(options.threads, trials.size()));
+		std::vector<int> cpus = util::numa::AssignCpus(topology, threads, options.pin);
+		std::atomic<size_t> next{ 0 };
+		auto work = [&](size_t w) {
+			util::trace::SetThreadName("sweep worker " + std::to_string(w));
+			bool pinned = util::numa::PinThread(cpus[w]);
+			for (size_t i = next++; i < trials.size(); i = next++)
+			{
+				Trial& trial = *trials[i];
+				util::trace::Span span{ "sweep trial", "sweep", (int64_t)trial.result.id };
+				auto start = std::chrono::steady_clock::now();
+
+				if (pinned)
+				{
+					int node = (int)topology.nodes[topology.NodeOfCpu(cpus[w])].physical;
+					if (trial.network->GetNode() != node)
+					{
+						trial.network->BindToNode(node);
+					}
+				}
+				const auto& batches = data.GetBatches(trial.result.config.batchSize);
+				for (; trial.result.epochs < epochs; trial.result.epochs++)
+				{
+					for (const auto& batch : batches)
+					{
+						trial.network->Learn(batch, trial.result.config.learnRate);
+					}
+				}
+				Evaluate(*trial.network, data.GetValidation(), metric, trial.result);
+
+				trial.result.seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			}
+		};
+
+		// even worker 0 gets a thread of its own, so the calling thread is never pinned
+		std::vector<std::thread> workers;
+		for (size_t w = 0; w < threads; w++)
+		{
+			workers.emplace_back(work, w);
+		}
+		for (std::thread& worker : workers)
+		{
+			worker.join();
+		}
+	}
+
+	// one bracket of successive halving over configs, the first rung trains for firstEpochs
+	void Bracket(util::sweep::Dataset& data, const std::vector<util::sweep::Config>& configs, size_t firstEpochs, size_t bracket,
+		const util::sweep::Options& options, const util::numa::Topology& topology, const net::cost::Cost<double>& metric, State& state)
+	{
+		// each network starts from the weights of its trial id, whichever worker thread later trains it
+		size_t first = state.trials.size();
+		for (const util::sweep::Config& config : configs)
+		{
+			Trial trial;
+			trial.result.id = state.trials.size();
+			trial.result.config = config;
+			trial.result.bracket = bracket;
+			trial.cost = net::cost::GetCost<double>(config.cost);
+			trial.network = std::make_unique<net::Network>(config.layer_c, trial.cost.get(),
+				net::actf::GetActivation(config.hiddenType), net::actf::GetActivation(config.outputType), 0.0, trial.result.id);
+			state.trials.push_back(std::move(trial));
+		}
+		std::vector<Trial*> alive;
+		for (size_t i = first; i < state.trials.size(); i++)
+		{
+			alive.push_back(&state.trials[i]);
+		}
+
+		size_t epochs = std::min(std::max<size_t>(1, firstEpochs), options.maxEpochs);
+		for (;;)
+		{
+			size_t before = 0;
+			for (Trial* trial : alive)
+			{
+				before += trial->result.epochs;
+			}
+			RunRung(data, alive, epochs, options, topology, metric);
+			state.epochs += alive.size() * epochs - before;
+
+			if (epochs >= options.maxEpochs)
+			{
+				break;
+			}
+
+			// stopped trials keep their results but give their networks back
+			std::stable_sort(alive.begin(), alive.end(), [](const Trial* a, const Trial* b) { return a->result.loss < b->result.loss; });
+			size_t keep = std::max<size_t>(1, alive.size() / std::max<size_t>(2, options.eta));
+			for (size_t i = keep; i < alive.size(); i++)
+			{
+				alive[i]->network.reset();
+			}
+			alive.resize(keep);
+			epochs = std::min(epochs * std::max<size_t>(2, options.eta), options.maxEpochs);
+		}
+
+		for (Trial* trial : alive)
+		{
+			size_t id = trial->result.id;
+			if (!state.hasBest || trial->result.loss < state.trials[state.best].result.loss)
+			{
+				if (state.hasBest)
+				{
+					state.trials[state.best].network.reset();
+				}
+				state.hasBest = true;
+				state.best = id;
+			}
+			else
+			{
+				trial->network.reset();
+			}
+		}
+	}
+
+	util::sweep::SweepResult Finish(State& state, const util::sweep::Options& options, std::chrono::steady_clock::time_point start)
+	{
+		util::sweep::SweepResult result;
+		for (Trial& trial : state.trials)
+		{
+			result.trials.push_back(trial.result);
+			result.coreSeconds += trial.result.seconds;
+		}
+		result.best = state.best;
+		if (state.hasBest)
+		{
+			result.bestNetwork = std::move(state.trials[state.best].network);
+			result.bestCost = std::move(state.trials[state.best].cost);
+		}
+		result.epochs = state.epochs;
+		result.gridEpochs = state.trials.size() * options.maxEpochs;
+		result.wallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		return result;
+	}
+}
+
+std::ostream& util::sweep::operator<<(std::ostream& out, const Config& config)
+{
+	return out << Topology(config.layer_c) << ' ' << Name(config.hiddenType) << '/' << Name(config.outputType) << ' ' << Name(config.cost)
+		<< " lr " << config.learnRate << " batch " << config.batchSize;
+}
+
+size_t util::sweep::SearchSpace::GetSize() const
+{
+	return topologies.size() * hiddenTypes.size() * outputTypes.size() * costs.size() * learnRates.size() * batchSizes.size();
+}
+
+util::sweep::Config util::sweep::SearchSpace::At(size_t index) const
+{
+	assert(index < GetSize());
+	Config config;
+	config.batchSize = batchSizes[index % batchSizes.size()];
+	index /= batchSizes.size();
+	config.learnRate = learnRates[index % learnRates.size()];
+	index /= learnRates.size();
+	config.cost = costs[index % costs.size()];
+	index /= costs.size();
+	config.outputType = outputTypes[index % outputTypes.size()];
+	index /= outputTypes.size();
+	config.hiddenType = hiddenTypes[index % hiddenTypes.size()];
+	index /= hiddenTypes.size();
+	config.layer_c = topologies[index];
+	return config;
+}
+
+std::vector<util::sweep::Config> util::sweep::SearchSpace::Grid() const
+{
+	std::vector<Config> configs;
+	for (size_t i = 0; i < GetSize(); i++)
+	{
+		configs.push_back(At(i));
+	}
+	return configs;
+}
+
+std::vector<util::sweep::Config> util::sweep::SearchSpace::Sample(size_t n, uint64_t stream) const
+{
+	util::Philox gen{ SEED, stream };
+	const size_t size = GetSize();
+	std::vector<size_t> indices(size);
+	std::iota(indices.begin(), indices.end(), 0);
+
+	// a partial Fisher-Yates shuffle gives distinct configurations until every one has been drawn
+	std::vector<Config> configs;
+	for (size_t i = 0; i < n; i++)
+	{
+		if (i < size)
+		{
+			std::swap(indices[i], indices[i + gen() % (size - i)]);
+			configs.push_back(At(indices[i]));
+		}
+		else
+		{
+			configs.push_back(At(gen() % size));
+		}
+	}
+	return configs;
+}
+
+util::sweep::Dataset::Dataset(std::vector<DataPoint<double>> train, std::vector<DataPoint<double>> validation)
+	: train(std::move(train)), validation(std::move(validation))
+{}
+
+void util::sweep::Dataset::Prepare(size_t batchSize)
+{
+	assert(batchSize > 0);
+	if (batches.count(batchSize))
+	{
+		return;
+	}
+	std::vector<std::vector<DataPoint<double>>>& sized = batches[batchSize];
+	for (size_t i = 0; i < train.size(); i += batchSize)
+	{
+		sized.emplace_back(train.begin() + i, train.begin() + std::min(train.size(), i + batchSize));
+	}
+}
+
+const std::vector<std::vector<util::DataPoint<double>>>& util::sweep::Dataset::GetBatches(size_t batchSize) const
+{
+	auto it = batches.find(batchSize);
+	assert(it != batches.end());
+	return it->second;
+}
+
+const std::vector<util::DataPoint<double>>& util::sweep::Dataset::GetTrain() const
+{
+	return train;
+}
+
+const std::vector<util::DataPoint<double>>& util::sweep::Dataset::GetValidation() const
+{
+	return validation;
+}
+
+void util::sweep::SweepResult::Report(std::ostream& out, size_t top) const
+{
+	out << trials.size() << " trials, " << epochs << " epochs trained instead of " << gridEpochs << " for all of them ("
+		<< std::fixed << std::setprecision(1) << (gridEpochs == 0 ? 0.0 : 100.0 * epochs / gridEpochs) << "%), "
+		<< std::setprecision(2) << coreSeconds << " core-s in " << wallSeconds << "s" << std::defaultfloat << std::setprecision(6) << '\n';
+
+	// the trials that got the full budget first, the ones stopped early after them
+	size_t maxEpochs = 0;
+	for (const TrialResult& trial : trials)
+	{
+		maxEpochs = std::max(maxEpochs, trial.epochs);
+	}
+	std::vector<const TrialResult*> order;
+	for (const TrialResult& trial : trials)
+	{
+		order.push_back(&trial);
+	}
+	std::stable_sort(order.begin(), order.end(), [maxEpochs](const TrialResult* a, const TrialResult* b) {
+		bool fullA = a->epochs == maxEpochs, fullB = b->epochs == maxEpochs;
+		return fullA != fullB ? fullA : a->loss < b->loss;
+	});
+	for (size_t i = 0; i < order.size() && i < top; i++)
+	{
+		const TrialResult& trial = *order[i];
+		out << (trial.id == best ? "* " : "  ") << "loss " << std::setw(10) << trial.loss << ", accuracy " << std::setw(6) << trial.accuracy * 100.0
+			<< "%, " << std::setw(3) << trial.epochs << " epochs: " << trial.config << '\n';
+	}
+}
+
+void util::sweep::SweepResult::WriteCsv(const std::string& path) const
+{
+	std::ofstream file{ path };
+	if (!file)
+	{
+		throw std::runtime_error("cannot open " + path + " for writing");
+	}
+	file << "id,bracket,topology,hidden,output,cost,learn_rate,batch_size,epochs,loss,accuracy,seconds,best\n";
+	file << std::setprecision(17);
+	for (const TrialResult& trial : trials)
+	{
+		const Config& config = trial.config;
+		file << trial.id << ',' << trial.bracket << ',' << Topology(config.layer_c) << ',' << Name(config.hiddenType) << ',' << Name(config.outputType)
+			<< ',' << Name(config.cost) << ',' << config.learnRate << ',' << config.batchSize << ',' << trial.epochs << ',' << trial.loss
+			<< ',' << trial.accuracy << ',' << trial.seconds << ',' << (trial.id == best && bestNetwork ? 1 : 0) << '\n';
+	}
+	if (!file)
+	{
+		throw std::runtime_error("write to " + path + " failed");
+	}
+}
+
+util::sweep::SweepResult util::sweep::SuccessiveHalving(Dataset& data, const std::vector<Config>& configs, const Options& options)
+{
+	auto start = std::chrono::steady_clock::now();
+	std::unique_ptr<net::cost::Cost<double>> metric = net::cost::GetCost<double>(options.metric);
+	numa::Topology topology = numa::Discover();
+
+	State state;
+	Bracket(data, configs, options.minEpochs, 0, options, topology, *metric, state);
+	return Finish(state, options, start);
+}
+
+util::sweep::SweepResult util::sweep::Hyperband(Dataset& data, const SearchSpace& space, const Options& options)
+{
+	auto start = std::chrono::steady_clock::now();
+	std::unique_ptr<net::cost::Cost<double>> metric = net::cost::GetCost<double>(options.metric);
+	numa::Topology topology = numa::Discover();
+
+	// s_max + 1 brackets, bracket s starts n = ceil((s_max + 1) / (s + 1) * eta^s) trials at maxEpochs / eta^s epochs
+	size_t eta = std::max<size_t>(2, options.eta);
+	size_t minEpochs = std::max<size_t>(1, options.minEpochs);
+	size_t sMax = 0;
+	for (size_t r = minEpochs * eta; r <= options.maxEpochs; r *= eta)
+	{
+		sMax++;
+	}
+
+	std::vector<size_t> counts;
+	size_t total = 0;
+	for (size_t s = sMax + 1; s-- > 0;)
+	{
+		size_t power = (size_t)std::pow((double)eta, (double)s);
+		counts.push_back(((sMax + 1) * power + s) / (s + 1));
+		total += counts.back();
+	}
+	std::vector<Config> configs = space.Sample(total, options.stream);
+
+	State state;
+	size_t used = 0;
+	for (size_t b = 0; b < counts.size(); b++)
+	{
+		size_t s = sMax - b;
+		size_t firstEpochs = std::max(minEpochs, options.maxEpochs / (size_t)std::pow((double)eta, (double)s));
+		std::vector<Config> bracket{ configs.begin() + used, configs.begin() + used + counts[b] };
+		used += counts[b];
+		Bracket(data, bracket, firstEpochs, b, options, topology, *metric, state);
+	}
+	return Finish(state, options, start);
+}
@@ -0,0 +1,105 @@
+#pragma once
+
+#include "Network.h"
+#include "Numa.h"
+#include "Parallel.h"
+#include <map>
+#include <limits>
+#include <ostream>
+
+namespace util
+{
+	// hyperparameter search: trials train side by side on one shared dataset and successive halving
+	// stops the worst of them early by validation loss
+	namespace sweep
+	{
+		struct Config
+		{
+			std::vector<size_t> layer_c;
+			net::actf::ACTIVATION_TYPE hiddenType = net::actf::ACTIVATION_TYPE::SIGMOID;
+			net::actf::ACTIVATION_TYPE outputType = net::actf::ACTIVATION_TYPE::SIGMOID;
+			net::cost::COST_TYPE cost = net::cost::COST_TYPE::MSE;
+			double learnRate = 0.05;
+			size_t batchSize = 100;
+		};
+
+		std::ostream& operator<<(std::ostream& out, const Config& config); // e.g. "2-3-2 sigmoid/sigmoid mse lr 0.05 batch 100"
+
+		// every combination of the listed values is one configuration
+		struct SearchSpace
+		{
+			std::vector<std::vector<size_t>> topologies;
+			std::vector<net::actf::ACTIVATION_TYPE> hiddenTypes{ net::actf::ACTIVATION_TYPE::SIGMOID };
+			std::vector<net::actf::ACTIVATION_TYPE> outputTypes{ net::actf::ACTIVATION_TYPE::SIGMOID };
+			std::vector<net::cost::COST_TYPE> costs{ net::cost::COST_TYPE::MSE };
+			std::vector<double> learnRates{ 0.05 };
+			std::vector<size_t> batchSizes{ 100 };
+
+			size_t GetSize() const;
+			Config At(size_t index) const; // index < GetSize(), batch sizes vary fastest
+			std::vector<Config> Grid() const;
+			std::vector<Config> Sample(size_t n, uint64_t stream) const; // uniformly from the given stream of SEED, all distinct unless n > GetSize()
+		};
+
+		// the samples every trial reads, batched once per batch size and never written while trials run
+		class Dataset
+		{
+		public:
+			Dataset(std::vector<DataPoint<double>> train, std::vector<DataPoint<double>> validation);
+		public:
+			void Prepare(size_t batchSize); // builds the batches of that size, not thread-safe
+			const std::vector<std::vector<DataPoint<double>>>& GetBatches(size_t batchSize) const; // Prepare must have been called for it
+
+			const std::vector<DataPoint<double>>& GetTrain() const;
+			const std::vector<DataPoint<double>>& GetValidation() const;
+		private:
+			std::vector<DataPoint<double>> train;
+			std::vector<DataPoint<double>> validation;
+			std::map<size_t, std::vector<std::vector<DataPoint<double>>>> batches;
+		};
+
+		struct Options
+		{
+			size_t minEpochs = 1; // budget of the first rung, an epoch is one pass over the training samples
+			size_t maxEpochs = 27; // budget of the last rung, what every survivor is trained for in the end
+			size_t eta = 3; // each rung keeps the best 1 / eta of its trials and trains them eta times longer
+			size_t threads = HardwareThreads(); // trials trained at once
+			numa::PIN_POLICY pin = numa::PIN_POLICY::NONE; // any other policy also binds each trial's network to its worker's node
+			net::cost::COST_TYPE metric = net::cost::COST_TYPE::MSE; // validation loss, the same for every trial whatever cost it trains with
+			uint64_t stream = 0; // Hyperband samples the search space from this stream of SEED
+		};
+
+		struct TrialResult
+		{
+			size_t id = 0;
+			Config config;
+			size_t bracket = 0;
+			size_t epochs = 0; // trained in total, less than maxEpochs if it was stopped early
+			double loss = std::numeric_limits<double>::infinity(); // validation loss after its last rung, infinity if it diverged
+			double accuracy = 0.0; // fraction of validation samples whose largest output is the expected class
+			double seconds = 0.0; // training and validation time on one core
+		};
+
+		struct SweepResult
+		{
+			std::vector<TrialResult> trials; // by id
+			size_t best = 0; // the lowest loss among the trials trained for maxEpochs
+			std::unique_ptr<net::Network> bestNetwork;
+			std::unique_ptr<net::cost::Cost<double>> bestCost; // the cost bestNetwork trains with
+
+			size_t epochs = 0; // over all trials
+			size_t gridEpochs = 0; // training every trial for maxEpochs instead
+			double coreSeconds = 0.0;
+			double wallSeconds = 0.0;
+
+			void Report(std::ostream& out, size_t top = 5) const;
+			void WriteCsv(const std::string& path) const; // one line per trial, throws std::runtime_error if the file cannot be written
+		};
+
+		// trains every configuration for minEpochs, keeps the best 1 / eta, trains those eta times longer, ... up to maxEpochs
+		SweepResult SuccessiveHalving(Dataset& data, const std::vector<Config>& configs, const Options& options);
+		// brackets of successive halving from many trials starting at minEpochs down to a few trained for maxEpochs
+		// straight away, so a configuration that starts slow still gets a full run, configurations are sampled from space
+		SweepResult Hyperband(Dataset& data, const SearchSpace& space, const Options& options);
+	}
+}
@@ -0,0 +1,252 @@
+#include "Trace.h"
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <map>
+#include <fstream>
+#include <iomanip>
+#include <stdexcept>
+
+namespace
+{
+	struct Event
+	{
+		const char* name;
+		const char* category;
+		int64_t start;
+		int64_t duration;
+		int64_t index;
+		uint32_t tid;
+	};
+
+	// only its owner thread writes, count is published after every event so Write can read while recording goes on
+	struct Buffer
+	{
+		std::unique_ptr<Event[]> events;
+		size_t capacity = 0;
+		std::atomic<size_t> count{ 0 };
+		std::atomic<size_t> dropped{ 0 };
+	};
+
+	std::mutex _mtx; // buffer lists and thread names, taken once per thread and by Write, never per event
+	std::vector<std::unique_ptr<Buffer>> _buffers;
+	std::vector<Buffer*> _free; // of threads that exited, their events are kept and new threads append to them
+	std::map<uint32_t, std::string> _names;
+
+	std::atomic<uint32_t> _nextTid{ 1 };
+	std::atomic<double> _sampleRate{ 1.0 };
+	std::atomic<size_t> _capacity{ (size_t)1 << 16 };
+	const std::chrono::steady_clock::time_point _origin = std::chrono::steady_clock::now();
+
+	int64_t Now()
+	{
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - _origin).count();
+	}
+
+	struct ThreadState
+	{
+		Buffer* buffer = nullptr;
+		uint32_t tid = _nextTid.fetch_add(1);
+		size_t sampleDepth = 0; // open sampled spans
+		bool picked = false; // whether the outermost open sampled span is recorded
+		double credit = 1.0; // picks every 1 / rate-th sampled span, starting with the first
+
+		~ThreadState()
+		{
+			if (buffer)
+			{
+				std::lock_guard<std::mutex> lock{ _mtx };
+				_free.push_back(buffer);
+			}
+		}
+
+		Buffer& Get()
+		{
+			if (buffer)
+			{
+				return *buffer;
+			}
+			std::lock_guard<std::mutex> lock{ _mtx };
+			if (!_free.empty())
+			{
+				buffer = _free.back();
+				_free.pop_back();
+				return *buffer;
+			}
+			_buffers.push_back(std::make_unique<Buffer>());
+			buffer = _buffers.back().get();
+			buffer->capacity = _capacity.load();
+			buffer->events = std::make_unique<Event[]>(buffer->capacity);
+			return *buffer;
+		}
+	};
+
+	thread_local ThreadState _thread;
+
+	void WriteString(std::ostream& out, const std::string& value)
+	{
+		out << '"';
+		for (char c : value)
+		{
+			if (c == '"' || c == '\\')
+			{
+				out << '\\';
+			}
+			out << c;
+		}
+		out << '"';
+	}
+}
+
+void util::trace::Enable(double sampleRate, size_t bufferEvents)
+{
+	_sampleRate.store(sampleRate);
+	_capacity.store(bufferEvents); // threads that already have a buffer keep its size
+	_enabled.store(true);
+}
+
+void util::trace::Disable()
+{
+	_enabled.store(false);
+}
+
+void util::trace::SetThreadName(const std::string& name)
+{
+	uint32_t tid = _thread.tid;
+	std::lock_guard<std::mutex> lock{ _mtx };
+	_names[tid] = name;
+}
+
+void util::trace::Span::Begin(const char* name, const char* category, int64_t index, bool sampled)
+{
+	ThreadState& thread = _thread;
+	this->name = name;
+	this->category = category;
+	this->index = index;
+	open = true;
+
+	// nested sampled spans follow the outermost one
+	if (sampled)
+	{
+		sampleRoot = true;
+		if (thread.sampleDepth++ == 0)
+		{
+			thread.credit += _sampleRate.load(std::memory_order_relaxed);
+			thread.picked = thread.credit >= 1.0;
+			if (thread.picked)
+			{
+				thread.credit -= 1.0;
+			}
+		}
+	}
+	if (thread.sampleDepth > 0 && !thread.picked)
+	{
+		return;
+	}
+	start = Now();
+}
+
+void util::trace::Span::End()
+{
+	ThreadState& thread = _thread;
+	if (start >= 0)
+	{
+		int64_t end = Now();
+		Buffer& buffer = thread.Get();
+		size_t n = buffer.count.load(std::memory_order_relaxed);
+		if (n == buffer.capacity)
+		{
+			buffer.dropped.fetch_add(1, std::memory_order_relaxed);
+		}
+		else
+		{
+			buffer.events[n] = Event{ name, category, start, end - start, index, thread.tid };
+			buffer.count.store(n + 1, std::memory_order_release);
+		}
+	}
+	if (sampleRoot)
+	{
+		thread.sampleDepth--;
+	}
+}
+
+util::trace::Stats util::trace::GetStats()
+{
+	std::lock_guard<std::mutex> lock{ _mtx };
+	Stats stats;
+	for (const auto& buffer : _buffers)
+	{
+		stats.events += buffer->count.load(std::memory_order_acquire);
+		stats.dropped += buffer->dropped.load(std::memory_order_relaxed);
+	}
+	stats.threads = _buffers.size();
+	return stats;
+}
+
+void util::trace::Clear()
+{
+	std::lock_guard<std::mutex> lock{ _mtx };
+	for (const auto& buffer : _buffers)
+	{
+		buffer->count.store(0);
+		buffer->dropped.store(0);
+	}
+}
+
+void util::trace::Write(std::ostream& out)
+{
+	std::lock_guard<std::mutex> lock{ _mtx };
+	out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+	bool first = true;
+	auto separator = [&] {
+		out << (first ? "\n" : ",\n");
+		first = false;
+	};
+
+	for (const auto& [tid, name] : _names)
+	{
+		separator();
+		out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << tid << ",\"args\":{\"name\":";
+		WriteString(out, name);
+		out << "}}";
+	}
+
+	// timestamps and durations are in microseconds
+	std::ios::fmtflags flags = out.flags();
+	std::streamsize precision = out.precision();
+	out << std::fixed << std::setprecision(3);
+	for (const auto& buffer : _buffers)
+	{
+		size_t n = buffer->count.load(std::memory_order_acquire);
+		for (size_t i = 0; i < n; i++)
+		{
+			const Event& e = buffer->events[i];
+			separator();
+			out << "{\"name\":\"" << e.name << "\",\"cat\":\"" << e.category << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << e.tid
+				<< ",\"ts\":" << e.start / 1e3 << ",\"dur\":" << e.duration / 1e3;
+			if (e.index >= 0)
+			{
+				out << ",\"args\":{\"index\":" << e.index << '}';
+			}
+			out << '}';
+		}
+	}
+	out.flags(flags);
+	out.precision(precision);
+	out << "\n]}\n";
+}
+
+void util::trace::Write(const std::string& path)
+{
+	std::ofstream file{ path };
+	if (!file)
+	{
+		throw std::runtime_error("cannot open " + path);
+	}
+	Write(file);
+	if (!file)
+	{
+		throw std::runtime_error("cannot write " + path);
+	}
+}
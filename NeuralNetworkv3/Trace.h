@@ -0,0 +1,76 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <ostream>
+
+namespace util
+{
+	// timeline tracing in the Chrome trace event format, open the output in chrome://tracing or ui.perfetto.dev
+	// every thread records into its own buffer without locking, a disabled span costs one relaxed load
+	namespace trace
+	{
+		inline std::atomic<bool> _enabled{ false };
+
+		// sampleRate is the fraction of sampled spans (one per batch) recorded together with everything inside them,
+		// spans outside a sampled span are always recorded
+		// bufferEvents is the capacity of each thread's buffer, events beyond it are dropped and counted
+		void Enable(double sampleRate = 1.0, size_t bufferEvents = (size_t)1 << 16);
+		void Disable();
+		inline bool IsEnabled()
+		{
+			return _enabled.load(std::memory_order_relaxed);
+		}
+
+		void SetThreadName(const std::string& name); // shown instead of the thread id
+
+		// records the time from construction to destruction on the calling thread
+		// name and category must outlive the trace, string literals in practice, index is shown as an argument if >= 0
+		class Span
+		{
+		public:
+			Span(const char* name, const char* category, int64_t index = -1, bool sampled = false)
+			{
+				if (IsEnabled())
+				{
+					Begin(name, category, index, sampled);
+				}
+			}
+			~Span()
+			{
+				if (open)
+				{
+					End();
+				}
+			}
+
+			Span(const Span&) = delete;
+			Span& operator=(const Span&) = delete;
+		private:
+			void Begin(const char* name, const char* category, int64_t index, bool sampled);
+			void End();
+		private:
+			const char* name = nullptr;
+			const char* category = nullptr;
+			int64_t index = -1;
+			int64_t start = -1; // ns since Enable, -1 if this span is not recorded
+			bool open = false;
+			bool sampleRoot = false;
+		};
+
+		struct Stats
+		{
+			size_t events = 0;
+			size_t dropped = 0; // buffers were full
+			size_t threads = 0;
+		};
+
+		Stats GetStats();
+		void Clear(); // drops every recorded event, no span may be open on any thread
+
+		// writes the recorded events as {"traceEvents": [...]}, safe while other threads keep recording
+		void Write(std::ostream& out);
+		void Write(const std::string& path); // throws std::runtime_error if the file cannot be written
+	}
+}
@@ -40,6 +40,7 @@ util::Trainer::Trainer(std::vector<DataPoint<double>>& data, size_t batchSize, f
 
 void util::Trainer::Train(net::Network& net, double learnRate, size_t index)
 {
+	trace::Span span{ "Trainer::Train", "train", (int64_t)index, true };
 	net.Learn(trainBatches[index], learnRate);
 }
 
@@ -2,6 +2,7 @@
 
 #include <random>
 #include "Matrix.h"
+#include "Random.h"
 #include <memory>
 
 #define SEED 4252452
@@ -11,8 +12,8 @@ namespace util
 	template<typename T>
 	struct DataPoint
 	{
-		DataPoint(math::Matrix<T> input, math::Matrix<T> expected) : input(input), expected(expected) {};
-		DataPoint(math::Matrix<T> input, math::Matrix<T> expected, math::Matrix<T> output) : output(output), expected(expected), input(input) {};
+		DataPoint(math::Matrix<T> input, math::Matrix<T> expected) : input(std::move(input)), expected(std::move(expected)) {};
+		DataPoint(math::Matrix<T> input, math::Matrix<T> expected, math::Matrix<T> output) : input(std::move(input)), expected(std::move(expected)), output(std::move(output)) {};
 		DataPoint() = default;
 
 		math::Matrix<T> input;
@@ -21,12 +22,17 @@ namespace util
 		T label;
 	};
 
-	inline std::random_device _rd;
-	inline std::mt19937 _rng(SEED);
+	// every thread draws from its own stream of SEED, streams are handed out in the order threads first call Random
+	inline Philox& ThreadRng()
+	{
+		thread_local Philox rng{ SEED, NextStream(STREAM_THREAD) };
+		return rng;
+	}
+
 	template<typename T, typename distr>
 	inline T Random(distr dist)
 	{
-		return dist(_rng);
+		return dist(ThreadRng());
 	}
 
 	template<typename T>